@@ -0,0 +1,233 @@
+// ### Description #############################################################
+// Per-frame latency tracing.
+//
+// Build with -DLAT_TRACE to carry a timestamp per hop in every ethfrm_t and
+// queue record, and to keep a latency histogram per hop:
+//	LAT_RX		frame received (recvfrom, or recv_vlc_frm at the station)
+//	LAT_PUSH	frame queued
+//	LAT_POP		frame taken from the queue
+//	LAT_TX_FIRST	start of transmission (first send_ofdm_sym, or sendto)
+//	LAT_TX_LAST	end of transmission (last send_ofdm_sym done, sendto done)
+// RX->PUSH and POP->TX_FIRST are CPU time, PUSH->POP is queueing,
+// TX_FIRST->TX_LAST is PHY time.
+//
+// Timestamps come from the cycle counter: rdtsc on x86, CNTVCT on ARMv8 and
+// PMU CCNT on ARMv7 with -DLAT_CCNT (needs user access to the PMU enabled by
+// the kernel, PMUSERENR, or it traps). Other targets use CLOCK_MONOTONIC_RAW.
+//
+// Add -DLAT_TRACE_USDT to also fire USDT probes lifi:hop(hop, bytes, ts) and
+// lifi:frame(bytes, total) for perf, bpftrace or SystemTap (needs sys/sdt.h
+// from systemtap-sdt-dev).
+//
+// Without LAT_TRACE every macro is empty and frames carry no timestamps.
+
+#ifndef _LAT_TRACE_H_
+#define _LAT_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+// ### Defines #################################################################
+#define LAT_RX			0
+#define LAT_PUSH		1
+#define LAT_POP			2
+#define LAT_TX_FIRST	3
+#define LAT_TX_LAST		4
+#define LAT_HOPS		5
+// Histogram: 8 linear sub-buckets per power of 2, at most 12.5% error
+#define LAT_SUB_BITS	3
+#define LAT_BKT			(64 << LAT_SUB_BITS)
+// Seconds between two histogram prints
+#define LAT_PRINT_S		10
+
+// ### Struct definitions ######################################################
+typedef struct lat_ts_t
+{
+	uint64_t t[LAT_HOPS];			// Cycle counter at each hop, 0 if not seen
+} lat_ts_t;
+
+typedef struct lat_hist_t
+{
+	uint64_t count[LAT_HOPS][LAT_BKT];	// Hop i: t[i] - t[i-1], hop 0: total
+	uint64_t max[LAT_HOPS];
+	uint64_t frames;
+	double hz;						// Cycle counter frequency
+} lat_hist_t;
+
+#ifdef LAT_TRACE
+
+#ifdef LAT_TRACE_USDT
+#include <sys/sdt.h>
+#define LAT_TP_HOP(hop, bytes, ts)	DTRACE_PROBE3(lifi, hop, hop, bytes, ts)
+#define LAT_TP_FRAME(bytes, total)	DTRACE_PROBE2(lifi, frame, bytes, total)
+#else
+// Without probes the frame length is not used
+#define LAT_TP_HOP(hop, bytes, ts)	(void)(bytes)
+#define LAT_TP_FRAME(bytes, total)	(void)(bytes)
+#endif
+
+// ### Variables ###############################################################
+static lat_hist_t lat_hist;
+
+// ### Functions ###############################################################
+static inline uint64_t lat_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t t;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#elif defined(__arm__) && defined(LAT_CCNT)
+	uint32_t t;
+	__asm__ volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(t));
+	return t;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// *** a - b, CCNT is 32 bits and wraps in seconds ***
+static inline uint64_t lat_diff(uint64_t a, uint64_t b)
+{
+#if defined(__arm__) && defined(LAT_CCNT)
+	return (uint32_t)(a - b);
+#else
+	return a - b;
+#endif
+}
+
+static inline uint64_t lat_mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// *** Measure the cycle counter against the clock for 20 ms ***
+static inline void lat_init(void)
+{
+	uint64_t t0, c0, t1, c1;
+
+	t0 = lat_mono_ns();
+	c0 = lat_now();
+	do
+		t1 = lat_mono_ns();
+	while (t1 - t0 < 20000000ULL);
+	c1 = lat_now();
+	lat_hist.hz = (double)lat_diff(c1, c0) * 1e9 / (double)(t1 - t0);
+}
+
+static inline uint32_t lat_bucket(uint64_t d)
+{
+	uint32_t e;
+
+	if (d < (1 << LAT_SUB_BITS))
+		return (uint32_t)d;
+	e = 63 - __builtin_clzll(d);
+	return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) |
+			(uint32_t)((d >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+// Lower bound of a bucket, in cycles
+static inline uint64_t lat_bucket_val(uint32_t b)
+{
+	uint32_t e = b >> LAT_SUB_BITS;
+
+	if (e == 0)
+		return b;
+	return (uint64_t)((1 << LAT_SUB_BITS) | (b & ((1 << LAT_SUB_BITS) - 1)))
+			<< (e - 1);
+}
+
+static inline void lat_stamp(lat_ts_t *ts, uint8_t hop, uint16_t bytes)
+{
+	ts->t[hop] = lat_now();
+	LAT_TP_HOP(hop, bytes, ts->t[hop]);
+}
+
+// *** Add a frame that left on the last hop, called by one thread ***
+static inline void lat_record(lat_ts_t *ts, uint16_t bytes)
+{
+	uint64_t d;
+	uint8_t i;
+
+	if (ts->t[LAT_RX] == 0 || ts->t[LAT_TX_LAST] == 0)
+		return;
+	for (i = 0; i < LAT_HOPS; i++)
+	{
+		if (i == 0)
+			d = lat_diff(ts->t[LAT_TX_LAST], ts->t[LAT_RX]);
+		else if (ts->t[i] && ts->t[i-1])
+			d = lat_diff(ts->t[i], ts->t[i-1]);
+		else
+			continue;
+		__atomic_fetch_add(&lat_hist.count[i][lat_bucket(d)], 1, __ATOMIC_RELAXED);
+		if (d > lat_hist.max[i])
+			lat_hist.max[i] = d;
+	}
+	__atomic_fetch_add(&lat_hist.frames, 1, __ATOMIC_RELAXED);
+	LAT_TP_FRAME(bytes, lat_diff(ts->t[LAT_TX_LAST], ts->t[LAT_RX]));
+}
+
+// *** Percentiles per hop in microseconds ***
+static inline void lat_print(void)
+{
+	const char *name[LAT_HOPS] = {"total", "rx-push", "push-pop", "pop-tx", "tx-phy"};
+	const double pct[4] = {0.50, 0.90, 0.99, 0.999};
+	double us = 1e6 / lat_hist.hz, v[4];
+	uint64_t n, sum;
+	uint32_t b;
+	uint8_t i, k;
+
+	printf("Latency (us), %llu frames\n", (unsigned long long)lat_hist.frames);
+	printf("%-9s %10s %10s %10s %10s %10s\n", "hop", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < LAT_HOPS; i++)
+	{
+		for (n = 0, b = 0; b < LAT_BKT; b++)
+			n += lat_hist.count[i][b];
+		if (n == 0)
+			continue;
+		for (k = 0; k < 4; k++)
+		{
+			for (sum = 0, b = 0; b < LAT_BKT; b++)
+			{
+				sum += lat_hist.count[i][b];
+				if (sum >= (uint64_t)(pct[k] * n + 0.5))
+					break;
+			}
+			v[k] = lat_bucket_val(b) * us;
+		}
+		printf("%-9s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name[i],
+				v[0], v[1], v[2], v[3], lat_hist.max[i] * us);
+	}
+}
+
+// *** Print the histogram every LAT_PRINT_S seconds ***
+static inline void *lat_print_handler(void *arg)
+{
+	(void)arg;
+	while (1)
+	{
+		sleep(LAT_PRINT_S);
+		lat_print();
+	}
+	return NULL;
+}
+
+#define LAT_STAMP(ts, hop, bytes)	lat_stamp(ts, hop, bytes)
+#define LAT_RECORD(ts, bytes)		lat_record(ts, bytes)
+
+#else
+
+#define LAT_STAMP(ts, hop, bytes)
+#define LAT_RECORD(ts, bytes)
+
+#endif
+
+#endif
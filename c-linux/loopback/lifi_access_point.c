@@ -7,6 +7,11 @@
 //  					 LiFi Station                      LiFi Access Point
 // 	client_ethernet -> red_pi(eth0->irc) -> irc channel -> red_pi(irc->wlan0) -> wifi_router -> internet
 //	client_ethernet <- red_pi(eth0<-vlc) <- vlc channel <- red_pi(vlc<-wlan0) <- wifi_router <- internet
+//
+// VLC TX: axi_vlctx_control queues up to a frame of symbols, send_ofdm_sym()
+// only waits while its FIFO is full. Build with -DVLC_TX_DMA to collect the
+// symbols of a frame in DDR and push them with the AXI DMA (MM2S, simple mode)
+// at the end of the frame instead of writing the data registers.
 
 // ### Includes ################################################################
 #include <stdint.h>
@@ -32,10 +37,25 @@
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <time.h>
+#if defined(VLC_TX_DMA) && !defined(PHY_SIM)
+void send_ofdm_flush(void);
+#define VLC_TX_END()	send_ofdm_flush()
+#endif
+#include "lifi_mac.h"
+#include "link_cap.h"
+#ifdef PHY_SIM
+#include "phy_sim.h"
+#else
+#include "phy_poll.h"
+#endif
 
 // ### Configuration ###########################################################
 // This iface is connected to WiFi router
+#ifdef PHY_SIM
+#define WLAN_IFACE				"lifi_wlan0"	// veth made by lifi_replay
+#else
 #define WLAN_IFACE				"wlan0"
+#endif
 // WiFi router, TP-Link_MR3020, 192.168.1.1
 #define MAC_WIFI_ROUTER_1		0x7C
 #define MAC_WIFI_ROUTER_2		0x8B 
@@ -50,69 +70,107 @@
 #define MAC_WLAN_4				0xA8
 #define MAC_WLAN_5				0x87
 #define MAC_WLAN_6				0x10
+// Number of LiFi stations, station ID 0 ~ NUM_STA-1
+#define NUM_STA					1
+#if NUM_STA > MAX_STA
+#error "NUM_STA must be 1 ~ MAX_STA"
+#endif
+// Downlink scheduler, SCHED_TDMA or SCHED_DRR
+#define DL_SCHED_MODE			SCHED_DRR
+// Client IP behind each station. Replies to flows a station started are sent
+// to it as well, any other downlink frame is broadcast to all stations.
+#define IP_STA_0				"192.168.3.1"
+// WLAN receive workers, each on its own socket of a PACKET_FANOUT_HASH group.
+// The kernel hashes every flow to one socket, so the frames of a flow keep
+// their order. 1 receives on a single socket without fanout.
+#define WLAN_RX_WORKERS			1
+// Downlink fragment size in bytes, 0 sends every frame whole. Needed when
+// LINK_MTU is above FRAM_SIZE. A frame is at most FRAG_MAX fragments.
+#ifndef DL_FRAG_SIZE
+#define DL_FRAG_SIZE			0
+#endif
+// Uplink frames a station may send per poll
+#define UL_GRANT				4
+// Time a polled station has to start answering
+#define UL_POLL_TIMEOUT_US		20000
+// Pause after a polling round in which no station had data
+#define UL_IDLE_US				1000
+// Link capture file, with -DLINK_CAP (link_cap.h)
+#define LINK_CAP_FILE			"lifi_ap.pcapng"
 
 // ### Defines #################################################################
 // *** PHY address ***
 #define AXI_VLC_TX		0x41200000
 #define AXI_IRC_RX 		0x41230000
-// *** Ethernet ***
-#define FRAM_SIZE		1518
-// *** OFDM ***
-#define OFDM_WORD		4
-#define OFDM_BYTE		15
-#define OFDM_BIT		120
-
+#ifdef VLC_TX_DMA
+#define AXI_DMA_TX		0x40400000
+// Symbol buffer in DDR kept from Linux (e.g. mem= on the kernel command line),
+// two halves: one is filled while the DMA reads the other
+#define VLC_DMA_BUF		0x1FF00000
+#define VLC_DMA_HALF	(SCHED_SLOT_SYM * OFDM_WORD)	// Words
+#endif
+// *** axi_vlctx_control ***
+#define VLCTX_FULL		(1 << 11)
+#define VLCTX_SRC_DMA	(1 << 14)
+// Stream words per symbol, BPSK 1, QPSK 2, QAM-16 4
+#define VLC_SYM_WORD	((VLC_MOD == 0) ? 1 : ((VLC_MOD == 1) ? 2 : 4))
 // *** Uplink ******************************************************************
-// Ring buffer size
-#define BUFF_UP_SIZE 	2048
+// Ring buffer size in bytes, power of 2
+#define BUFF_UP_SIZE 	(1 << 20)
+// Flow table size, power of 2
+#define FLOW_SIZE		1024
 
 // *** Downlink ****************************************************************
-// Ring buffer size
-#define BUFF_DL_SIZE 	2048
-
-#define HEADER_MISSING	1
-#define ACK_FOUND		2
-
-// ### Struct definitions ######################################################
-typedef struct pseudotcp_t
-{
-	uint32_t saddr;
-	uint32_t daddr;
-	uint8_t zero;
-	uint8_t protocol;
-	uint16_t len;
-} pseudotcp_t;
-
-typedef struct ethfrm_t
-{
-	uint8_t data[FRAM_SIZE];	// Ethernet packet data
-	uint16_t bytes;				// Ethernet packet length
-} ethfrm_t;
-
-typedef struct ofdmsym_t
-{
-	uint32_t data[OFDM_WORD];	// OFDM symbol data
-	uint16_t bytes;				// Number of data bytes
-} ofdmsym_t;
+// Ring buffer size in bytes, shared by the station queues and the broadcast
+// queue (each rounded down to a power of 2)
+#define BUFF_DL_SIZE 	(1 << 20)
+#define BUFF_DL_BCAST	NUM_STA
+#if (LINK_MTU > FRAM_SIZE) && (DL_FRAG_SIZE == 0)
+#error "LINK_MTU above FRAM_SIZE needs DL_FRAG_SIZE"
+#endif
+#if DL_FRAG_SIZE > (FRAM_SIZE - FRAG_HDR_SIZE)
+#error "DL_FRAG_SIZE does not fit in a VLC frame"
+#endif
+#if (DL_FRAG_SIZE > 0) && ((LINK_MTU + DL_FRAG_SIZE-1) / DL_FRAG_SIZE > FRAG_MAX)
+#error "LINK_MTU needs more than FRAG_MAX fragments of DL_FRAG_SIZE"
+#endif
+// PACKET_FANOUT group of the WLAN receive sockets
+#define WLAN_FANOUT_ID	0x4C46
 
 // ### Variables ###############################################################
 // *** PHY memory map ***
 int fd_mem;
+#ifdef PHY_SIM
+static phy_sim_port_t phy_port;
+#else
 static volatile uint32_t *vlc_tx_p;
 static volatile uint32_t *ook_rx_p;
-// *** Socket ***
+static phy_poll_t poll_vlc_tx, poll_irc_rx;
+// Bytes of the last packed read not yet returned, bytes known in the RX FIFO
+static uint32_t irc_rx_word;
+static uint8_t irc_rx_n;
+static uint32_t irc_rx_avail;
+#ifdef VLC_TX_DMA
+static volatile uint32_t *dma_tx_p;
+static volatile uint32_t *dma_buf_p;
+static uint32_t dma_words;				// Words in the half being filled
+static uint8_t dma_half;
+static uint8_t dma_run;					// A transfer was started
+#endif
+#endif
+// *** Socket, fd_sock sends and is also the first receive socket ***
 int fd_sock;
-struct sockaddr saddr;
-int saddr_len;
+int fd_rx[WLAN_RX_WORKERS];
 
 // *** Uplink ******************************************************************
 // *** Thread ***
 pthread_t thread_recvirc, thread_sendwlan;
-pthread_mutex_t mutex_up = PTHREAD_MUTEX_INITIALIZER;
 // *** Ethernet frame fifo buffer ***
-struct ethfrm_t buff_up[BUFF_UP_SIZE];
-uint16_t head_up = 0, tail_up = 0;
-uint8_t empty_up = 1, full_up = 0;
+struct staq_t buff_up;
+// *** Polling statistics per station, printed with PHY_POLL_STATS ***
+uint32_t ul_frames[NUM_STA], ul_timeout[NUM_STA], ul_error[NUM_STA];
+// *** Uplink flows, protocol << 24 | client port << 8 | station ***
+volatile uint32_t flow[FLOW_SIZE];
 // WiFi router's MAC
 uint8_t mac_wifi_router[6] = 
 {
@@ -126,12 +184,19 @@ uint8_t mac_wifi_router[6] =
 
 // *** Downlink ****************************************************************
 // *** Thread ***
-pthread_t thread_recvwlan, thread_sendvlc;
-pthread_mutex_t mutex_dl = PTHREAD_MUTEX_INITIALIZER;
-// *** Ethernet frame fifo buffer ***
-struct ethfrm_t buff_dl[BUFF_DL_SIZE];
-uint16_t head_dl = 0, tail_dl = 0;
-uint8_t empty_dl = 1, full_dl = 0;
+pthread_t thread_recvwlan[WLAN_RX_WORKERS], thread_sendvlc;
+// *** Ethernet frame fifo buffer, one per station plus broadcast ***
+struct staq_t buff_dl[NUM_STA+1];
+// *** Downlink scheduler ***
+struct dl_sched_t dl_sched;
+// Fragment sequence per station plus broadcast
+uint8_t dl_seq[NUM_STA+1];
+// Stations' client IP
+char *ip_sta[NUM_STA] =
+{
+	IP_STA_0
+};
+in_addr_t addr_sta[NUM_STA];
 // WLAN's MAC
 uint8_t mac_wlan[6] =
 {
@@ -144,30 +209,29 @@ uint8_t mac_wlan[6] =
 };
 
 // *** ACK *********************************************************************
+// Last uplink burst was acknowledged by the station
 uint8_t ack = 0;
-uint8_t send_ack_flag = 0;
-pthread_t thread_sendack;
-pthread_mutex_t mutex_ack, mutex_ofdmtx, mutex_ackflag = 
-		PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t mutex_ack = PTHREAD_MUTEX_INITIALIZER;
+
+// *** VLC TX scheduler ********************************************************
+// sendvlc_handler is the only thread writing the VLC TX registers, the other
+// threads hand it polls, ACKs and downlink frames
+uint8_t poll_req = 0, poll_sta = 0;
+uint32_t dl_pending = 0;		// Frames in the downlink buffers
+uint32_t ack_pending = 0;		// Bit n: uplink frames of station n to ACK
+pthread_mutex_t mutex_vlctx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_vlctx = PTHREAD_COND_INITIALIZER;
 
 // ### Function prototypes #####################################################
 // *** PHY layer initialization ***
 void phy_init(void);
+#if defined(PHY_POLL_STATS) && !defined(PHY_SIM)
+void *phy_poll_print_handler();
+#endif
 
 // *** Ethernet frame functions *** 
 void ethfrm_set(ethfrm_t *ethfrm, uint8_t *data, uint16_t bytes);
 void ethfrm_print(ethfrm_t ethfrm);
-// *** Data link layer functions ***
-void send_vlc_frm(struct ethfrm_t ethfrm);
-uint8_t recv_irc_frm(struct ethfrm_t *ethfrm);
-void send_ack(void);
-// *** PHY layer functions ***
-void send_ofdm_sym(ofdmsym_t ofdmsym);
-void recv_ook_sym(uint8_t *data);
-
-// *** Checksum ***
-unsigned short checksum(unsigned short *buff, int _16bitword);
-unsigned short checksumtcp(const char *buff, unsigned size);
 
 // *** Uplink ******************************************************************
 // *** Thread handler ***
@@ -177,22 +241,34 @@ void *sendwlan_handler();
 uint8_t buff_up_push(ethfrm_t ethfrm);
 uint8_t buff_up_pop(ethfrm_t *ethfrm);
 void buff_up_print(void);
+// *** Flow table functions ***
+uint8_t flow_key(ethfrm_t *ethfrm, uint8_t uplink, uint32_t *key);
+void flow_learn(ethfrm_t *ethfrm, uint8_t sta);
 
 // *** Downlink ****************************************************************
 // *** Thread handler ***
-void *recvwlan_handler();
+void *recvwlan_handler(void *arg);
 void *sendvlc_handler();
+// *** Socket functions ***
+int wlan_rx_open(void);
 // *** FIFO buffer functions ***
-uint8_t buff_dl_push(ethfrm_t ethfrm);
-uint8_t buff_dl_pop(ethfrm_t *ethfrm);
+void buff_dl_init(void);
+uint8_t buff_dl_push(uint8_t sta, ethfrm_t ethfrm);
 void buff_dl_print(void);
+uint8_t dl_classify(ethfrm_t *ethfrm);
 
-// *** ACK *********************************************************************
-void *sendack_handler();
+// *** VLC TX scheduler ********************************************************
+void vlc_tx_poll(uint8_t sta);
+void vlc_tx_ack(uint8_t sta);
+void vlc_tx_data(void);
+uint8_t vlc_tx_take_ack(uint8_t sta);
 
 // ### Main ####################################################################
 int main()
 {
+	int i;
+
+#ifndef PHY_SIM
 	// ### Set to highest priority #############################################
 	setpriority(PRIO_PROCESS, 0, -20);
 
@@ -203,10 +279,25 @@ int main()
 	system("iptables -A INPUT -p tcp -s 192.168.1.100 -d 192.168.1.105 --sport 513:65535 --dport 22 -m state --state NEW,ESTABLISHED -j ACCEPT");
 	system("iptables -A OUTPUT -p tcp -s 192.168.1.105 -d 192.168.1.100 --sport 22 --dport 513:65535 -m state --state ESTABLISHED -j ACCEPT");
 	system("ip addr del 169.254.109.254/16 dev wlan0");
+#endif
 	
 	// ### Initialize PHY ######################################################
 	phy_init();
 
+	// ### Initialize uplink MAC ###############################################
+	if (staq_init(&buff_up, BUFF_UP_SIZE) < 0)
+	{
+		printf("Uplink buffer allocation error\n");
+		return -1;
+	}
+
+	// ### Initialize downlink MAC #############################################
+	buff_dl_init();
+#ifdef LAT_TRACE
+	lat_init();
+#endif
+	LINK_CAP_OPEN(LINK_CAP_FILE);
+
 	// ### Initialize socket ###################################################
 	fd_sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 	if (fd_sock < 0)
@@ -214,7 +305,8 @@ int main()
 		printf("Socket create error\n");
 		return -1;
 	}
-	saddr_len = sizeof(saddr);
+	if (wlan_rx_open() < 0)
+		return -1;
 
 	// ### Initialize thread ###################################################
 	// *** Create ***
@@ -225,14 +317,25 @@ int main()
 		printf("Thread send WLAN create error\n");
 
 	// *** Downlink ************************************************************
-	if (pthread_create(&thread_recvwlan, NULL, recvwlan_handler, NULL) != 0)
-		printf("Thread receive WLAN create error\n");
+	for (i = 0; i < WLAN_RX_WORKERS; i++)
+	{
+		if (pthread_create(&thread_recvwlan[i], NULL, recvwlan_handler, &fd_rx[i]) != 0)
+			printf("Thread receive WLAN %d create error\n", i);
+	}
 	if (pthread_create(&thread_sendvlc, NULL, sendvlc_handler, NULL) != 0)
 		printf("Thread send ETH create error\n");
-
-	// *** ACK *****************************************************************
-	if (pthread_create(&thread_sendack, NULL, sendack_handler, NULL) != 0)
-		printf("Thread send ACK create error\n");	
+#ifdef LAT_TRACE
+	// *** Latency histogram ***
+	pthread_t thread_lat;
+	if (pthread_create(&thread_lat, NULL, lat_print_handler, NULL) != 0)
+		printf("Thread latency print create error\n");
+#endif
+#if defined(PHY_POLL_STATS) && !defined(PHY_SIM)
+	// *** PHY polling statistics ***
+	pthread_t thread_poll;
+	if (pthread_create(&thread_poll, NULL, phy_poll_print_handler, NULL) != 0)
+		printf("Thread PHY poll print create error\n");
+#endif
 	
 	// *** Join ***
 	// *** Uplink **************************************************************
@@ -240,11 +343,9 @@ int main()
 	pthread_join(thread_sendwlan, NULL);
 
 	// *** Downlink ************************************************************
-	pthread_join(thread_recvwlan, NULL);
+	for (i = 0; i < WLAN_RX_WORKERS; i++)
+		pthread_join(thread_recvwlan[i], NULL);
 	pthread_join(thread_sendvlc, NULL);
-
-	// *** ACK *****************************************************************
-	pthread_join(thread_sendack, NULL);
 	
 	// ### Test code ###########################################################
 	// *** Send OFDM symbol test ***
@@ -263,7 +364,7 @@ int main()
 	// uint8_t data;
 	// for (int i = 0; i <= 255; i++)
 	// {
-		// recv_ook_sym(&data);
+		// recv_ook_sym(&data, 0);
 		// printf("0x%02X ", data);
 	// }
 	// printf("\n");
@@ -275,27 +376,29 @@ int main()
 		// ethfrm_d.bytes = 500;
 		// for (int i = 0; i < ethfrm_d.bytes; i++)
 			 // ethfrm_d.data[i] = k;
-		// send_vlc_frm(ethfrm_d);
+		// send_vlc_frm(ethfrm_d, STA_BCAST, 0);
 		// ethfrm_print(ethfrm_d);
 	// }
 	
 	// *** Receive OOK frame test ***
+	// struct mac_hdr_t hdr;
 	// for (int k = 0; k <= 200; k++)
 	// {
 		// struct ethfrm_t ethfrm_u = {0};
-		// recv_irc_frm(&ethfrm_u);
+		// recv_irc_frm(&ethfrm_u, &hdr, 0);
 		// ethfrm_print(ethfrm_u);
 	// }
 	
-	// *** Send OFDM ACK test ***
+	// *** Send OFDM poll with ACK test ***
 	// for (int k = 0; k <= 10; k++)
-		// send_ack();
+		// send_vlc_poll(0, UL_GRANT, 1);
 
 	// *** Receive OOK ACK test ***
+	// struct mac_hdr_t hdr;
 	// for (int k = 0; k <= 10; k++)
 	// {
 		// struct ethfrm_t ethfrm_u = {0};
-		// if (recv_irc_frm(&ethfrm_u) == ACK_FOUND)
+		// if (recv_irc_frm(&ethfrm_u, &hdr, 0) == ACK_FOUND || hdr.ack)
 		// {		
 			// printf("ACK found\n");
 			// continue;
@@ -307,6 +410,31 @@ int main()
 }
 
 // ### Functions ###############################################################
+#ifdef PHY_SIM
+// *** PHY registers replaced by the shared-memory medium (phy_sim.h) ***
+void phy_init()
+{
+	phy_sim_t *sim = phy_sim_open(PHY_SIM_NAME, 0);
+
+	if (sim == NULL)
+	{
+		perror("Couldn't open the PHY simulator");
+		exit(-1);
+	}
+	phy_sim_attach(&phy_port, sim);
+}
+
+void send_ofdm_sym(ofdmsym_t ofdmsym)
+{
+	phy_sim_vlc_send(&phy_port, ofdmsym.data);
+}
+
+uint8_t recv_ook_sym(uint8_t *data, uint32_t timeout_us)
+{
+	// A stopped medium reads as an idle line
+	return (phy_sim_irc_recv(&phy_port, data, (uint64_t)timeout_us * 1000) == 0) ? 0 : 1;
+}
+#else
 void phy_init()
 {
 	// *** Handle to physical memory ***
@@ -319,9 +447,60 @@ void phy_init()
 	ook_rx_p = (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE,
 			MAP_SHARED, fd_mem, AXI_IRC_RX);
 			
+#ifdef VLC_TX_DMA
+	dma_tx_p = (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd_mem, AXI_DMA_TX);
+	dma_buf_p = (uint32_t *)mmap(0, 2 * VLC_DMA_HALF * 4, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd_mem, VLC_DMA_BUF);
+	// *** DMA reset, then run ***
+	*(dma_tx_p+0) = 1 << 2;
+	while (*(dma_tx_p+0) & (1 << 2));
+	*(dma_tx_p+0) = 1 << 0;
+#endif
+
 	// PHY initialization
-	*(vlc_tx_p+0) = 0x122;
+#ifdef VLC_TX_DMA
+	*(vlc_tx_p+0) = (VLC_BURST << 16) | VLCTX_SRC_DMA | (VLC_GUARD << 2) | VLC_MOD;
+#else
+	*(vlc_tx_p+0) = (VLC_BURST << 16) | (VLC_GUARD << 2) | VLC_MOD;
+#endif
+	*(vlc_tx_p+8) = VLC_UP_FACTOR;
+	phy_poll_init(&poll_vlc_tx, "VLC TX", VLC_SYM_NS);
+	*(ook_rx_p+0) = IRC_CTRL;
+	phy_poll_init(&poll_irc_rx, "IRC RX", IRC_BYTE_NS);
+#ifdef PHY_IRQ
+	// *** Interrupts: VLC TX FIFO not full (low-water at depth - 1), IRC RX
+	// byte ready ***
+#ifndef VLC_TX_DMA
+	*(vlc_tx_p+2) = (*(vlc_tx_p+1) >> 16) - 1;
+	*(vlc_tx_p+3) = 1;
+	phy_poll_uio(&poll_vlc_tx, "vlctx");
+#endif
+	*(ook_rx_p+2) = 1;
+	phy_poll_uio(&poll_irc_rx, "ircrx");
+#endif
+}
+
+#ifdef PHY_POLL_STATS
+void *phy_poll_print_handler()
+{
+	uint8_t i;
+
+	while (1)
+	{
+		sleep(PHY_POLL_PRINT_S);
+		phy_poll_print(&poll_vlc_tx);
+		phy_poll_print(&poll_irc_rx);
+		printf("IRC RX FIFO: %u of %u bytes, %u dropped\n", *(ook_rx_p+4) & 0xFFFF,
+				*(ook_rx_p+4) >> 16, *(ook_rx_p+5));
+		for (i = 0; i < NUM_STA; i++)
+			printf("Station %u uplink: %u frames, %u timeouts, %u errors\n", i,
+					ul_frames[i], ul_timeout[i], ul_error[i]);
+	}
+	return NULL;
 }
+#endif
+#endif
 
 void ethfrm_set(ethfrm_t *ethfrm, uint8_t *data, uint16_t bytes)
 {
@@ -344,133 +523,18 @@ void ethfrm_print(struct ethfrm_t ethfrm)
 	printf("\n");
 }
 
-void send_vlc_frm(struct ethfrm_t ethfrm)
-{
-	struct ofdmsym_t ofdmsym = {0};
-	uint16_t num_ofdm, num_rem_bit;
-	uint16_t ethfrm_idx = 0;
-	uint16_t i, j;
-
-	// *** Split an Ethernet frame into OFDM symbols ***
-	// Calculate how many OFDM symbols that we can make
-	num_ofdm = ethfrm.bytes * 8 / OFDM_BIT;
-	// Calculate how many remaining bits for the last OFDM symbol
-	num_rem_bit = ethfrm.bytes * 8 % OFDM_BIT;
-	// printf("OFDM frame size: %d byte = (%d symbol * %d bit) + %d bit\n", ethfrm.bytes,
-			// num_ofdm, OFDM_BIT, num_rem_bit);
-
-	// *** Send the first OFDM symbol (header symbol) ***
-	// *** Fill OFDM symbol ***
-	ofdmsym.data[0] = 0x16808880;
-	ofdmsym.data[1] = 0x16800000;
-	ofdmsym.data[2] = (num_ofdm << 16) | num_rem_bit;
-	ofdmsym.data[3] = 0x00000000; 
-	ofdmsym.bytes = OFDM_BYTE;
-	// *** Send OFDM symbol ***
-	send_ofdm_sym(ofdmsym);
-	
-	// *** Send all the OFDM symbol, except the last OFDM symbol ***
-	for (i = 0; i < num_ofdm; i++)
-	{
-		// *** Clear OFDM symbol ***
-		for (j = 0; j < OFDM_WORD; j++)
-			ofdmsym.data[j] = 0;
-		// *** Fill OFDM symbol ***
-		for (j = 0; j < OFDM_BYTE; j++)
-		{
-			if (j < 4)
-				ofdmsym.data[0] |= (ethfrm.data[ethfrm_idx++] << (24-(j%4)*8));
-			else if (j < 8)
-				ofdmsym.data[1] |= (ethfrm.data[ethfrm_idx++] << (24-(j%4)*8));
-			else if (j < 12)
-				ofdmsym.data[2] |= (ethfrm.data[ethfrm_idx++] << (24-(j%4)*8));
-			else
-				ofdmsym.data[3] |= (ethfrm.data[ethfrm_idx++] << (24-(j%4)*8));
-		}
-		ofdmsym.bytes = OFDM_BYTE;
-		// *** Send OFDM symbol ***
-		send_ofdm_sym(ofdmsym);
-	}
-
-	// *** Send the last OFDM symbol ***
-	if (num_rem_bit)
-	{
-		// *** Clear OFDM symbol ***
-		for (j = 0; j < OFDM_WORD; j++)
-			ofdmsym.data[j] = 0;
-		// *** Fill OFDM symbol ***
-		for (i = 0; i < OFDM_BYTE; i++)
-		{
-			uint8_t data = ethfrm.data[ethfrm_idx++];
-			if (ethfrm_idx == (ethfrm.bytes+1))
-				break;
-			if (i < 4)
-				ofdmsym.data[0] |= (data << (24-(i%4)*8));
-			else if (i < 8)
-				ofdmsym.data[1] |= (data << (24-(i%4)*8));
-			else if (i < 12)
-				ofdmsym.data[2] |= (data << (24-(i%4)*8));
-			else
-				ofdmsym.data[3] |= (data << (24-(i%4)*8));
-		}
-		ofdmsym.bytes = num_rem_bit;
-		// *** Send OFDM symbol ***
-		send_ofdm_sym(ofdmsym);
-	}
-}
-
-uint8_t recv_irc_frm(struct ethfrm_t *ethfrm)
+#ifndef PHY_SIM
+#ifndef VLC_TX_DMA
+void send_ofdm_sym(ofdmsym_t ofdmsym)
 {
-	uint16_t i;
-
-	// *** Receive OOK header ***
-	uint8_t header[7];
-	for (i = 0; i <= 6; i++)
-		recv_ook_sym(&header[i]);
-	
-	// *** Check ID ***
-	if (!((header[0] == 0x16) && (header[1] == 0x80) &&
-			(header[2] == 0x88) && (header[3] == 0x80)))
-		return HEADER_MISSING;
-	// *** Check ACK ***
-	if (header[4] == 0xFF)
-		return ACK_FOUND;
-
-	// *** Get number of bytes ***
-	ethfrm->bytes = (uint16_t)((header[5] << 8) | header[6]);
-
-	// *** Receive OOK data ***
-	uint8_t data;
-	for (i = 0; i < ethfrm->bytes; i++)
+	// Wait while the FIFO is full, a slot frees up every symbol
+	if (*(vlc_tx_p+0) & VLCTX_FULL)
 	{
-		recv_ook_sym(&data);
-		ethfrm->data[i] = data;
+		phy_poll_start(&poll_vlc_tx);
+		phy_poll_wait(&poll_vlc_tx, vlc_tx_p+0, VLCTX_FULL, 0, 0);
 	}
-	// printf("OOK frame size: %d byte\n", ethfrm->bytes);
-	
-	return 0;	// Success receive
-}
-
-void send_ack()
-{
-	struct ofdmsym_t ack = {0};
-		
-	// *** Construct ACK pattern ***
-	ack.data[0] = 0x16808880;
-	ack.data[1] = 0x1680FFFF;
-	ack.data[2] = 0x00000000;
-	ack.data[3] = 0x00000000; 
-	ack.bytes = OFDM_BYTE;
-	
-	// *** Send VLC ACK ***
-	pthread_mutex_lock(&mutex_ofdmtx);
-	send_ofdm_sym(ack);
-	pthread_mutex_unlock(&mutex_ofdmtx);
-}
 
-void send_ofdm_sym(ofdmsym_t ofdmsym)
-{
-	// *** Write data to data register ***
+	// *** Write data to data register, the last one queues the symbol ***
 	*(vlc_tx_p+4) = ofdmsym.data[0];
 	*(vlc_tx_p+5) = ofdmsym.data[1];
 	*(vlc_tx_p+6) = ofdmsym.data[2];
@@ -478,100 +542,171 @@ void send_ofdm_sym(ofdmsym_t ofdmsym)
 	// for (uint8_t i = 0; i < OFDM_WORD; i++)
 		// printf("0x%08X ", ofdmsym.data[i]);
 	// printf("\n");
-	
-	// Wait until busy flag is cleared
-	while ((*(vlc_tx_p+0) & (1 << 10)));
 }
-
-void recv_ook_sym(uint8_t *data)
+#else
+void send_ofdm_sym(ofdmsym_t ofdmsym)
 {
-	// Wait until ready flag is set
-	while (!(*(ook_rx_p+0) & (1 << 16)));
-	
-	// *** Copy from PHY RX memory ***
-	*data = *(ook_rx_p+1);
-	// printf("0x%02X\n", *data);
+	volatile uint32_t *p = dma_buf_p + dma_half*VLC_DMA_HALF + dma_words;
+	uint8_t i;
+
+	// *** Copy to the DMA buffer ***
+	for (i = 0; i < VLC_SYM_WORD; i++)
+		p[i] = ofdmsym.data[i];
+	dma_words += VLC_SYM_WORD;
+	if (dma_words + VLC_SYM_WORD > VLC_DMA_HALF)
+		send_ofdm_flush();
 }
 
-unsigned short checksum(unsigned short* buff, int _16bitword)
+// *** Start the DMA on the symbols queued since the last call ***
+void send_ofdm_flush(void)
 {
-	unsigned long sum;
-	unsigned short ans;
+	if (dma_words == 0)
+		return;
 
-	for(sum = 0; _16bitword > 0; _16bitword--)
-		sum += htons(*(buff)++);
-	
-	sum = ((sum >> 16) + (sum & 0xFFFF));
-	sum += (sum >> 16);
-	ans = (unsigned short)(~sum);
-	ans = ((ans & 0x00FF) << 8) + ((ans & 0xFF00) >> 8);
+	// Wait until the previous transfer, out of the other half, is done. The
+	// FIFO takes it at one symbol per symbol time when it is full.
+	if (dma_run)
+	{
+		phy_poll_start(&poll_vlc_tx);
+		phy_poll_wait(&poll_vlc_tx, dma_tx_p+1, 1 << 1, 1 << 1, 0);
+	}
+
+	// *** Source address and length, the length write starts it ***
+	__sync_synchronize();
+	*(dma_tx_p+6) = VLC_DMA_BUF + dma_half*VLC_DMA_HALF*4;
+	*(dma_tx_p+10) = dma_words*4;
+	dma_run = 1;
+	dma_half ^= 1;
+	dma_words = 0;
 }
+#endif
 
-unsigned short checksumtcp(const char *buff, unsigned size)
+uint8_t recv_ook_sym(uint8_t *data, uint32_t timeout_us)
 {
-	unsigned sum = 0;
-	int i;
-
-	for (i = 0; i < size-1; i += 2)
+	if (irc_rx_n == 0)
 	{
-		unsigned short word16 = *(unsigned short *)&buff[i];
-		sum += word16;
-	}
+		// *** Drain the FIFO 4 bytes per read, only wait when it is empty ***
+		if (irc_rx_avail == 0)
+			irc_rx_avail = *(ook_rx_p+4) & 0xFFFF;
+		if (irc_rx_avail == 0)
+		{
+			// Wait until ready flag is set
+			if (phy_poll_wait(&poll_irc_rx, ook_rx_p+0, 1 << 16, 1 << 16,
+					(uint64_t)timeout_us * 1000))
+				return 1;	// Timeout
+			irc_rx_avail = *(ook_rx_p+4) & 0xFFFF;
+		}
 
-	if (size & 1)
-	{
-		unsigned short word16 = (unsigned char)buff[i];
-		sum += word16;
+		// *** Copy from PHY RX memory ***
+		if (irc_rx_avail >= 4)
+		{
+			irc_rx_word = *(ook_rx_p+3);
+			irc_rx_n = 4;
+		}
+		else
+		{
+			irc_rx_word = *(ook_rx_p+1);
+			irc_rx_n = 1;
+		}
+		irc_rx_avail -= irc_rx_n;
 	}
+	*data = (uint8_t)irc_rx_word;
+	irc_rx_word >>= 8;
+	irc_rx_n--;
+	// printf("0x%02X\n", *data);
 
-	while (sum >> 16)
-		sum = (sum & 0xFFFF) + (sum >> 16);
-
-	return ~sum;
+	return 0;
 }
+#endif
 
 void *recvirc_handler()
 {
+	struct mac_hdr_t hdr = {0};
 	uint8_t ret_val;
+	uint8_t sta = 0, idle = 1;
+	uint16_t n;
 	
 	while (1)
 	{
-		// *** Receive data from IRC ***
-		ethfrm_t ethfrm_rd = {0};
-		ret_val = recv_irc_frm(&ethfrm_rd);
-		
-		// *** If header missing ***
-		// while (recv_irc_frm(&ethfrm_rd) == HEADER_MISSING);
-		if (ret_val == HEADER_MISSING)
+		// *** Poll one station on the VLC downlink ***
+		vlc_tx_poll(sta);
+
+		// *** Receive its answer from IRC, up to UL_GRANT frames ***
+		for (n = 0; n < UL_GRANT; n++)
 		{
-			printf("IRC header missing\n");
-			continue;
-		}
+			ethfrm_t ethfrm_rd = {0};
+			ret_val = recv_irc_frm(&ethfrm_rd, &hdr, UL_POLL_TIMEOUT_US);
+			LINK_CAP_RX(LINK_CAP_IRC, ret_val, &hdr, &ethfrm_rd);
+			if ((ret_val == 0 || ret_val == ACK_FOUND) && rx_hunt.irc_last)
+				printf("IRC resync, %u bytes discarded (%llu in total)\n",
+						rx_hunt.irc_last, (unsigned long long)rx_hunt.irc_bytes);
+
+			// *** If the station did not answer ***
+			if (ret_val == RX_TIMEOUT)
+			{
+				ul_timeout[sta]++;
+				recv_irc_drain();
+				break;
+			}
 		
-		// *** If it is ACK ***
-		if (ret_val == ACK_FOUND)
-		{
-			printf("ACK found\n");
-			pthread_mutex_lock(&mutex_ack);
-			ack = 1;
-			pthread_mutex_unlock(&mutex_ack);
-			continue;
-		}
+			// *** If header missing, or someone else is talking ***
+			if (ret_val == HEADER_MISSING || hdr.sta != sta)
+			{
+				printf("IRC header missing, %u bytes discarded\n", rx_hunt.irc_last);
+				ul_error[sta]++;
+				recv_irc_drain();
+				break;
+			}
 		
-		// *** If it is data, we must send ACK ***
-		// pthread_mutex_lock(&mutex_ackflag);
-		// send_ack_flag = 1;
-		// pthread_mutex_unlock(&mutex_ackflag);
+			// *** If it is ACK, alone or piggybacked ***
+			if (hdr.ack)
+			{
+				pthread_mutex_lock(&mutex_ack);
+				ack = 1;
+				pthread_mutex_unlock(&mutex_ack);
+			}
+			if (ret_val == ACK_FOUND)
+				continue;
+
+			// *** Nothing to send ***
+			if (hdr.type == IRC_TYPE_NULL)
+				break;
 		
-		// *** Push Ethernet frame to uplink buffer ***
-		buff_up_push(ethfrm_rd);
-		// ethfrm_print(ethfrm_rd);
+			// *** If it is data, we must send ACK, it rides the next downlink
+			// frame to this station ***
+			vlc_tx_ack(sta);
+		
+			// *** Push Ethernet frame to uplink buffer ***
+			idle = 0;
+			ul_frames[sta]++;
+			flow_learn(&ethfrm_rd, sta);
+			buff_up_push(ethfrm_rd);
+			// ethfrm_print(ethfrm_rd);
+
+			// *** End of the station's burst ***
+			if (hdr.type != IRC_TYPE_MORE)
+				break;
+		}
+
+		// *** Next station, rest after a round without any data ***
+		if (++sta == NUM_STA)
+		{
+			sta = 0;
+			if (idle)
+			{
+				struct timespec tim;
+				tim.tv_sec = 0;
+				tim.tv_nsec = UL_IDLE_US * 1000UL;
+				nanosleep(&tim, NULL);
+			}
+			idle = 1;
+		}
 	}
 }
 
 void *sendwlan_handler()
 {
-	uint16_t i;
+	uint16_t bytes;
 
 	// *** Getting index of own interface ***
 	struct ifreq ifreq_iface;
@@ -593,6 +728,14 @@ void *sendwlan_handler()
 	strncpy(ifreq_ip.ifr_name, WLAN_IFACE, IFNAMSIZ-1);
 	if (ioctl(fd_sock, SIOCGIFADDR, &ifreq_ip) < 0)
 		printf("Error in SIOCGIFADDR %s\n", WLAN_IFACE);
+	uint32_t ip_own = ((struct sockaddr_in *)&ifreq_ip.ifr_addr)->sin_addr.s_addr;
+
+	// *** Everything goes to the WiFi router ***
+	struct sockaddr_ll sadr_ll;
+	memset(&sadr_ll, 0, sizeof(sadr_ll));
+	sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
+	sadr_ll.sll_halen = ETH_ALEN;
+	memcpy(sadr_ll.sll_addr, mac_wifi_router, ETH_ALEN);
 
 	while (1)
 	{
@@ -602,320 +745,66 @@ void *sendwlan_handler()
 			continue;
 		//ethfrm_print(ethfrm_rd);
 
-		// *** Get Ethernet frame information ***
-		struct ethhdr *eth = (struct ethhdr*)(ethfrm_rd.data);
-		struct iphdr *ip = (struct iphdr*)(ethfrm_rd.data + sizeof(struct ethhdr));
-		unsigned short iphdrlen = ip->ihl * 4;
-
-		// *** Check Ethernet frame ***
-		if (eth->h_proto != 8)
+		// *** ICMP and TCP packets from our own address ***
+		ethfrm_t ethfrm_wr;
+		bytes = ip_frm_rebuild(&ethfrm_rd, &ethfrm_wr,
+				(uint8_t *)ifreq_mac.ifr_hwaddr.sa_data, mac_wifi_router, ip_own, 0);
+		if (bytes == 0)
 			continue;
 
-		// *** Send Ethernet frame ***
-		if(ip->protocol == 1)	// ICMP packet
-		{
-			// printf("ICMP uplink packet found\n");
-
-			// *** Extract ICMP header ***
-			struct icmphdr *icmp = (struct icmphdr*)(ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr));
-
-			// *** Extract Data ***
-			ethfrm_rd.bytes = ntohs(ip->tot_len) + 14;
-			unsigned char *data = (ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr) + sizeof(struct icmphdr));
-			int remaining_data = ethfrm_rd.bytes - (iphdrlen + sizeof(struct ethhdr) + sizeof(struct icmphdr));
-
-			// *** Constructing Ethernet header ***
-			ethfrm_t ethfrm_wr = {0};
-			struct ethhdr *eth = (struct ethhdr*)(ethfrm_wr.data);
-			eth->h_source[0] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[0]);
-			eth->h_source[1] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[1]);
-			eth->h_source[2] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[2]);
-			eth->h_source[3] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[3]);
-			eth->h_source[4] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[4]);
-			eth->h_source[5] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[5]);
-			eth->h_dest[0] = mac_wifi_router[0];
-			eth->h_dest[1] = mac_wifi_router[1];
-			eth->h_dest[2] = mac_wifi_router[2];
-			eth->h_dest[3] = mac_wifi_router[3];
-			eth->h_dest[4] = mac_wifi_router[4];
-			eth->h_dest[5] = mac_wifi_router[5];
-			eth->h_proto = htons(ETH_P_IP);
-			ethfrm_wr.bytes += sizeof(struct ethhdr);
-
-			// *** Constructing IP header ***
-			struct iphdr *iph = (struct iphdr*)(ethfrm_wr.data + sizeof(struct ethhdr));
-			iph->ihl = ip->ihl;
-			iph->version = ip->version;
-			iph->tos = ip->tos;
-			iph->id = ip->id;
-			iph->frag_off = ip->frag_off;
-			iph->ttl = ip->ttl;
-			iph->protocol = ip->protocol;
-			iph->saddr = inet_addr(inet_ntoa((((struct sockaddr_in*) & (ifreq_ip.ifr_addr))->sin_addr)));
-			iph->daddr = ip->daddr;
-			iph->tot_len = ip->tot_len;
-			ethfrm_wr.bytes += sizeof(struct iphdr);
-			for(i = 0; i < (iphdrlen-sizeof(struct iphdr)); i++)
-			{
-				iph[ethfrm_wr.bytes] = ip[ethfrm_wr.bytes];
-				ethfrm_wr.bytes++;
-			}
-
-			// *** Constructing ICMP header ***
-			struct icmphdr *ih = (struct icmphdr*)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr));
-			ih->type = icmp->type;
-			ih->code = icmp->code;
-			ih->un.echo.sequence = icmp->un.echo.sequence;
-			ih->un.echo.id = icmp->un.echo.id;
-			ih->un.frag.mtu = icmp->un.frag.mtu;
-			ethfrm_wr.bytes += sizeof(struct icmphdr);
-
-			// *** Constructing payload ***
-			for (i = 0; i < remaining_data; i++)
-			{
-				ethfrm_wr.data[ethfrm_wr.bytes++] = data[i];
-			}
-
-			// *** Completing ICMP and IP header ***
-			ih->checksum = checksum((unsigned short *)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr)),
-					(sizeof(struct icmphdr)/2+remaining_data/2));
-			iph->tot_len = htons(ethfrm_wr.bytes - sizeof(struct ethhdr));
-			iph->check = checksum((unsigned short *)(ethfrm_wr.data + sizeof(struct ethhdr)), iphdrlen/2);
-
-			// *** Actual sending ***
-			struct sockaddr_ll sadr_ll;
-			sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
-			sadr_ll.sll_halen = ETH_ALEN;
-			sadr_ll.sll_addr[0] = mac_wifi_router[0];
-			sadr_ll.sll_addr[1] = mac_wifi_router[1];
-			sadr_ll.sll_addr[2] = mac_wifi_router[2];
-			sadr_ll.sll_addr[3] = mac_wifi_router[3];
-			sadr_ll.sll_addr[4] = mac_wifi_router[4];
-			sadr_ll.sll_addr[5] = mac_wifi_router[5];
-			unsigned int res = sendto(fd_sock, ethfrm_wr.data, ntohs(ip->tot_len) + 14,
-					0, (const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll));
-			// if (res < 0)
-				// printf("ICMP uplink packet send error\n");
-			// else
-				// printf("ICMP uplink packet send success\n");
-		}
-		else if (ip->protocol == 6)		// TCP packet
-		{
-			// printf("TCP uplink packet found\n");
-			
-			// *** Extract TCP header ***
-			struct tcphdr *tcp = (struct tcphdr*)(ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr));
-		
-			// *** Extract Data ***
-			ethfrm_rd.bytes = ntohs(ip->tot_len) + 14;
-			unsigned char *data = (ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr) + sizeof(struct tcphdr));
-			int remaining_data = ethfrm_rd.bytes - (iphdrlen + sizeof(struct ethhdr) + sizeof(struct tcphdr));
-
-			// *** Constructing Ethernet header ***
-			ethfrm_t ethfrm_wr = {0};
-			struct ethhdr *eth = (struct ethhdr*)(ethfrm_wr.data);
-			eth->h_source[0] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[0]);
-			eth->h_source[1] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[1]);
-			eth->h_source[2] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[2]);
-			eth->h_source[3] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[3]);
-			eth->h_source[4] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[4]);
-			eth->h_source[5] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[5]);
-			eth->h_dest[0] = mac_wifi_router[0];
-			eth->h_dest[1] = mac_wifi_router[1];
-			eth->h_dest[2] = mac_wifi_router[2];
-			eth->h_dest[3] = mac_wifi_router[3];
-			eth->h_dest[4] = mac_wifi_router[4];
-			eth->h_dest[5] = mac_wifi_router[5];
-			eth->h_proto = htons(ETH_P_IP);
-			ethfrm_wr.bytes += sizeof(struct ethhdr);
-
-			// *** Constructing IP header ***
-			struct iphdr *iph = (struct iphdr*)(ethfrm_wr.data + sizeof(struct ethhdr));
-			iph->ihl = ip->ihl;
-			iph->version = ip->version;
-			iph->tos = ip->tos;
-			iph->id = ip->id;
-			iph->frag_off = ip->frag_off;
-			iph->ttl = ip->ttl;
-			iph->protocol = ip->protocol;
-			iph->saddr = inet_addr(inet_ntoa((((struct sockaddr_in*) & (ifreq_ip.ifr_addr))->sin_addr)));
-			iph->daddr = ip->daddr;
-			iph->tot_len = ip->tot_len;
-			ethfrm_wr.bytes += sizeof(struct iphdr);
-			for(i = 0; i < (iphdrlen-sizeof(struct iphdr)); i++)
-			{
-				iph[ethfrm_wr.bytes] = ip[ethfrm_wr.bytes];
-				ethfrm_wr.bytes++;
-			}
-
-			// *** Constructing TCP header
-			struct tcphdr *th = (struct tcphdr*)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr));
-			th->th_sport = tcp->th_sport;
-			th->th_dport = tcp->th_dport;
-			th->th_seq = tcp->th_seq;
-			th->th_ack = tcp->th_ack;
-			th->th_x2 = tcp->th_x2;
-			th->th_off = tcp->th_off;
-			th->th_flags = tcp->th_flags;
-			th->th_win = tcp->th_win;
-			th->th_urp = tcp->th_urp;
-			ethfrm_wr.bytes += sizeof(struct tcphdr);
-				
-			// *** Constructing payload ***
-			for(i = 0; i < remaining_data; i++)
-			{
-				ethfrm_wr.data[ethfrm_wr.bytes++] = data[i];
-			}
-
-			// *** Pseudo TCP header ***
-			uint8_t *tcpsumbuff = (uint8_t *)malloc(2000);
-			int total_len_sum = 0;
-			memset(tcpsumbuff,0,2000);
-			struct pseudotcp_t *pseudotcp = (struct pseudotcp_t*)(tcpsumbuff);			
-			pseudotcp->saddr = iph->saddr;
-			pseudotcp->daddr = iph->daddr;
-			pseudotcp->zero = 0;
-			pseudotcp->protocol = IPPROTO_TCP;
-			pseudotcp->len = htons(ntohs(ip->tot_len) - iphdrlen);
-			total_len_sum += sizeof(struct pseudotcp_t);
-			struct tcphdr *thsum = (struct tcphdr *)(tcpsumbuff + sizeof(struct pseudotcp_t));
-			thsum->th_sport = tcp->th_sport;
-			thsum->th_dport = tcp->th_dport;
-			thsum->th_seq = tcp->th_seq;
-			thsum->th_ack = tcp->th_ack;
-			thsum->th_x2 = tcp->th_x2;
-			thsum->th_off = tcp->th_off;
-			thsum->th_flags = tcp->th_flags;
-			thsum->th_win = tcp->th_win;
-			thsum->th_urp = tcp->th_urp;
-			thsum->th_sum = 0;
-			total_len_sum += sizeof(struct tcphdr);
-			for(i = 0; i < remaining_data; i++)
-			{
-				tcpsumbuff[total_len_sum++] = data[i];
-			}
-				
-			// *** Completing TCP and IP header ***
-			th->th_sum = checksumtcp((char*)(tcpsumbuff), sizeof(struct pseudotcp_t) + ntohs(ip->tot_len) - iphdrlen);
-			iph->check = checksum((unsigned short*)(ethfrm_wr.data + sizeof(struct ethhdr)), iphdrlen/2);
-
-			// *** Actual sending ***
-			struct sockaddr_ll sadr_ll;
-			sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
-			sadr_ll.sll_halen = ETH_ALEN;
-			sadr_ll.sll_addr[0] = mac_wifi_router[0];
-			sadr_ll.sll_addr[1] = mac_wifi_router[1];
-			sadr_ll.sll_addr[2] = mac_wifi_router[2];
-			sadr_ll.sll_addr[3] = mac_wifi_router[3];
-			sadr_ll.sll_addr[4] = mac_wifi_router[4];
-			sadr_ll.sll_addr[5] = mac_wifi_router[5];
-
-			unsigned int res = sendto(fd_sock, ethfrm_wr.data, ntohs(ip->tot_len) + 14,
-					0, (const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll));
-			// if (res < 0)
-				// printf("TCP uplink packet send error\n");
-			// else
-				// printf("TCP uplink packet send success\n");
-		}
-	}
-}
-
-void *sendack_handler()
-{	
-	while(1)
-	{
-		// *** Wait until there is send ACK request ***
-		while (send_ack_flag == 0);
-		pthread_mutex_lock(&mutex_ackflag);
-		send_ack_flag = 0;
-		pthread_mutex_unlock(&mutex_ackflag);
-		
-		// *** Send ACK ***
-		send_ack();
+		// *** Actual sending ***
+		if (sendto(fd_sock, ethfrm_wr.data, bytes, 0,
+				(const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll)) < 0)
+			printf("Uplink packet send error\n");
 	}
 }
 
 uint8_t buff_up_push(ethfrm_t ethfrm)
 {
-	uint8_t stat = 1;	// Push fail (buffer full)
-
-	if (!full_up)
-	{
-		pthread_mutex_lock(&mutex_up);
-
-		// *** Write eth frame to buffer and update head ***
-		buff_up[head_up++] = ethfrm;
-		if (head_up == BUFF_UP_SIZE)
-			head_up = 0;
-
-		// *** Update empty and full status ***
-		empty_up = 0;
-		if (head_up == tail_up)
-			full_up = 1;
-
-		pthread_mutex_unlock(&mutex_up);
-
-		stat = 0;	// Push success
-	}
-
-	return stat;
+	return staq_push(&buff_up, &ethfrm);
 }
 
 uint8_t buff_up_pop(ethfrm_t *ethfrm)
 {
-	uint8_t stat = 1;	// Pop fail (buffer empty)
-
-	if (!empty_up)
-	{
-		pthread_mutex_lock(&mutex_up);
-
-		// *** Read eth frame from buffer and update tail ***
-		*ethfrm = buff_up[tail_up++];
-		if (tail_up == BUFF_UP_SIZE)
-			tail_up = 0;
-
-		// *** Update empty and full status ***
-		full_up = 0;
-		if (tail_up == head_up)
-			empty_up = 1;
-
-		pthread_mutex_unlock(&mutex_up);
-
-		stat = 0;	// Pop success
-	}
-
-	return stat;
+	return staq_pop(&buff_up, ethfrm);
 }
 
 void buff_up_print(void)
 {
-	uint16_t i, j;
-
-	printf("Buffer Uplink: Head=%d, Tail=%d, Empty=%d, Full=%d\n", head_up,
-			tail_up, empty_up, full_up);
-	for (i = 0; i < BUFF_UP_SIZE; i++)
-	{
-		for (j = 0; j < buff_up[i].bytes; j++)
-			printf("%02X ", buff_up[i].data[j]);
-		printf("\n");
-	}
+	printf("Buffer Uplink: Used=%llu/%llu bytes\n",
+			(unsigned long long)pktring_used(&buff_up.ring),
+			(unsigned long long)buff_up.ring.size);
 }
 
-void *recvwlan_handler()
+// *** One per WLAN receive socket, several workers may push to the same
+// station queue ***
+void *recvwlan_handler(void *arg)
 {
+	int fd = *(int *)arg;
+	struct sockaddr_ll saddr;
+	socklen_t saddr_len;
+
 	while (1)
 	{
 		// *** Receive Ethernet frame ***
 		ethfrm_t ethfrm_rd = {0};
-		ethfrm_rd.bytes = recvfrom(fd_sock, ethfrm_rd.data, FRAM_SIZE, 0,
-				&saddr, (socklen_t *)&saddr_len);
+		saddr_len = sizeof(saddr);
+		ssize_t bytes = recvfrom(fd, ethfrm_rd.data, LINK_MTU, 0,
+				(struct sockaddr *)&saddr, &saddr_len);
+		// Interrupted or failed, saddr and the data are not valid
+		if (bytes < (ssize_t)(sizeof(struct ethhdr) + sizeof(struct iphdr)))
+			continue;
+		ethfrm_rd.bytes = bytes;
+		LAT_STAMP(&ethfrm_rd.ts, LAT_RX, ethfrm_rd.bytes);
 		
 		// *** Get Ethernet frame information ***
 		struct ethhdr *eth = (struct ethhdr *)(ethfrm_rd.data);
 		struct iphdr *ip = (struct iphdr *)(ethfrm_rd.data + sizeof(struct ethhdr));
 
-		// *** Check Ethernet frame ***
-		if ((ntohs(ip->tot_len)+14) > 1600 || ethfrm_rd.bytes > 1600)
+		// *** Check Ethernet frame, not our own uplink frames going out ***
+		if (saddr.sll_pkttype == PACKET_OUTGOING)
+			continue;
+		if ((ntohs(ip->tot_len)+14) > LINK_MTU || ethfrm_rd.bytes > LINK_MTU)
 			continue;
 		if (!(eth->h_proto == 8 &&
 				((unsigned char)eth->h_dest[0] == mac_wlan[0] && 
@@ -926,52 +815,55 @@ void *recvwlan_handler()
 				(unsigned char)eth->h_dest[5] == mac_wlan[5])))
 			continue;
 
-		// *** Push Ethernet frame to downlink buffer ***
-		buff_dl_push(ethfrm_rd);
+		// *** Push Ethernet frame to its station's downlink buffer ***
+		buff_dl_push(dl_classify(&ethfrm_rd), ethfrm_rd);
 	}
 }
 
 void *sendvlc_handler()
 {
-	uint8_t resend_val = 0;
-	uint32_t wait = 0;
+	uint8_t poll, sta_poll;
+	uint8_t *data;
+	uint16_t bytes;
+	int sta;
 	
 	while (1)
 	{
-		// *** Read Ethernet frame from downlink buffer ***
-		ethfrm_t ethfrm_rd = {0};
-		if (buff_dl_pop(&ethfrm_rd) == 1)
+		// *** Wait for a poll request or downlink data ***
+		pthread_mutex_lock(&mutex_vlctx);
+		while (!poll_req && dl_pending == 0)
+			pthread_cond_wait(&cond_vlctx, &mutex_vlctx);
+		poll = poll_req;
+		sta_poll = poll_sta;
+		poll_req = 0;
+		pthread_mutex_unlock(&mutex_vlctx);
+
+		// *** Control first, the uplink is idle until the poll is out ***
+		if (poll)
+		{
+			send_vlc_poll(sta_poll, UL_GRANT, vlc_tx_take_ack(sta_poll));
 			continue;
-		// ethfrm_print(ethfrm_rd);
-	
-		// *** Clear ACK ***
-		// pthread_mutex_lock(&mutex_ack);
-		// ack = 0;
-		// pthread_mutex_unlock(&mutex_ack);
-		
-		// *** Send with stop-and-wait ARQ ***
-		// resend:
-		// pthread_mutex_lock(&mutex_ofdmtx);
-		// Send VLC frame
-		send_vlc_frm(ethfrm_rd);
-		// pthread_mutex_unlock(&mutex_ofdmtx);
-
-		// *** Wait until get ACK ***
-		// while (ack == 0)
-		// {
-			// if (resend_val >= 1)
-			// {
-				// resend_val = 0;
-				// break;
-			// }
-			// if (wait >= 200000)
-			// {
-				// wait = 0;
-				// resend_val++;
-				// goto resend;
-			// }
-			// wait++;
-		// }
+		}
+
+		// *** Ethernet frame of the next scheduled station, in place ***
+		sta = dl_sched_peek(&dl_sched, buff_dl, &data, &bytes);
+		if (sta < 0)
+			continue;
+		pthread_mutex_lock(&mutex_vlctx);
+		dl_pending--;
+		pthread_mutex_unlock(&mutex_vlctx);
+		LAT_STAMP(staq_ts(data), LAT_POP, bytes);
+
+		// *** Send VLC frame, unicast frames carry the station's ACK ***
+		LAT_STAMP(staq_ts(data), LAT_TX_FIRST, bytes);
+		if (sta == BUFF_DL_BCAST)
+			send_vlc_frag(data, bytes, STA_BCAST, 0, DL_FRAG_SIZE, dl_seq[sta]++);
+		else
+			send_vlc_frag(data, bytes, sta, vlc_tx_take_ack(sta), DL_FRAG_SIZE,
+					dl_seq[sta]++);
+		LAT_STAMP(staq_ts(data), LAT_TX_LAST, bytes);
+		LAT_RECORD(staq_ts(data), bytes);
+		staq_release(&buff_dl[sta]);
 		
 		// *** Wait ***
 		struct timespec tim;
@@ -981,68 +873,182 @@ void *sendvlc_handler()
 	}
 }
 
-uint8_t buff_dl_push(ethfrm_t ethfrm)
+void vlc_tx_poll(uint8_t sta)
+{
+	pthread_mutex_lock(&mutex_vlctx);
+	poll_req = 1;
+	poll_sta = sta;
+	pthread_cond_signal(&cond_vlctx);
+	pthread_mutex_unlock(&mutex_vlctx);
+}
+
+void vlc_tx_ack(uint8_t sta)
 {
-	uint8_t stat = 1;	// Push fail (buffer full)
+	pthread_mutex_lock(&mutex_vlctx);
+	ack_pending |= (1UL << sta);
+	pthread_mutex_unlock(&mutex_vlctx);
+}
 
-	if (!full_dl)
-	{
-		pthread_mutex_lock(&mutex_dl);
+void vlc_tx_data(void)
+{
+	pthread_mutex_lock(&mutex_vlctx);
+	dl_pending++;
+	pthread_cond_signal(&cond_vlctx);
+	pthread_mutex_unlock(&mutex_vlctx);
+}
 
-		// *** Write eth frame to buffer and update head ***
-		buff_dl[head_dl++] = ethfrm;
-		if (head_dl == BUFF_DL_SIZE)
-			head_dl = 0;
+uint8_t vlc_tx_take_ack(uint8_t sta)
+{
+	uint8_t ack_sta;
 
-		// *** Update empty and full status ***
-		empty_dl = 0;
-		if (head_dl == tail_dl)
-			full_dl = 1;
+	pthread_mutex_lock(&mutex_vlctx);
+	ack_sta = (ack_pending >> sta) & 1;
+	ack_pending &= ~(1UL << sta);
+	pthread_mutex_unlock(&mutex_vlctx);
 
-		pthread_mutex_unlock(&mutex_dl);
+	return ack_sta;
+}
 
-		stat = 0;	// Push success
+int wlan_rx_open(void)
+{
+	struct sockaddr_ll sll;
+	int i;
+	uint32_t fanout;
+
+	// *** Only frames of the WLAN iface ***
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_nametoindex(WLAN_IFACE);
+	if (sll.sll_ifindex == 0)
+		printf("Error in index reading %s\n", WLAN_IFACE);
+
+	// *** Hash on the flow, defragment first so that all fragments of a
+	// datagram go to the same socket ***
+	fanout = WLAN_FANOUT_ID | ((uint32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	fd_rx[0] = fd_sock;
+	for (i = 0; i < WLAN_RX_WORKERS; i++)
+	{
+		if (i > 0)
+		{
+			fd_rx[i] = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+			if (fd_rx[i] < 0)
+			{
+				printf("Socket %d create error\n", i);
+				return -1;
+			}
+		}
+		if (sll.sll_ifindex && bind(fd_rx[i], (struct sockaddr *)&sll, sizeof(sll)) < 0)
+			printf("Socket %d bind error\n", i);
+		if (WLAN_RX_WORKERS == 1)
+			break;
+		if (setsockopt(fd_rx[i], SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0)
+		{
+			printf("Socket %d fanout error\n", i);
+			return -1;
+		}
 	}
 
-	return stat;
+	return 0;
 }
 
-uint8_t buff_dl_pop(ethfrm_t *ethfrm)
+void buff_dl_init(void)
 {
-	uint8_t stat = 1;	// Pop fail (buffer empty)
+	uint8_t i;
 
-	if (!empty_dl)
+	// *** Station and broadcast queues ***
+	for (i = 0; i <= NUM_STA; i++)
 	{
-		pthread_mutex_lock(&mutex_dl);
+		if (staq_init(&buff_dl[i], BUFF_DL_SIZE / (NUM_STA+1)) < 0)
+			printf("Downlink buffer %d allocation error\n", i);
+	}
 
-		// *** Read eth frame from buffer and update tail ***
-		*ethfrm = buff_dl[tail_dl++];
-		if (tail_dl == BUFF_DL_SIZE)
-			tail_dl = 0;
+	// *** Scheduler serves the broadcast queue like one more station ***
+	dl_sched_init(&dl_sched, DL_SCHED_MODE, NUM_STA+1);
+	dl_sched.frag = DL_FRAG_SIZE;
 
-		// *** Update empty and full status ***
-		full_dl = 0;
-		if (tail_dl == head_dl)
-			empty_dl = 1;
+	// *** Stations' client address ***
+	for (i = 0; i < NUM_STA; i++)
+		addr_sta[i] = inet_addr(ip_sta[i]);
+}
 
-		pthread_mutex_unlock(&mutex_dl);
+uint8_t buff_dl_push(uint8_t sta, ethfrm_t ethfrm)
+{
+	uint8_t stat = staq_push(&buff_dl[sta], &ethfrm);
 
-		stat = 0;	// Pop success
-	}
+	// *** Wake up the VLC TX scheduler ***
+	if (stat == 0)
+		vlc_tx_data();
 
 	return stat;
 }
 
 void buff_dl_print(void)
 {
-	uint16_t i, j;
+	uint16_t i;
+
+	for (i = 0; i <= NUM_STA; i++)
+	{
+		printf("Buffer Downlink %d: Used=%llu/%llu bytes\n", i,
+				(unsigned long long)pktring_used(&buff_dl[i].ring),
+				(unsigned long long)buff_dl[i].ring.size);
+	}
+}
+
+uint8_t dl_classify(ethfrm_t *ethfrm)
+{
+	struct iphdr *ip = (struct iphdr *)(ethfrm->data + sizeof(struct ethhdr));
+	uint32_t key, entry;
+	uint8_t i;
 
-	printf("Buffer Downlink: Head=%d, Tail=%d, Empty=%d, Full=%d\n", head_dl,
-			tail_dl, empty_dl, full_dl);
-	for (i = 0; i < BUFF_DL_SIZE; i++)
+	// *** Match destination IP with the stations' client ***
+	for (i = 0; i < NUM_STA; i++)
 	{
-		for (j = 0; j < buff_dl[i].bytes; j++)
-			printf("%02X ", buff_dl[i].data[j]);
-		printf("\n");
+		if (ip->daddr == addr_sta[i])
+			return i;
 	}
+
+	// *** Reply to a flow one of the stations started ***
+	if (flow_key(ethfrm, 0, &key) == 0)
+	{
+		entry = flow[key & (FLOW_SIZE-1)];
+		if ((entry >> 8) == key && (entry & 0xFF) < NUM_STA)
+			return entry & 0xFF;
+	}
+
+	// *** Unknown destination, let every station have it ***
+	return BUFF_DL_BCAST;
+}
+
+uint8_t flow_key(ethfrm_t *ethfrm, uint8_t uplink, uint32_t *key)
+{
+	struct ethhdr *eth = (struct ethhdr *)(ethfrm->data);
+	struct iphdr *ip = (struct iphdr *)(ethfrm->data + sizeof(struct ethhdr));
+	uint8_t *l4 = ethfrm->data + sizeof(struct ethhdr) + ip->ihl * 4;
+	uint16_t port;
+
+	// *** Need IPv4 and the first 8 bytes of the transport header ***
+	if (eth->h_proto != 8 || ethfrm->bytes < (l4 - ethfrm->data) + 8)
+		return 1;
+
+	// *** Client side port: ICMP echo ID, or TCP/UDP source port uplink and
+	// destination port downlink ***
+	if (ip->protocol == IPPROTO_ICMP)
+		port = (l4[4] << 8) | l4[5];
+	else if (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP)
+		port = uplink ? ((l4[0] << 8) | l4[1]) : ((l4[2] << 8) | l4[3]);
+	else
+		return 1;
+
+	*key = ((uint32_t)ip->protocol << 16) | port;
+	return 0;
+}
+
+void flow_learn(ethfrm_t *ethfrm, uint8_t sta)
+{
+	uint32_t key;
+
+	// *** The latest station wins if two clients use the same port ***
+	if (flow_key(ethfrm, 1, &key) == 0)
+		flow[key & (FLOW_SIZE-1)] = (key << 8) | sta;
 }
@@ -0,0 +1,1174 @@
+// ### Description #############################################################
+// LiFi data link layer shared by the access point, the station and the
+// benchmarks: VLC and IRC frame format, per-station downlink queues, the
+// downlink scheduler and the polled uplink.
+//
+// VLC header symbol:
+//	data[0] = 0x16808880				sync word
+//	data[1] = 0x1680TTTT				TTTT = 0x0000 data, 0x0001 poll,
+//										0x0002 fragment, 0xFFFF ACK
+//	data[2] = num_ofdm << 16 | num_rem_bit	(data)
+//			  grant						(poll, frames)
+//	data[3] = sta_id << 24 | ack << 23 | crc << 8
+//										bit 22~16 and 7~0 reserved (bit 3~0
+//										are not carried by QAM-16)
+// crc is the CRC-8 of data[1], data[2] and bit 31~16 of data[3]. A header
+// with a bad CRC, or announcing more than FRAM_SIZE bytes, is not a header.
+// A station only keeps data frames for its own sta_id or for STA_BCAST.
+//
+// Downlink fragments: a frame longer than the fragment size is sent as
+// fragment frames, each starting with a 4-byte header:
+//	SEQ  LAST << 7 | INDEX  OFFSET_H  OFFSET_L
+// SEQ numbers the frames of one destination, INDEX the fragments of a frame
+// and OFFSET is the byte offset of the fragment data in the frame. The
+// receiver puts fragments together in any order, ignores duplicates and
+// drops a frame that is not complete within FRAG_TIMEOUT_US. A symbol error
+// then costs one fragment of airtime instead of the whole frame, and frames
+// may be longer than FRAM_SIZE (LINK_MTU).
+//
+// IRC header bytes:
+//	0x16 0x80 0x88 0x80 TYPE STA LEN_H LEN_L CRC
+//	TYPE = 0x00 data, last of the grant
+//		   0x01 data, more frames follow in this grant
+//		   0x02 null, nothing to send (LEN = 0)
+//		   0xFF ACK
+//		   bit 6 (IRC_FLAG_ACK) set on data and null frames carries an ACK
+//	CRC  = CRC-8 of TYPE STA LEN_H LEN_L, LEN is at most FRAM_SIZE
+//
+// Uplink access: all stations share one IR channel to the single UART of the
+// access point, so they may only transmit when polled. The access point sends
+// a poll frame to one station at a time on the VLC downlink; the station
+// answers with up to `grant` frames, or a null frame, on the IRC uplink.
+//
+// ACKs are piggybacked: the ack bit of a unicast VLC data or poll frame
+// acknowledges the addressed station's last uplink burst, the IRC_FLAG_ACK of
+// an uplink frame acknowledges the last unicast downlink frame. As a station
+// may only talk when polled and every poll is a downlink frame, no separate
+// ACK frame is needed. ACK frames are still recognized on receive.
+//
+// Resynchronization: after a lost byte or symbol the receivers hunt for the
+// next sync word instead of failing every read until the line is quiet. The
+// IRC receiver slides a 4-byte window over the bytes, the VLC receiver checks
+// every symbol, data symbols included, so a header that arrives where data
+// was expected cuts the current frame (RX_TIMEOUT) and starts the next one.
+// Discarded bytes and symbols are counted in rx_hunt.
+//
+// Receive deadlines: a frame must arrive within a budget per symbol or byte it
+// announced (VLC_SYM_BUDGET_US, IRC_BYTE_BUDGET_US), so a header that got
+// through corrupted costs at most one frame time, not a stalled link.
+//
+// The includer provides the PHY functions send_ofdm_sym(), recv_ofdm_sym(),
+// send_ook_sym() and recv_ook_sym(); only the functions it actually calls need
+// to exist.
+
+#ifndef _LIFI_MAC_H_
+#define _LIFI_MAC_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/if_ether.h>
+#include "pktring.h"
+#include "lat_trace.h"
+
+// ### Defines #################################################################
+// *** Ethernet ***
+// Largest frame in one VLC or IRC frame
+#define FRAM_SIZE		1518
+// Largest Ethernet frame carried by the link, above FRAM_SIZE the downlink
+// must fragment and the uplink still stops at FRAM_SIZE
+#ifndef LINK_MTU
+#define LINK_MTU		FRAM_SIZE
+#endif
+// *** OFDM ***
+#define OFDM_WORD		4
+#define OFDM_BYTE		15
+#define OFDM_BIT		120
+
+// *** VLC header ***
+#define VLC_SYNC		0x16808880
+#define VLC_ID			0x16800000
+#define VLC_TYPE_DATA	0x0000
+#define VLC_TYPE_POLL	0x0001
+#define VLC_TYPE_FRAG	0x0002
+#define VLC_TYPE_ACK	0xFFFF
+#define VLC_STA_SHIFT	24
+#define VLC_ACK_BIT		(1 << 23)
+#define VLC_CRC_SHIFT	8
+// Receive time allowed per symbol of a frame, 43.2 us on air
+#define VLC_SYM_BUDGET_US	1000
+
+// *** IRC header ***
+#define IRC_HDR_SIZE	9
+#define IRC_TYPE_DATA	0x00
+#define IRC_TYPE_MORE	0x01
+#define IRC_TYPE_NULL	0x02
+#define IRC_TYPE_ACK	0xFF
+#define IRC_FLAG_ACK	0x40
+#define IRC_SYNC		0x16808880
+// Longest gap between two bytes of one IRC frame
+#define IRC_BYTE_TIMEOUT_US	10000
+// Receive time allowed per byte of a frame, 10.24 us on air
+#define IRC_BYTE_BUDGET_US	100
+
+// *** Header CRC-8, x^8 + x^2 + x + 1 ***
+#define HDR_CRC_POLY	0x07
+
+// *** Resynchronization ***
+// A receiver gives up hunting for a header after one full frame
+#define IRC_HUNT_MAX	(IRC_HDR_SIZE + FRAM_SIZE)
+#define VLC_HUNT_MAX	SCHED_SLOT_SYM
+
+// *** Fragmentation ***
+#define FRAG_HDR_SIZE	4
+#define FRAG_LAST		0x80
+// At most 128 fragments per frame
+#define FRAG_MAX		128
+// Time to receive all the fragments of a frame
+#define FRAG_TIMEOUT_US	50000
+
+// *** Station addressing ***
+#define MAX_STA			16
+#define STA_BCAST		0xFF
+
+// *** Receive status ***
+#define HEADER_MISSING	1
+#define ACK_FOUND		2
+#define STA_MISMATCH	3
+#define POLL_FOUND		4
+#define RX_TIMEOUT		5
+
+// *** Downlink scheduler ***
+#define SCHED_TDMA		0		// Fixed symbol budget per station slot
+#define SCHED_DRR		1		// Deficit round robin on symbols
+// Default TDMA slot, enough for one full-size frame plus its header
+#define SCHED_SLOT_SYM	((FRAM_SIZE*8 + OFDM_BIT-1) / OFDM_BIT + 1)
+// Default DRR quantum
+#define SCHED_QUANTUM	SCHED_SLOT_SYM
+
+// ### Struct definitions ######################################################
+typedef struct ethfrm_t
+{
+	uint8_t data[LINK_MTU];		// Ethernet packet data
+	uint16_t bytes;				// Ethernet packet length
+#ifdef LAT_TRACE
+	struct lat_ts_t ts;			// Time at each hop
+#endif
+} ethfrm_t;
+
+typedef struct ofdmsym_t
+{
+	uint32_t data[OFDM_WORD];	// OFDM symbol data
+	uint16_t bytes;				// Number of data bytes
+} ofdmsym_t;
+
+typedef struct mac_hdr_t
+{
+	uint8_t type;				// VLC_TYPE_* (low byte) or IRC_TYPE_*
+	uint8_t sta;				// VLC: destination, IRC: sender
+	uint8_t ack;				// Piggybacked ACK
+	uint16_t grant;				// Poll: uplink frames granted
+} mac_hdr_t;
+
+// Frame queue on a byte ring (pktring.h). Any thread may push, one thread
+// pops. A record holds STAQ_META bytes of frame descriptor (timestamps) and
+// then the frame.
+typedef struct staq_t
+{
+	struct pktring_t ring;
+	pthread_mutex_t mutex;			// Serializes the producers
+} staq_t;
+
+typedef struct dl_sched_t
+{
+	uint8_t mode;					// SCHED_TDMA or SCHED_DRR
+	uint8_t num_sta;				// Number of stations served
+	uint8_t cur;					// Station currently served
+	uint8_t fresh;					// cur has not been credited this round
+	uint16_t frag;					// Fragment size of the queued frames
+	uint32_t slot_sym;				// TDMA: symbols per slot
+	uint32_t used;					// TDMA: symbols used in the current slot
+	// One entry per station and the broadcast queue
+	uint32_t quantum[MAX_STA+1];	// DRR: symbols credited per round
+	int32_t deficit[MAX_STA+1];		// DRR: symbols still available
+} dl_sched_t;
+
+// TCP checksum pseudo header
+typedef struct pseudotcp_t
+{
+	uint32_t saddr;
+	uint32_t daddr;
+	uint8_t zero;
+	uint8_t protocol;
+	uint16_t len;
+} pseudotcp_t;
+
+typedef struct frag_rx_t
+{
+	struct ethfrm_t frm;			// Frame being put together
+	uint8_t busy;					// frm holds fragments
+	uint8_t sta, seq;				// Destination and sequence of frm
+	uint8_t last;					// Index of the last fragment, if seen
+	uint8_t last_seen;
+	uint32_t got[FRAG_MAX/32];		// Fragments received, one bit each
+	uint64_t deadline_us;
+	uint32_t frames;				// Frames put together
+	uint32_t dropped;				// Frames given up, incomplete
+	uint32_t errors;				// Bad fragment headers
+} frag_rx_t;
+
+// Receivers hunt for the sync word after a loss: IRC byte by byte in a 4-byte
+// window, VLC symbol by symbol (every symbol is aligned by its own preamble,
+// so symbols get lost but never shifted)
+typedef struct rx_hunt_t
+{
+	uint64_t irc_bytes;				// Bytes discarded while hunting
+	uint64_t irc_relock;			// Headers found after hunting
+	uint64_t vlc_sym;				// Symbols discarded while hunting
+	uint64_t vlc_relock;
+	uint64_t vlc_cut;				// Frames cut by the next header
+	uint64_t vlc_late;				// Frames past their deadline
+	uint64_t irc_late;
+	uint16_t irc_last;				// Discarded before the last header
+	uint16_t vlc_last;
+	struct ofdmsym_t vlc_hdr;		// Header found inside the previous frame
+	uint8_t vlc_held;
+} rx_hunt_t;
+
+// ### Function prototypes #####################################################
+// *** PHY layer functions, provided by the includer ***
+void send_ofdm_sym(ofdmsym_t ofdmsym);
+// Return 1 if no symbol arrived within timeout_us, 0 waits forever
+uint8_t recv_ofdm_sym(struct ofdmsym_t *ofdmsym, uint32_t timeout_us);
+void send_ook_sym(uint8_t data);
+// Return 1 if no byte arrived within timeout_us, 0 waits forever
+uint8_t recv_ook_sym(uint8_t *data, uint32_t timeout_us);
+// End of a VLC frame, the includer may define it to hand the symbols queued by
+// send_ofdm_sym() to the PHY at once
+#ifndef VLC_TX_END
+#define VLC_TX_END()
+#endif
+// The same for the bytes of an IRC frame and send_ook_sym()
+#ifndef IRC_TX_END
+#define IRC_TX_END()
+#endif
+
+// ### Variables ###############################################################
+static rx_hunt_t rx_hunt;
+
+// ### Functions ###############################################################
+static inline uint64_t mac_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// *** Header CRC-8 ***
+static inline uint8_t hdr_crc8(const uint8_t *buf, uint16_t len)
+{
+	uint8_t crc = 0;
+	uint16_t i;
+	uint8_t j;
+
+	for (i = 0; i < len; i++)
+	{
+		crc ^= buf[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ HDR_CRC_POLY) : (uint8_t)(crc << 1);
+	}
+
+	return crc;
+}
+
+static inline uint8_t vlc_hdr_crc(const struct ofdmsym_t *ofdmsym)
+{
+	uint8_t buf[10];
+	uint8_t i;
+
+	for (i = 0; i < 4; i++)
+	{
+		buf[i] = (uint8_t)(ofdmsym->data[1] >> (24-i*8));
+		buf[4+i] = (uint8_t)(ofdmsym->data[2] >> (24-i*8));
+	}
+	buf[8] = (uint8_t)(ofdmsym->data[3] >> 24);
+	buf[9] = (uint8_t)(ofdmsym->data[3] >> 16);
+
+	return hdr_crc8(buf, sizeof(buf));
+}
+
+// *** VLC header symbol, word2 = num_ofdm << 16 | num_rem_bit, or grant ***
+static inline void vlc_hdr_make(struct ofdmsym_t *ofdmsym, uint16_t type,
+		uint32_t word2, uint8_t sta_id, uint8_t ack)
+{
+	ofdmsym->data[0] = VLC_SYNC;
+	ofdmsym->data[1] = VLC_ID | type;
+	ofdmsym->data[2] = word2;
+	ofdmsym->data[3] = ((uint32_t)sta_id << VLC_STA_SHIFT) | (ack ? VLC_ACK_BIT : 0);
+	ofdmsym->data[3] |= (uint32_t)vlc_hdr_crc(ofdmsym) << VLC_CRC_SHIFT;
+	ofdmsym->bytes = OFDM_BYTE;
+}
+
+// *** Number of OFDM symbols (airtime) of a frame, header included ***
+static inline uint32_t vlc_frm_sym(uint16_t bytes)
+{
+	return 1 + (bytes*8 + OFDM_BIT-1) / OFDM_BIT;
+}
+
+// *** Airtime of a frame sent in fragments of frag bytes, 0 sends it whole ***
+static inline uint32_t vlc_frag_sym(uint16_t bytes, uint16_t frag)
+{
+	uint32_t n;
+
+	if (frag == 0 || bytes <= frag)
+		return vlc_frm_sym(bytes);
+	n = (bytes + frag-1) / frag;
+	return (n-1) * vlc_frm_sym(frag + FRAG_HDR_SIZE) +
+			vlc_frm_sym(bytes - (n-1)*frag + FRAG_HDR_SIZE);
+}
+
+// *** data is read in place, e.g. straight from a queue record ***
+static inline void send_vlc_pdu(uint16_t type, const uint8_t *data, uint16_t bytes,
+		uint8_t sta_id, uint8_t ack)
+{
+	struct ofdmsym_t ofdmsym = {0};
+	uint16_t num_ofdm, num_rem_bit;
+	uint16_t ethfrm_idx = 0;
+	uint16_t i, j;
+
+	// *** Split an Ethernet frame into OFDM symbols ***
+	// Calculate how many OFDM symbols that we can make
+	num_ofdm = bytes * 8 / OFDM_BIT;
+	// Calculate how many remaining bits for the last OFDM symbol
+	num_rem_bit = bytes * 8 % OFDM_BIT;
+
+	// *** Send the first OFDM symbol (header symbol) ***
+	// *** Fill OFDM symbol ***
+	vlc_hdr_make(&ofdmsym, type, ((uint32_t)num_ofdm << 16) | num_rem_bit, sta_id, ack);
+	// *** Send OFDM symbol ***
+	send_ofdm_sym(ofdmsym);
+
+	// *** Send all the OFDM symbol, except the last OFDM symbol ***
+	for (i = 0; i < num_ofdm; i++)
+	{
+		// *** Clear OFDM symbol ***
+		for (j = 0; j < OFDM_WORD; j++)
+			ofdmsym.data[j] = 0;
+		// *** Fill OFDM symbol ***
+		for (j = 0; j < OFDM_BYTE; j++)
+		{
+			if (j < 4)
+				ofdmsym.data[0] |= (data[ethfrm_idx++] << (24-(j%4)*8));
+			else if (j < 8)
+				ofdmsym.data[1] |= (data[ethfrm_idx++] << (24-(j%4)*8));
+			else if (j < 12)
+				ofdmsym.data[2] |= (data[ethfrm_idx++] << (24-(j%4)*8));
+			else
+				ofdmsym.data[3] |= (data[ethfrm_idx++] << (24-(j%4)*8));
+		}
+		ofdmsym.bytes = OFDM_BYTE;
+		// *** Send OFDM symbol ***
+		send_ofdm_sym(ofdmsym);
+	}
+
+	// *** Send the last OFDM symbol ***
+	if (num_rem_bit)
+	{
+		// *** Clear OFDM symbol ***
+		for (j = 0; j < OFDM_WORD; j++)
+			ofdmsym.data[j] = 0;
+		// *** Fill OFDM symbol ***
+		for (i = 0; i < OFDM_BYTE; i++)
+		{
+			// Stop at the last byte, data may end at the end of a ring
+			if (ethfrm_idx == bytes)
+				break;
+			if (i < 4)
+				ofdmsym.data[0] |= (data[ethfrm_idx++] << (24-(i%4)*8));
+			else if (i < 8)
+				ofdmsym.data[1] |= (data[ethfrm_idx++] << (24-(i%4)*8));
+			else if (i < 12)
+				ofdmsym.data[2] |= (data[ethfrm_idx++] << (24-(i%4)*8));
+			else
+				ofdmsym.data[3] |= (data[ethfrm_idx++] << (24-(i%4)*8));
+		}
+		ofdmsym.bytes = num_rem_bit;
+		// *** Send OFDM symbol ***
+		send_ofdm_sym(ofdmsym);
+	}
+	VLC_TX_END();
+}
+
+static inline void send_vlc_buf(const uint8_t *data, uint16_t bytes, uint8_t sta_id,
+		uint8_t ack)
+{
+	send_vlc_pdu(VLC_TYPE_DATA, data, bytes, sta_id, ack);
+}
+
+static inline void send_vlc_frm(struct ethfrm_t ethfrm, uint8_t sta_id, uint8_t ack)
+{
+	send_vlc_buf(ethfrm.data, ethfrm.bytes, sta_id, ack);
+}
+
+// *** Send a frame in fragments of up to frag data bytes, whole if it fits in
+// one fragment or frag is 0. frag is at most FRAM_SIZE - FRAG_HDR_SIZE. The
+// ACK rides the first fragment. A frame of more than FRAG_MAX fragments is
+// not sent, its index would set FRAG_LAST. ***
+static inline void send_vlc_frag(const uint8_t *data, uint16_t bytes, uint8_t sta_id,
+		uint8_t ack, uint16_t frag, uint8_t seq)
+{
+	uint8_t buf[FRAM_SIZE];
+	uint16_t offset, len;
+	uint8_t idx;
+
+	if (frag == 0 || bytes <= frag)
+	{
+		send_vlc_buf(data, bytes, sta_id, ack);
+		return;
+	}
+	if ((bytes + frag-1) / frag > FRAG_MAX)
+	{
+		printf("Error: %u bytes need more than %d fragments of %u bytes\n", bytes,
+				FRAG_MAX, frag);
+		return;
+	}
+
+	for (offset = 0, idx = 0; offset < bytes; offset += len, idx++)
+	{
+		len = (bytes - offset < frag) ? (bytes - offset) : frag;
+		buf[0] = seq;
+		buf[1] = ((offset + len == bytes) ? FRAG_LAST : 0) | idx;
+		buf[2] = (uint8_t)(offset >> 8);
+		buf[3] = (uint8_t)(offset & 0xFF);
+		memcpy(buf + FRAG_HDR_SIZE, data + offset, len);
+		send_vlc_pdu(VLC_TYPE_FRAG, buf, FRAG_HDR_SIZE + len, sta_id, ack);
+		ack = 0;
+	}
+}
+
+// *** Sync word, ID, CRC, and for frames with data symbols a length that fits
+// in FRAM_SIZE ***
+static inline uint8_t vlc_hdr_ok(const struct ofdmsym_t *ofdmsym)
+{
+	uint16_t type = (uint16_t)ofdmsym->data[1];
+	uint16_t num_ofdm = (uint16_t)(ofdmsym->data[2] >> 16);
+	uint16_t num_rem_bit = (uint16_t)ofdmsym->data[2];
+
+	if (!((ofdmsym->data[0] == VLC_SYNC) && ((ofdmsym->data[1] & 0xFFFF0000) == VLC_ID)))
+		return 0;
+	if ((uint8_t)(ofdmsym->data[3] >> VLC_CRC_SHIFT) != vlc_hdr_crc(ofdmsym))
+		return 0;
+	if (type == VLC_TYPE_POLL || type == VLC_TYPE_ACK)
+		return 1;
+	return (num_rem_bit < OFDM_BIT) && (num_rem_bit % 8 == 0) &&
+			((uint32_t)num_ofdm*OFDM_BYTE + num_rem_bit/8 <= FRAM_SIZE);
+}
+
+// *** Next data symbol of a frame. RX_TIMEOUT if it is a header (symbols of
+// this frame were lost, the header is kept for the next call) or if it did
+// not come by the frame deadline ***
+static inline uint8_t vlc_recv_data(struct ofdmsym_t *ofdmsym, uint64_t deadline_us)
+{
+	uint64_t now = mac_now_us();
+
+	if (now >= deadline_us || recv_ofdm_sym(ofdmsym, (uint32_t)(deadline_us - now)))
+	{
+		rx_hunt.vlc_late++;
+		return RX_TIMEOUT;
+	}
+	if (vlc_hdr_ok(ofdmsym))
+	{
+		rx_hunt.vlc_hdr = *ofdmsym;
+		rx_hunt.vlc_held = 1;
+		rx_hunt.vlc_cut++;
+		return RX_TIMEOUT;
+	}
+	if (mac_now_us() > deadline_us)
+	{
+		rx_hunt.vlc_late++;
+		return RX_TIMEOUT;
+	}
+
+	return 0;
+}
+
+// *** Frame cut: return the frame at the bytes announced, the bytes of the
+// symbols not received are left zero ***
+static inline uint8_t vlc_cut(struct ethfrm_t *ethfrm, const uint8_t *data,
+		uint16_t bytes, uint16_t num_sym)
+{
+	memcpy(ethfrm->data, data, bytes);
+	ethfrm->bytes = bytes;
+	rx_hunt.vlc_sym += num_sym;
+
+	return RX_TIMEOUT;
+}
+
+static inline uint8_t recv_vlc_frm(struct ethfrm_t *ethfrm, uint8_t sta_id,
+		struct mac_hdr_t *hdr)
+{
+	struct ofdmsym_t ofdmsym = {0};
+	uint16_t num_ofdm, num_rem_bit, num_rem_byte;
+	uint8_t data[FRAM_SIZE] = {0};
+	uint16_t data_idx = 0;
+	uint16_t i, j, hunt = 0;
+	uint64_t deadline_us;
+
+	// *** Receive OFDM header symbol, hunting symbol by symbol ***
+	if (rx_hunt.vlc_held)
+	{
+		ofdmsym = rx_hunt.vlc_hdr;
+		rx_hunt.vlc_held = 0;
+	}
+	else
+		recv_ofdm_sym(&ofdmsym, 0);
+	// *** Check ID, CRC and length ***
+	while (!vlc_hdr_ok(&ofdmsym))
+	{
+		if (++hunt == VLC_HUNT_MAX)
+		{
+			rx_hunt.vlc_sym += hunt;
+			rx_hunt.vlc_last = hunt;
+			return HEADER_MISSING;
+		}
+		recv_ofdm_sym(&ofdmsym, 0);
+	}
+	rx_hunt.vlc_last = hunt;
+	if (hunt)
+	{
+		rx_hunt.vlc_sym += hunt;
+		rx_hunt.vlc_relock++;
+	}
+	hdr->type = (uint8_t)ofdmsym.data[1];
+	hdr->sta = (uint8_t)(ofdmsym.data[3] >> VLC_STA_SHIFT);
+	hdr->ack = (ofdmsym.data[3] & VLC_ACK_BIT) ? 1 : 0;
+	hdr->grant = 0;
+	// *** Check ACK ***
+	if ((ofdmsym.data[1] & 0x0000FFFF) == VLC_TYPE_ACK)
+	{
+		hdr->ack = 1;
+		return ACK_FOUND;
+	}
+
+	num_ofdm = (uint16_t)((ofdmsym.data[2] & 0xFFFF0000) >> 16);
+	num_rem_bit = (uint16_t)(ofdmsym.data[2] & 0x0000FFFF);
+	deadline_us = mac_now_us() + (uint64_t)(num_ofdm + 1) * VLC_SYM_BUDGET_US;
+
+	// *** Check poll, it has no data symbols ***
+	if ((ofdmsym.data[1] & 0x0000FFFF) == VLC_TYPE_POLL)
+	{
+		if (hdr->sta != sta_id)
+			return STA_MISMATCH;
+		hdr->grant = num_rem_bit;
+		return POLL_FOUND;
+	}
+
+	// *** Frame for another station, drain its symbols to stay in sync ***
+	if ((hdr->sta != sta_id) && (hdr->sta != STA_BCAST))
+	{
+		for (i = 0; i < num_ofdm + (num_rem_bit ? 1 : 0); i++)
+		{
+			if (vlc_recv_data(&ofdmsym, deadline_us))
+			{
+				vlc_cut(ethfrm, data, 0, 1 + i);
+				break;
+			}
+		}
+		return STA_MISMATCH;
+	}
+
+	// *** Split all the OFDM symbol into bytes, except the last OFDM symbol ***
+	for (i = 0; i < num_ofdm; i++)
+	{
+		// Receive one OFDM symbol (blocking)
+		if (vlc_recv_data(&ofdmsym, deadline_us))
+			return vlc_cut(ethfrm, data, num_ofdm*OFDM_BYTE + num_rem_bit/8, 1 + i);
+		// *** Split one OFDM symbol to bytes ***
+		for (j = 0; j < OFDM_BYTE; j++)
+		{
+			if (j < 4)
+				data[data_idx++] |= (ofdmsym.data[0] >> (24-(j%4)*8));
+			else if (j < 8)
+				data[data_idx++] |= (ofdmsym.data[1] >> (24-(j%4)*8));
+			else if (j < 12)
+				data[data_idx++] |= (ofdmsym.data[2] >> (24-(j%4)*8));
+			else
+				data[data_idx++] |= (ofdmsym.data[3] >> (24-(j%4)*8));
+		}
+	}
+
+	// *** Split the last OFDM symbol into bytes ***
+	if (num_rem_bit)
+	{
+		// Calculate number of remaining bytes in the last OFDM symbol
+		num_rem_byte = num_rem_bit / 8;
+		// Receive the last OFDM symbol (blocking)
+		if (vlc_recv_data(&ofdmsym, deadline_us))
+			return vlc_cut(ethfrm, data, num_ofdm*OFDM_BYTE + num_rem_bit/8,
+					1 + num_ofdm);
+		// *** Split the last OFDM symbol to bytes ***
+		for (i = 0; i < num_rem_byte; i++)
+		{
+			if (i < 4)
+				data[data_idx++] |= (ofdmsym.data[0] >> (24-(i%4)*8));
+			else if (i < 8)
+				data[data_idx++] |= (ofdmsym.data[1] >> (24-(i%4)*8));
+			else if (i < 12)
+				data[data_idx++] |= (ofdmsym.data[2] >> (24-(i%4)*8));
+			else
+				data[data_idx++] |= (ofdmsym.data[3] >> (24-(i%4)*8));
+		}
+	}
+
+	// *** Construct ethrenet frame ***
+	for (i = 0; i < data_idx; i++)
+	{
+		ethfrm->data[i] = data[i];
+	}
+	ethfrm->bytes = data_idx;
+
+	return 0;	// Success receive
+}
+
+static inline void send_vlc_poll(uint8_t sta_id, uint16_t grant, uint8_t ack)
+{
+	struct ofdmsym_t ofdmsym = {0};
+
+	vlc_hdr_make(&ofdmsym, VLC_TYPE_POLL, grant, sta_id, ack);
+	send_ofdm_sym(ofdmsym);
+	VLC_TX_END();
+}
+
+static inline void send_irc_frm(struct ethfrm_t ethfrm, uint8_t sta_id, uint8_t type,
+		uint8_t ack)
+{
+	uint8_t header[IRC_HDR_SIZE];
+	uint16_t i;
+
+	// *** Build OOK header ***
+	// *** ID ***
+	header[0] = (uint8_t)(IRC_SYNC >> 24);
+	header[1] = (uint8_t)(IRC_SYNC >> 16);
+	header[2] = (uint8_t)(IRC_SYNC >> 8);
+	header[3] = (uint8_t)IRC_SYNC;
+	// *** Frame type and sender ***
+	header[4] = type | (ack ? IRC_FLAG_ACK : 0);
+	header[5] = sta_id;
+	// *** Number of bytes ***
+	header[6] = (uint8_t)(ethfrm.bytes >> 8);
+	header[7] = (uint8_t)(ethfrm.bytes & 0xFF);
+	header[8] = hdr_crc8(header + 4, 4);
+
+	// *** Send OOK header ***
+	for (i = 0; i < IRC_HDR_SIZE; i++)
+		send_ook_sym(header[i]);
+
+	// *** Send OOK data ***
+	for (i = 0; i < ethfrm.bytes; i++)
+	{
+		send_ook_sym(ethfrm.data[i]);
+	}
+	IRC_TX_END();
+}
+
+// *** Sync word, CRC and length ***
+static inline uint8_t irc_hdr_ok(const uint8_t *header)
+{
+	return (header[0] == (uint8_t)(IRC_SYNC >> 24)) &&
+			(header[1] == (uint8_t)(IRC_SYNC >> 16)) &&
+			(header[2] == (uint8_t)(IRC_SYNC >> 8)) &&
+			(header[3] == (uint8_t)IRC_SYNC) &&
+			(header[8] == hdr_crc8(header + 4, 4)) &&
+			(((header[6] << 8) | header[7]) <= FRAM_SIZE);
+}
+
+// timeout_us bounds the wait for the first byte, 0 waits forever
+static inline uint8_t recv_irc_frm(struct ethfrm_t *ethfrm, struct mac_hdr_t *hdr,
+		uint32_t timeout_us)
+{
+	uint8_t header[IRC_HDR_SIZE] = {0};
+	uint16_t i, n = 0;
+	uint64_t now, deadline_us;
+	uint32_t byte_us;
+
+	// *** Hunt for the header byte by byte, in a window of its size ***
+	do
+	{
+		memmove(header, header + 1, IRC_HDR_SIZE - 1);
+		if (recv_ook_sym(&header[IRC_HDR_SIZE-1], n ? IRC_BYTE_TIMEOUT_US : timeout_us))
+		{
+			rx_hunt.irc_bytes += n;
+			rx_hunt.irc_last = n;
+			return RX_TIMEOUT;
+		}
+		if (++n > IRC_HUNT_MAX)
+		{
+			rx_hunt.irc_bytes += n;
+			rx_hunt.irc_last = n;
+			return HEADER_MISSING;
+		}
+	}
+	while (n < IRC_HDR_SIZE || !irc_hdr_ok(header));
+	rx_hunt.irc_last = n - IRC_HDR_SIZE;
+	if (n > IRC_HDR_SIZE)
+	{
+		rx_hunt.irc_bytes += n - IRC_HDR_SIZE;
+		rx_hunt.irc_relock++;
+	}
+
+	hdr->sta = header[5];
+	hdr->grant = 0;
+	// *** Check ACK ***
+	if (header[4] == IRC_TYPE_ACK)
+	{
+		hdr->type = IRC_TYPE_ACK;
+		hdr->ack = 1;
+		return ACK_FOUND;
+	}
+	hdr->type = header[4] & ~IRC_FLAG_ACK;
+	hdr->ack = (header[4] & IRC_FLAG_ACK) ? 1 : 0;
+
+	// *** Get number of bytes ***
+	ethfrm->bytes = (uint16_t)((header[6] << 8) | header[7]);
+
+	// *** Receive OOK data, within the frame deadline ***
+	deadline_us = mac_now_us() + (uint64_t)ethfrm->bytes * IRC_BYTE_BUDGET_US +
+			IRC_BYTE_TIMEOUT_US;
+	for (i = 0; i < ethfrm->bytes; i++)
+	{
+		now = mac_now_us();
+		if (now >= deadline_us)
+		{
+			rx_hunt.irc_late++;
+			return RX_TIMEOUT;
+		}
+		byte_us = (deadline_us - now < IRC_BYTE_TIMEOUT_US) ?
+				(uint32_t)(deadline_us - now) : IRC_BYTE_TIMEOUT_US;
+		if (recv_ook_sym(&ethfrm->data[i], byte_us))
+			return RX_TIMEOUT;
+	}
+
+	return 0;	// Success receive
+}
+
+// *** Wait until the IRC line has been idle for IRC_BYTE_TIMEOUT_US, e.g.
+// after a broken frame, so that the next frame starts on a clean line ***
+static inline void recv_irc_drain(void)
+{
+	uint8_t data;
+
+	while (recv_ook_sym(&data, IRC_BYTE_TIMEOUT_US) == 0);
+}
+
+// *** Fragment reassembly ***
+static inline void frag_rx_init(frag_rx_t *fr)
+{
+	memset(fr, 0, sizeof(*fr));
+}
+
+// Add a fragment received for sta. Return the whole frame once its last
+// missing fragment is in, NULL otherwise. The frame stays valid until the
+// next call.
+static inline ethfrm_t *frag_rx_push(frag_rx_t *fr, ethfrm_t *ethfrm, uint8_t sta)
+{
+	uint8_t seq, idx, last, i;
+	uint16_t offset, len;
+	uint64_t now = mac_now_us();
+
+	// *** Give up on a frame that took too long ***
+	if (fr->busy && now > fr->deadline_us)
+	{
+		fr->busy = 0;
+		fr->dropped++;
+	}
+
+	// *** Check fragment header ***
+	if (ethfrm->bytes < FRAG_HDR_SIZE)
+	{
+		fr->errors++;
+		return NULL;
+	}
+	seq = ethfrm->data[0];
+	last = ethfrm->data[1] & FRAG_LAST;
+	idx = ethfrm->data[1] & ~FRAG_LAST;
+	offset = ((uint16_t)ethfrm->data[2] << 8) | ethfrm->data[3];
+	len = ethfrm->bytes - FRAG_HDR_SIZE;
+	if ((uint32_t)offset + len > LINK_MTU)
+	{
+		fr->errors++;
+		return NULL;
+	}
+
+	// *** First fragment of a new frame, the old one is lost ***
+	if (!fr->busy || fr->sta != sta || fr->seq != seq)
+	{
+		if (fr->busy)
+			fr->dropped++;
+		fr->busy = 1;
+		fr->sta = sta;
+		fr->seq = seq;
+		fr->last_seen = 0;
+		memset(fr->got, 0, sizeof(fr->got));
+		fr->deadline_us = now + FRAG_TIMEOUT_US;
+	}
+
+	// *** Duplicate ***
+	if (fr->got[idx / 32] & (1UL << (idx % 32)))
+		return NULL;
+
+	memcpy(fr->frm.data + offset, ethfrm->data + FRAG_HDR_SIZE, len);
+	fr->got[idx / 32] |= (1UL << (idx % 32));
+	if (last)
+	{
+		fr->last = idx;
+		fr->last_seen = 1;
+		fr->frm.bytes = offset + len;
+	}
+
+	// *** Complete when every fragment up to the last one is in ***
+	if (!fr->last_seen)
+		return NULL;
+	for (i = 0; i <= fr->last; i++)
+	{
+		if (!(fr->got[i / 32] & (1UL << (i % 32))))
+			return NULL;
+	}
+	fr->busy = 0;
+	fr->frames++;
+
+	return &fr->frm;
+}
+
+// *** Per-station queue, size in bytes ***
+#ifdef LAT_TRACE
+#define STAQ_META		sizeof(struct lat_ts_t)
+#else
+#define STAQ_META		0
+#endif
+
+static inline int staq_init(staq_t *q, uint32_t size)
+{
+	if (pktring_init(&q->ring, size) != 0)
+		return -1;
+	pthread_mutex_init(&q->mutex, NULL);
+
+	return 0;
+}
+
+static inline uint8_t staq_push(staq_t *q, ethfrm_t *ethfrm)
+{
+	uint8_t *p;
+
+	pthread_mutex_lock(&q->mutex);
+	p = pktring_reserve(&q->ring, STAQ_META + ethfrm->bytes);
+	if (p != NULL)
+	{
+#ifdef LAT_TRACE
+		LAT_STAMP(&ethfrm->ts, LAT_PUSH, ethfrm->bytes);
+		memcpy(p, &ethfrm->ts, STAQ_META);
+#endif
+		memcpy(p + STAQ_META, ethfrm->data, ethfrm->bytes);
+		pktring_commit(&q->ring, STAQ_META + ethfrm->bytes);
+	}
+	pthread_mutex_unlock(&q->mutex);
+
+	return p ? 0 : 1;	// 1: push fail (buffer full)
+}
+
+// *** Single producer: receive straight into the queue ***
+// Room for up to bytes frame bytes, NULL if the queue is full
+static inline uint8_t *staq_reserve(staq_t *q, uint16_t bytes)
+{
+	uint8_t *p = pktring_reserve(&q->ring, STAQ_META + bytes);
+
+	return p ? p + STAQ_META : NULL;
+}
+
+static inline void staq_commit(staq_t *q, uint8_t *data, uint16_t bytes)
+{
+#ifdef LAT_TRACE
+	lat_ts_t *ts = (lat_ts_t *)(data - STAQ_META);
+	memset(ts, 0, STAQ_META);
+	LAT_STAMP(ts, LAT_RX, bytes);
+	LAT_STAMP(ts, LAT_PUSH, bytes);
+#endif
+	(void)data;
+	pktring_commit(&q->ring, STAQ_META + bytes);
+}
+
+// Head frame in place, NULL if the queue is empty. Drop it with
+// staq_release() once used.
+static inline uint8_t *staq_peek(staq_t *q, uint16_t *bytes)
+{
+	uint32_t len = 0;
+	uint8_t *data = pktring_peek(&q->ring, &len);
+
+	if (data == NULL)
+	{
+		*bytes = 0;
+		return NULL;
+	}
+	*bytes = (uint16_t)(len - STAQ_META);
+	return data + STAQ_META;
+}
+
+#ifdef LAT_TRACE
+// Timestamps of a frame returned by staq_peek()
+static inline lat_ts_t *staq_ts(uint8_t *data)
+{
+	return (lat_ts_t *)(data - STAQ_META);
+}
+#endif
+
+static inline void staq_release(staq_t *q)
+{
+	pktring_release(&q->ring);
+}
+
+// ethfrm is left untouched if the queue is empty
+static inline uint8_t staq_pop(staq_t *q, ethfrm_t *ethfrm)
+{
+	uint16_t bytes;
+	uint8_t *data = staq_peek(q, &bytes);
+
+	if (data == NULL)
+		return 1;	// Pop fail (buffer empty)
+	ethfrm->bytes = bytes;
+	memcpy(ethfrm->data, data, bytes);
+#ifdef LAT_TRACE
+	ethfrm->ts = *staq_ts(data);
+	LAT_STAMP(&ethfrm->ts, LAT_POP, ethfrm->bytes);
+#endif
+	staq_release(q);
+
+	return 0;
+}
+
+// Airtime of the head frame in symbols, 0 if the queue is empty
+static inline uint32_t staq_peek_sym(staq_t *q)
+{
+	uint16_t bytes;
+
+	return staq_peek(q, &bytes) ? vlc_frm_sym(bytes) : 0;
+}
+
+// *** Downlink scheduler ***
+static inline void dl_sched_init(dl_sched_t *s, uint8_t mode, uint8_t num_sta)
+{
+	uint8_t i;
+
+	s->mode = mode;
+	s->num_sta = num_sta;
+	s->cur = 0;
+	s->fresh = 1;
+	s->frag = 0;
+	s->slot_sym = SCHED_SLOT_SYM;
+	s->used = 0;
+	for (i = 0; i <= MAX_STA; i++)
+	{
+		s->quantum[i] = SCHED_QUANTUM;
+		s->deficit[i] = 0;
+	}
+}
+
+static inline void dl_sched_next_sta(dl_sched_t *s)
+{
+	s->cur = (s->cur + 1 == s->num_sta) ? 0 : s->cur + 1;
+	s->fresh = 1;
+	s->used = 0;
+}
+
+// Pick the next frame to send and return it in place, the caller sends it
+// and then calls staq_release(&q[sta]). Return its station, or -1 if all
+// queues are empty. q[] holds one queue per station.
+static inline int dl_sched_peek(dl_sched_t *s, staq_t *q, uint8_t **data,
+		uint16_t *bytes)
+{
+	uint8_t visited;
+	uint32_t sym;
+	int sta;
+
+	// Visit every station once, plus the current one again for a new slot
+	for (visited = 0; visited <= s->num_sta; visited++)
+	{
+		sta = s->cur;
+		*data = staq_peek(&q[sta], bytes);
+		sym = *data ? vlc_frag_sym(*bytes, s->frag) : 0;
+
+		if (s->mode == SCHED_TDMA)
+		{
+			// *** Send while the head frame fits in the rest of the slot ***
+			if (sym && (s->used + sym <= s->slot_sym || s->used == 0))
+			{
+				s->used += sym;
+				return sta;
+			}
+		}
+		else
+		{
+			// *** Credit the station once per round ***
+			if (sym == 0)
+			{
+				// Idle stations do not bank credit
+				s->deficit[sta] = 0;
+			}
+			else
+			{
+				if (s->fresh)
+				{
+					s->deficit[sta] += s->quantum[sta];
+					s->fresh = 0;
+				}
+				if ((int32_t)sym <= s->deficit[sta])
+				{
+					s->deficit[sta] -= sym;
+					return sta;
+				}
+			}
+		}
+
+		// *** Slot or credit exhausted, serve the next station ***
+		dl_sched_next_sta(s);
+	}
+
+	return -1;
+}
+
+// Same, copying the frame out
+static inline int dl_sched_pop(dl_sched_t *s, staq_t *q, ethfrm_t *ethfrm)
+{
+	uint8_t *data;
+	int sta = dl_sched_peek(s, q, &data, &ethfrm->bytes);
+
+	if (sta >= 0)
+	{
+		memcpy(ethfrm->data, data, ethfrm->bytes);
+		staq_release(&q[sta]);
+	}
+
+	return sta;
+}
+
+
+// *** IPv4 forwarding ***
+// One's complement sum of size bytes, odd sizes padded with zero
+static inline uint32_t csum_partial(const uint8_t *buff, unsigned size, uint32_t sum)
+{
+	uint16_t word16;
+	unsigned i;
+
+	for (i = 0; i + 1 < size; i += 2)
+	{
+		memcpy(&word16, buff + i, 2);
+		sum += word16;
+	}
+	if (size & 1)
+		sum += buff[i];
+
+	return sum;
+}
+
+// IP header checksum of _16bitword words, in network byte order
+static inline unsigned short checksum(unsigned short *buff, int _16bitword)
+{
+	unsigned long sum;
+	unsigned short ans;
+
+	for(sum = 0; _16bitword > 0; _16bitword--)
+		sum += htons(*(buff)++);
+	
+	sum = ((sum >> 16) + (sum & 0xFFFF));
+	sum += (sum >> 16);
+	ans = (unsigned short)(~sum);
+	ans = ((ans & 0x00FF) << 8) + ((ans & 0xFF00) >> 8);
+
+	return ans;
+}
+
+// ICMP or TCP checksum of size bytes, to be stored as is
+static inline unsigned short checksumtcp(const char *buff, unsigned size)
+{
+	uint32_t sum = csum_partial((const uint8_t *)buff, size, 0);
+
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return ~sum;
+}
+
+// *** Rebuild an IPv4 ICMP or TCP frame for the next hop: new MAC addresses,
+// source and destination address replaced unless 0, checksums recomputed.
+// Return the bytes to send, 0 if the frame is not IPv4 ICMP or TCP ***
+static inline uint16_t ip_frm_rebuild(const ethfrm_t *in, ethfrm_t *out,
+		const uint8_t *mac_src, const uint8_t *mac_dst, uint32_t saddr, uint32_t daddr)
+{
+	const struct ethhdr *eth = (const struct ethhdr *)(in->data);
+	const struct iphdr *ip = (const struct iphdr *)(in->data + sizeof(struct ethhdr));
+	uint16_t iphdrlen = ip->ihl * 4;
+	uint16_t tot_len = ntohs(ip->tot_len);
+	uint16_t l4_len = tot_len - iphdrlen;
+	struct ethhdr *eth_wr = (struct ethhdr *)(out->data);
+	struct iphdr *iph = (struct iphdr *)(out->data + sizeof(struct ethhdr));
+	uint8_t *l4 = out->data + sizeof(struct ethhdr) + iphdrlen;
+	pseudotcp_t pseudotcp;
+	uint32_t sum;
+
+	// *** Check Ethernet frame ***
+	if (eth->h_proto != htons(ETH_P_IP) || iphdrlen < sizeof(struct iphdr) ||
+			tot_len < iphdrlen || tot_len + sizeof(struct ethhdr) > LINK_MTU)
+		return 0;
+	if (!(ip->protocol == IPPROTO_ICMP && l4_len >= sizeof(struct icmphdr)) &&
+			!(ip->protocol == IPPROTO_TCP && l4_len >= sizeof(struct tcphdr)))
+		return 0;
+
+	// *** Constructing Ethernet header ***
+	memcpy(eth_wr->h_dest, mac_dst, ETH_ALEN);
+	memcpy(eth_wr->h_source, mac_src, ETH_ALEN);
+	eth_wr->h_proto = htons(ETH_P_IP);
+
+	// *** IP header with its options, ICMP or TCP header and payload ***
+	memcpy(iph, ip, tot_len);
+	if (saddr)
+		iph->saddr = saddr;
+	if (daddr)
+		iph->daddr = daddr;
+
+	// *** Completing ICMP or TCP header ***
+	if (ip->protocol == IPPROTO_ICMP)
+	{
+		struct icmphdr *ih = (struct icmphdr *)l4;
+		ih->checksum = 0;
+		ih->checksum = checksumtcp((const char *)l4, l4_len);
+	}
+	else
+	{
+		struct tcphdr *th = (struct tcphdr *)l4;
+		pseudotcp.saddr = iph->saddr;
+		pseudotcp.daddr = iph->daddr;
+		pseudotcp.zero = 0;
+		pseudotcp.protocol = IPPROTO_TCP;
+		pseudotcp.len = htons(l4_len);
+		th->th_sum = 0;
+		sum = csum_partial((const uint8_t *)&pseudotcp, sizeof(pseudotcp), 0);
+		sum = csum_partial(l4, l4_len, sum);
+		while (sum >> 16)
+			sum = (sum & 0xFFFF) + (sum >> 16);
+		th->th_sum = ~sum;
+	}
+
+	// *** Completing IP header ***
+	iph->check = 0;
+	iph->check = checksum((unsigned short *)iph, iphdrlen/2);
+
+	return tot_len + sizeof(struct ethhdr);
+}
+
+#endif
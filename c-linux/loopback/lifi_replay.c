@@ -0,0 +1,562 @@
+// ### Description #############################################################
+// End-to-end replay of a pcap through the access point and the station on one
+// Linux host.
+//
+//	lifi_replay -> lifi_wlan0p => lifi_wlan0 -> lifi_access_point_sim
+//		-> phy_sim (VLC ring, IRC slots) ->
+//	lifi_station_sim -> lifi_eth0 => lifi_eth0p -> lifi_replay
+//
+// Both daemons are built with -DPHY_SIM, which replaces their PHY registers by
+// the shared-memory medium of phy_sim.h and points them at the veth pairs
+// above. This program creates the medium and the veth pairs, starts the
+// daemons, replays the pcap into the access point's WLAN side with the
+// original timing (or SPEED times faster, 0 as fast as possible) and captures
+// what the station emits on its Ethernet side.
+//
+// The bridges only forward IPv4 ICMP and TCP, other packets are skipped.
+// Every replayed packet is addressed to the access point's WLAN MAC and
+// numbered in its IPv4 ID, which both bridges carry through, so that the
+// capture can be matched with the replay. Goodput, loss, duplicates,
+// reordering and the one-way latency distribution are reported.
+//
+// Build:
+//	gcc -O2 -DPHY_SIM -o lifi_access_point_sim lifi_access_point.c -lpthread -lrt
+//	gcc -O2 -DPHY_SIM -o lifi_station_sim lifi_station.c -lpthread -lrt
+//	gcc -O2 -o lifi_replay lifi_replay.c -lpthread -lrt
+// Usage (root): lifi_replay PCAP [SPEED [SYM_NS [BYTE_NS]]]
+
+// ### Includes ################################################################
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+#include "lifi_mac.h"
+#include "phy_sim.h"
+
+// ### Defines #################################################################
+// Daemons built with -DPHY_SIM
+#define REPLAY_AP_BIN		"./lifi_access_point_sim"
+#define REPLAY_STA_BIN		"./lifi_station_sim"
+// veth pairs, the daemons' side is set in their PHY_SIM configuration
+#define REPLAY_WLAN			"lifi_wlan0"
+#define REPLAY_WLAN_PEER	"lifi_wlan0p"
+#define REPLAY_ETH			"lifi_eth0"
+#define REPLAY_ETH_PEER		"lifi_eth0p"
+// Access point's WLAN MAC and station's laptop MAC, as in the daemons
+#define REPLAY_MAC_WLAN		{0x74, 0xDA, 0x38, 0xA8, 0x87, 0x10}
+#define REPLAY_MAC_LAPTOP	{0x00, 0x30, 0x67, 0x0B, 0xE0, 0xFD}
+// Simulated airtime, as mac_bench
+#define REPLAY_SYM_NS		2000
+#define REPLAY_BYTE_NS		4000
+// Time for the daemons to start, and to drain after the last packet
+#define REPLAY_START_MS		500
+#define REPLAY_DRAIN_MS		2000
+// *** pcap ***
+#define PCAP_MAGIC_US		0xA1B2C3D4
+#define PCAP_MAGIC_NS		0xA1B23C4D
+#define PCAP_LINK_ETH		1
+
+// ### Struct definitions ######################################################
+typedef struct pcap_hdr_t
+{
+	uint32_t magic;
+	uint16_t ver_major, ver_minor;
+	int32_t zone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} pcap_hdr_t;
+
+typedef struct pcap_rec_t
+{
+	uint32_t ts_sec, ts_frac;
+	uint32_t caplen, len;
+} pcap_rec_t;
+
+typedef struct replay_pkt_t
+{
+	uint8_t *data;
+	uint16_t bytes;
+	uint64_t ts_ns;					// pcap time
+	uint64_t tx_ns;					// Replayed at
+	uint64_t rx_ns;					// Captured at, 0 if lost
+} replay_pkt_t;
+
+// ### Variables ###############################################################
+replay_pkt_t *pkt;
+uint32_t num_pkt, num_skip;
+volatile uint32_t num_sent;
+volatile uint64_t last_rx_ns;
+volatile int capture_stop;
+uint32_t num_rx, num_dup, num_reorder, num_foreign;
+uint64_t rx_bytes;
+pid_t pid_ap, pid_sta;
+uint8_t mac_wlan[6] = REPLAY_MAC_WLAN;
+uint8_t mac_laptop[6] = REPLAY_MAC_LAPTOP;
+
+// ### Function prototypes #####################################################
+int pcap_load(const char *name);
+void replay_setup(void);
+void replay_cleanup(void);
+pid_t replay_spawn(const char *bin, const char *arg, const char *log);
+int raw_open(const char *iface);
+void *capture_handler(void *arg);
+void replay_report(uint64_t t_start);
+int cmp_u64(const void *a, const void *b);
+uint16_t ip_checksum(const uint8_t *data, uint16_t bytes);
+
+// ### Main ####################################################################
+int main(int argc, char *argv[])
+{
+	double speed = 1.0;
+	int sym_ns = REPLAY_SYM_NS;
+	int byte_ns = REPLAY_BYTE_NS;
+	phy_sim_t *sim;
+	pthread_t thread_capture;
+	struct sockaddr_ll sll;
+	struct timespec tim;
+	uint64_t t_start, t_send;
+	int fd_tx;
+	uint32_t i;
+
+	// *** Get PCAP, SPEED, SYM_NS and BYTE_NS ***
+	if (argc < 2 || argc > 5)
+	{
+		printf("Usage: %s PCAP [SPEED [SYM_NS [BYTE_NS]]]\n", argv[0]);
+		return -1;
+	}
+	if (argc >= 3)
+		speed = atof(argv[2]);
+	if (argc >= 4)
+		sym_ns = atoi(argv[3]);
+	if (argc >= 5)
+		byte_ns = atoi(argv[4]);
+	if (speed < 0 || sym_ns < 0 || byte_ns < 1)
+	{
+		printf("Error: SPEED >= 0, SYM_NS >= 0, BYTE_NS >= 1.\n");
+		return -1;
+	}
+	if (pcap_load(argv[1]) < 0)
+		return -1;
+	printf("%u packets to replay, %u skipped (not IPv4 ICMP/TCP, truncated or too long)\n",
+			num_pkt, num_skip);
+
+	// *** veth pairs, simulated medium and the two daemons ***
+	replay_setup();
+	sim = phy_sim_open(PHY_SIM_NAME, 1);
+	if (sim == NULL)
+	{
+		perror("Couldn't create the simulated PHY");
+		replay_cleanup();
+		return -1;
+	}
+	sim->sym_ns = sym_ns;
+	sim->byte_ns = byte_ns;
+	pid_ap = replay_spawn(REPLAY_AP_BIN, NULL, "lifi_replay_ap.log");
+	pid_sta = replay_spawn(REPLAY_STA_BIN, "0", "lifi_replay_sta.log");
+	usleep(REPLAY_START_MS * 1000);
+
+	// *** Capture the station's Ethernet side ***
+	if (pthread_create(&thread_capture, NULL, capture_handler, NULL) != 0)
+	{
+		printf("Thread capture create error\n");
+		replay_cleanup();
+		return -1;
+	}
+
+	// *** Replay into the access point's WLAN side ***
+	fd_tx = raw_open(REPLAY_WLAN_PEER);
+	if (fd_tx < 0)
+	{
+		replay_cleanup();
+		return -1;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = if_nametoindex(REPLAY_WLAN_PEER);
+	sll.sll_halen = ETH_ALEN;
+	memcpy(sll.sll_addr, mac_wlan, ETH_ALEN);
+
+	if (speed > 0)
+		printf("Replaying at %.2gx, ", speed);
+	else
+		printf("Replaying back to back, ");
+	printf("VLC symbol %d ns, IRC byte %d ns\n", sym_ns, byte_ns);
+	t_start = phy_sim_now_ns();
+	for (i = 0; i < num_pkt; i++)
+	{
+		// *** Wait for the packet's time ***
+		if (speed > 0)
+		{
+			t_send = t_start + (uint64_t)((pkt[i].ts_ns - pkt[0].ts_ns) / speed);
+			tim.tv_sec = t_send / 1000000000ULL;
+			tim.tv_nsec = t_send % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL);
+		}
+		pkt[i].tx_ns = phy_sim_now_ns();
+		__atomic_store_n(&num_sent, i + 1, __ATOMIC_RELEASE);
+		if (sendto(fd_tx, pkt[i].data, pkt[i].bytes, 0, (struct sockaddr *)&sll,
+				sizeof(sll)) < 0)
+			perror("Replay send error");
+	}
+
+	// *** Wait until nothing has arrived for REPLAY_DRAIN_MS ***
+	last_rx_ns = phy_sim_now_ns();
+	while (phy_sim_now_ns() - last_rx_ns < REPLAY_DRAIN_MS * 1000000ULL)
+		usleep(10000);
+	capture_stop = 1;
+	pthread_join(thread_capture, NULL);
+	close(fd_tx);
+
+	replay_report(t_start);
+
+	sim->stop = 1;
+	replay_cleanup();
+
+	return 0;
+}
+
+// ### Functions ###############################################################
+// *** Read the whole pcap, keep the packets the bridges forward, addressed to
+// the access point and numbered in the IPv4 ID ***
+int pcap_load(const char *name)
+{
+	pcap_hdr_t hdr;
+	pcap_rec_t rec;
+	uint8_t frm[65536];
+	uint8_t swap, nsec;
+	uint32_t cap = 1024;
+	FILE *f;
+
+	f = fopen(name, "rb");
+	if (f == NULL)
+	{
+		perror("Couldn't open the pcap");
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+	{
+		printf("Error: %s is too short.\n", name);
+		fclose(f);
+		return -1;
+	}
+	swap = (hdr.magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+			hdr.magic == __builtin_bswap32(PCAP_MAGIC_NS));
+	if (swap)
+	{
+		hdr.magic = __builtin_bswap32(hdr.magic);
+		hdr.linktype = __builtin_bswap32(hdr.linktype);
+	}
+	if (hdr.magic != PCAP_MAGIC_US && hdr.magic != PCAP_MAGIC_NS)
+	{
+		printf("Error: %s is not a pcap (pcapng is not supported).\n", name);
+		fclose(f);
+		return -1;
+	}
+	if ((hdr.linktype & 0xFFFF) != PCAP_LINK_ETH)
+	{
+		printf("Error: %s is not an Ethernet capture.\n", name);
+		fclose(f);
+		return -1;
+	}
+	nsec = (hdr.magic == PCAP_MAGIC_NS);
+
+	pkt = (replay_pkt_t *)malloc(cap * sizeof(replay_pkt_t));
+	while (pkt != NULL && fread(&rec, sizeof(rec), 1, f) == 1)
+	{
+		if (swap)
+		{
+			rec.ts_sec = __builtin_bswap32(rec.ts_sec);
+			rec.ts_frac = __builtin_bswap32(rec.ts_frac);
+			rec.caplen = __builtin_bswap32(rec.caplen);
+			rec.len = __builtin_bswap32(rec.len);
+		}
+		if (rec.caplen > sizeof(frm) || fread(frm, rec.caplen, 1, f) != 1)
+			break;
+
+		// *** What the access point forwards: whole IPv4 ICMP or TCP ***
+		struct ethhdr *eth = (struct ethhdr *)frm;
+		struct iphdr *ip = (struct iphdr *)(frm + sizeof(struct ethhdr));
+		if (rec.caplen != rec.len || rec.len > LINK_MTU ||
+				rec.len < sizeof(struct ethhdr) + sizeof(struct iphdr) ||
+				eth->h_proto != htons(ETH_P_IP) ||
+				(ip->protocol != IPPROTO_ICMP && ip->protocol != IPPROTO_TCP) ||
+				ntohs(ip->tot_len) + sizeof(struct ethhdr) > rec.len)
+		{
+			num_skip++;
+			continue;
+		}
+
+		// *** Address and number it ***
+		memcpy(eth->h_dest, mac_wlan, ETH_ALEN);
+		ip->id = htons((uint16_t)num_pkt);
+		ip->check = 0;
+		ip->check = ip_checksum((uint8_t *)ip, ip->ihl * 4);
+
+		if (num_pkt == cap)
+		{
+			cap *= 2;
+			pkt = (replay_pkt_t *)realloc(pkt, cap * sizeof(replay_pkt_t));
+			if (pkt == NULL)
+				break;
+		}
+		pkt[num_pkt].data = (uint8_t *)malloc(rec.len);
+		if (pkt[num_pkt].data == NULL)
+			break;
+		memcpy(pkt[num_pkt].data, frm, rec.len);
+		pkt[num_pkt].bytes = rec.len;
+		pkt[num_pkt].ts_ns = (uint64_t)rec.ts_sec * 1000000000ULL +
+				(nsec ? rec.ts_frac : rec.ts_frac * 1000ULL);
+		pkt[num_pkt].tx_ns = 0;
+		pkt[num_pkt].rx_ns = 0;
+		num_pkt++;
+	}
+	fclose(f);
+
+	if (pkt == NULL || num_pkt == 0)
+	{
+		printf("Error: No packet to replay in %s.\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+void replay_setup(void)
+{
+	replay_cleanup();
+	system("ip link add " REPLAY_WLAN " type veth peer name " REPLAY_WLAN_PEER);
+	system("ip link add " REPLAY_ETH " type veth peer name " REPLAY_ETH_PEER);
+	// Keep the host's own IPv6 traffic off the links
+	system("sysctl -qw net.ipv6.conf." REPLAY_WLAN ".disable_ipv6=1 "
+			"net.ipv6.conf." REPLAY_WLAN_PEER ".disable_ipv6=1 "
+			"net.ipv6.conf." REPLAY_ETH ".disable_ipv6=1 "
+			"net.ipv6.conf." REPLAY_ETH_PEER ".disable_ipv6=1");
+	// Addresses the daemons expect on their ifaces, and the laptop's MAC
+	system("ip link set " REPLAY_WLAN " address 74:da:38:a8:87:10");
+	system("ip link set " REPLAY_ETH " address 00:26:32:f0:56:70");
+	system("ip link set " REPLAY_ETH_PEER " address 00:30:67:0b:e0:fd");
+	system("ip addr add 192.168.1.105/24 dev " REPLAY_WLAN);
+	system("ip addr add 192.168.3.105/24 dev " REPLAY_ETH);
+	system("ip link set " REPLAY_WLAN " up");
+	system("ip link set " REPLAY_WLAN_PEER " up");
+	system("ip link set " REPLAY_ETH " up");
+	system("ip link set " REPLAY_ETH_PEER " up");
+}
+
+void replay_cleanup(void)
+{
+	if (pid_ap > 0)
+	{
+		kill(pid_ap, SIGTERM);
+		waitpid(pid_ap, NULL, 0);
+		pid_ap = 0;
+	}
+	if (pid_sta > 0)
+	{
+		kill(pid_sta, SIGTERM);
+		waitpid(pid_sta, NULL, 0);
+		pid_sta = 0;
+	}
+	system("ip link del " REPLAY_WLAN " 2>/dev/null");
+	system("ip link del " REPLAY_ETH " 2>/dev/null");
+	shm_unlink(PHY_SIM_NAME);
+}
+
+// *** Start a daemon with its output in log ***
+pid_t replay_spawn(const char *bin, const char *arg, const char *log)
+{
+	pid_t pid = fork();
+	int fd;
+
+	if (pid == 0)
+	{
+		fd = open("/dev/null", O_RDONLY);
+		if (fd >= 0)
+			dup2(fd, STDIN_FILENO);
+		fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0)
+		{
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execl(bin, bin, arg, (char *)NULL);
+		perror("Couldn't start the daemon");
+		_exit(-1);
+	}
+
+	return pid;
+}
+
+// *** Raw socket bound to iface ***
+int raw_open(const char *iface)
+{
+	struct sockaddr_ll sll;
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0)
+	{
+		printf("Socket create error\n");
+		return -1;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_nametoindex(iface);
+	if (sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+	{
+		printf("Socket bind error on %s\n", iface);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// *** Match what the station sends to the laptop with the replayed packets ***
+void *capture_handler(void *arg)
+{
+	uint8_t frm[65536];
+	struct sockaddr_ll sll;
+	socklen_t sll_len;
+	struct timeval tv = {0, 100000};
+	uint32_t sent, seq, max_seq = 0;
+	uint8_t first = 1;
+	ssize_t bytes;
+	int fd;
+
+	(void)arg;
+	fd = raw_open(REPLAY_ETH_PEER);
+	if (fd < 0)
+		return NULL;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	while (!capture_stop)
+	{
+		sll_len = sizeof(sll);
+		bytes = recvfrom(fd, frm, sizeof(frm), 0, (struct sockaddr *)&sll, &sll_len);
+		if (bytes < 0 || sll.sll_pkttype == PACKET_OUTGOING)
+			continue;
+
+		uint64_t now = phy_sim_now_ns();
+		struct ethhdr *eth = (struct ethhdr *)frm;
+		struct iphdr *ip = (struct iphdr *)(frm + sizeof(struct ethhdr));
+		if (bytes < (ssize_t)(sizeof(struct ethhdr) + sizeof(struct iphdr)) ||
+				eth->h_proto != htons(ETH_P_IP) ||
+				memcmp(eth->h_dest, mac_laptop, ETH_ALEN) != 0)
+		{
+			num_foreign++;
+			continue;
+		}
+
+		// *** Sequence: the latest replayed packet with this 16-bit ID ***
+		sent = __atomic_load_n(&num_sent, __ATOMIC_ACQUIRE);
+		if (sent == 0)
+		{
+			num_foreign++;
+			continue;
+		}
+		seq = (sent - 1) - (uint16_t)((sent - 1) - ntohs(ip->id));
+		if (seq >= sent)
+		{
+			num_foreign++;
+			continue;
+		}
+
+		last_rx_ns = now;
+		if (pkt[seq].rx_ns)
+		{
+			num_dup++;
+			continue;
+		}
+		pkt[seq].rx_ns = now;
+		num_rx++;
+		rx_bytes += bytes;
+		if (!first && seq < max_seq)
+			num_reorder++;
+		else
+			max_seq = seq;
+		first = 0;
+	}
+	close(fd);
+
+	return NULL;
+}
+
+void replay_report(uint64_t t_start)
+{
+	uint64_t *lat, tx_bytes = 0, t_tx_end = 0, t_rx_end = 0;
+	uint32_t i, n = 0;
+	double tx_s, rx_s;
+
+	lat = (uint64_t *)malloc(num_pkt * sizeof(uint64_t));
+	if (lat == NULL)
+		return;
+	for (i = 0; i < num_pkt; i++)
+	{
+		tx_bytes += pkt[i].bytes;
+		if (pkt[i].tx_ns > t_tx_end)
+			t_tx_end = pkt[i].tx_ns;
+		if (pkt[i].rx_ns)
+		{
+			lat[n++] = pkt[i].rx_ns - pkt[i].tx_ns;
+			if (pkt[i].rx_ns > t_rx_end)
+				t_rx_end = pkt[i].rx_ns;
+		}
+	}
+	qsort(lat, n, sizeof(uint64_t), cmp_u64);
+
+	tx_s = (t_tx_end - t_start) / 1e9;
+	rx_s = (t_rx_end - t_start) / 1e9;
+	printf("=============================== Replay ================================\n");
+	printf("Sent      %8u packets %10llu bytes %10.3f Mbit/s offered\n", num_pkt,
+			(unsigned long long)tx_bytes, tx_s > 0 ? tx_bytes * 8 / tx_s / 1e6 : 0);
+	printf("Received  %8u packets %10llu bytes %10.3f Mbit/s goodput\n", num_rx,
+			(unsigned long long)rx_bytes, rx_s > 0 ? rx_bytes * 8 / rx_s / 1e6 : 0);
+	printf("Lost      %8u packets (%.2f%%)\n", num_pkt - num_rx,
+			100.0 * (num_pkt - num_rx) / num_pkt);
+	printf("Reordered %8u packets, %u duplicates, %u other frames\n", num_reorder,
+			num_dup, num_foreign);
+	if (n)
+	{
+		printf("One-way latency (us): min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+				lat[0] / 1e3, lat[n/2] / 1e3, lat[(uint64_t)n*90/100] / 1e3,
+				lat[(uint64_t)n*99/100] / 1e3, lat[(uint64_t)n*999/1000] / 1e3,
+				lat[n-1] / 1e3);
+	}
+	free(lat);
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+uint16_t ip_checksum(const uint8_t *data, uint16_t bytes)
+{
+	uint32_t sum = 0;
+	uint16_t i;
+
+	for (i = 0; i + 1 < bytes; i += 2)
+		sum += (data[i] << 8) | data[i+1];
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return htons(~sum & 0xFFFF);
+}
@@ -32,10 +32,25 @@
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <time.h>
+#ifndef PHY_SIM
+void send_ook_flush(void);
+#define IRC_TX_END()	send_ook_flush()
+#endif
+#include "lifi_mac.h"
+#include "link_cap.h"
+#ifdef PHY_SIM
+#include "phy_sim.h"
+#else
+#include "phy_poll.h"
+#endif
 
 // ### Configuration ###########################################################
 // This iface is connected to laptop
+#ifdef PHY_SIM
+#define ETH_IFACE			"lifi_eth0"		// veth made by lifi_replay
+#else
 #define ETH_IFACE			"eth0"
+#endif
 // ETH iface, eth0, 192.168.3.105
 #define MAC_ETHERNET_1		0x00
 #define MAC_ETHERNET_2		0x26 
@@ -51,73 +66,54 @@
 #define MAC_LAPTOP_5		0xE0
 #define MAC_LAPTOP_6		0xFD
 #define IP_LAPTOP 			"192.168.3.1"
+// Station ID on the VLC downlink, 0 ~ MAX_STA-1, can be overridden by argv[1]
+#define STA_ID				0
+// Link capture file, with -DLINK_CAP (link_cap.h)
+#define LINK_CAP_FILE		"lifi_sta.pcapng"
 
 // ### Defines #################################################################
 // *** PHY address ***
 #define AXI_VLC_RX		0x41210000
 #define AXI_IRC_TX 		0x41240000
-// *** Ethernet ***
-#define FRAM_SIZE		1518
+// *** Synchronizer thresholds, relative to the received signal ***
+#define VLC_DC_RATIO	128			// DC metric / energy in 1/256, 0: fixed
+#define VLC_NF_MARGIN	16			// Above noise floor in 1/4, 0: off
+#define VLC_FINE_RATIO	2540		// Fine correlation / sum of |x|, 0: fixed
 // *** Ring buffer ***
 #define BUFF_SIZE 		256
-// *** OFDM ***
-#define OFDM_WORD		4
-#define OFDM_BYTE		15
-#define OFDM_BIT		120
 // *** Shared memory ***
 #define SHM_SIZE 		9
 
 // *** Uplink ******************************************************************
-// Ring buffer size
-#define BUFF_UP_SIZE 	2048
+// Ring buffer size in bytes, power of 2
+#define BUFF_UP_SIZE 	(1 << 20)
 
 // *** Downlink ****************************************************************
-// Ring buffer size
-#define BUFF_DL_SIZE 	2048
-
-#define HEADER_MISSING	1
-#define ACK_FOUND		2
-
-// ### Struct definitions ######################################################
-typedef struct pseudotcp_t
-{
-	uint32_t saddr;
-	uint32_t daddr;
-	uint8_t zero;
-	uint8_t protocol;
-	uint16_t len;
-} pseudotcp_t;
-
-typedef struct ethfrm_t
-{
-	uint8_t data[FRAM_SIZE];	// Ethernet packet data
-	uint16_t bytes;				// Ethernet packet length
-} ethfrm_t;
-
-typedef struct ofdmsym_t
-{
-	uint32_t data[OFDM_WORD];	// OFDM symbol data
-	uint16_t bytes;				// Number of data bytes
-} ofdmsym_t;
+// Ring buffer size in bytes, power of 2
+#define BUFF_DL_SIZE 	(1 << 20)
 
 // ### Variables ###############################################################
 // *** PHY memory map ***
 int fd_mem;
+#ifdef PHY_SIM
+static phy_sim_port_t phy_port;
+#else
 static volatile uint32_t *vlc_rx_p;
 static volatile uint32_t *ook_tx_p;
+static phy_poll_t poll_vlc_rx, poll_irc_tx;
+static uint32_t vlc_rx_avail;			// Symbols known to be in the RX FIFO
+// IRC frame collected by send_ook_sym(), handed to the TX FIFO at its end
+static uint8_t irc_tx_buf[IRC_HDR_SIZE + FRAM_SIZE];
+static uint16_t irc_tx_len;
+#endif
 // *** Socket ***
 int fd_sock;
-struct sockaddr saddr;
-int saddr_len;
 
 // *** Uplink ******************************************************************
 // *** Thread ***
 pthread_t thread_recveth, thread_sendirc;
-pthread_mutex_t mutex_up = PTHREAD_MUTEX_INITIALIZER;
 // *** Ethernet frame fifo buffer ***
-struct ethfrm_t buff_up[BUFF_UP_SIZE];
-uint16_t head_up = 0, tail_up = 0;
-uint8_t empty_up = 1, full_up = 0;
+struct staq_t buff_up;
 // ETH's MAC
 uint8_t mac_ethernet[6] = 
 {
@@ -132,11 +128,10 @@ uint8_t mac_ethernet[6] =
 // *** Downlink ****************************************************************
 // *** Thread ***
 pthread_t thread_recvvlc, thread_sendeth;
-pthread_mutex_t mutex_dl = PTHREAD_MUTEX_INITIALIZER;
 // *** Ethernet frame fifo buffer ***
-struct ethfrm_t buff_dl[BUFF_DL_SIZE];
-uint16_t head_dl = 0, tail_dl = 0;
-uint8_t empty_dl = 1, full_dl = 0;
+struct staq_t buff_dl;
+// *** Fragment reassembly ***
+struct frag_rx_t frag_rx;
 // Laptop's MAC
 uint8_t mac_laptop[6] =
 {
@@ -149,32 +144,31 @@ uint8_t mac_laptop[6] =
 };
 // Laptop's IP
 char *ip_laptop = IP_LAPTOP;
+// Own station ID
+uint8_t sta_id = STA_ID;
+// *** Uplink grant from the last poll, and downlink frames to ACK ***
+// sendirc_handler is the only thread writing the IRC TX registers
+uint16_t ul_grant = 0;
+uint8_t ack_pending = 0;
+pthread_mutex_t mutex_ul = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_ul = PTHREAD_COND_INITIALIZER;
 
 // *** ACK *********************************************************************
+// Last uplink burst was acknowledged by the access point
 uint8_t ack = 0;
-uint8_t send_ack_flag = 0;
-pthread_t thread_sendack;
-pthread_mutex_t mutex_ack, mutex_ooktx, mutex_ackflag = 
-		PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t mutex_ack = PTHREAD_MUTEX_INITIALIZER;
 		
 // ### Function prototypes #####################################################
 // *** PHY layer initialization ***
 void phy_init(void);
+#if defined(PHY_POLL_STATS) && !defined(PHY_SIM)
+void *phy_poll_print_handler();
+#endif
 
 // *** Ethernet frame functions *** 
 void ethfrm_set(ethfrm_t *ethfrm, uint8_t *data, uint16_t bytes);
 void ethfrm_print(ethfrm_t ethfrm);
 // *** Data link layer functions ***
-uint8_t recv_vlc_frm(struct ethfrm_t *ethfrm);
-void send_irc_frm(ethfrm_t ethfrm);
-void send_ack(void);
-// *** PHY layer functions ***
-void recv_ofdm_sym(struct ofdmsym_t *ofdmsym);
-void send_ook_sym(uint8_t data);
-
-// *** Checksum ***
-unsigned short checksum(unsigned short *buff, int _16bitword);
-unsigned short checksumtcp(const char *buff, unsigned size);
 
 // *** Uplink ******************************************************************
 // *** Thread handler ***
@@ -194,12 +188,23 @@ uint8_t buff_dl_push(ethfrm_t ethfrm);
 uint8_t buff_dl_pop(ethfrm_t *ethfrm);
 void buff_dl_print(void);
 
-// *** ACK *********************************************************************
-void *sendack_handler();
-
 // ### Main ####################################################################
 int main(int argc, char *argv[])
 {
+	// ### Get station ID ######################################################
+	if (argc >= 2)
+	{
+		int id = atoi(argv[1]);
+		if (id < 0 || id >= MAX_STA)
+		{
+			printf("Error: Station ID must be 0 ~ %d.\n", MAX_STA-1);
+			return -1;
+		}
+		sta_id = (uint8_t)id;
+	}
+	printf("LiFi station ID: %d\n", sta_id);
+
+#ifndef PHY_SIM
 	// ### Set to highest priority #############################################
 	setpriority(PRIO_PROCESS, 0, -20);
 
@@ -210,10 +215,23 @@ int main(int argc, char *argv[])
 	system("iptables -A INPUT -p tcp -s 192.168.1.100 -d 192.168.1.105 --sport 513:65535 --dport 22 -m state --state NEW,ESTABLISHED -j ACCEPT");
 	system("iptables -A OUTPUT -p tcp -s 192.168.1.105 -d 192.168.1.100 --sport 22 --dport 513:65535 -m state --state ESTABLISHED -j ACCEPT");
 	system("ip addr del 169.254.109.254/16 dev wlan0");
+#endif
 	
 	// ### Initialize PHY ######################################################
 	phy_init();
 
+	// ### Initialize MAC ######################################################
+	if (staq_init(&buff_up, BUFF_UP_SIZE) < 0 || staq_init(&buff_dl, BUFF_DL_SIZE) < 0)
+	{
+		printf("Buffer allocation error\n");
+		return -1;
+	}
+	frag_rx_init(&frag_rx);
+#ifdef LAT_TRACE
+	lat_init();
+#endif
+	LINK_CAP_OPEN(LINK_CAP_FILE);
+
 	// ### Initialize socket ###################################################
 	fd_sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 	if (fd_sock < 0)
@@ -221,7 +239,6 @@ int main(int argc, char *argv[])
 		printf("Socket create error\n");
 		return -1;
 	}
-	saddr_len = sizeof(saddr);
 
 	// ### Initialize thread ###################################################
 	// *** Create ***
@@ -236,10 +253,18 @@ int main(int argc, char *argv[])
 		printf("Thread receive WLAN create error\n");
 	if (pthread_create(&thread_sendeth, NULL, sendeth_handler, NULL) != 0)
 		printf("Thread send ETH create error\n");
-	
-	// *** ACK *****************************************************************
-	if (pthread_create(&thread_sendack, NULL, sendack_handler, NULL) != 0)
-		printf("Thread send ACK create error\n");	
+#ifdef LAT_TRACE
+	// *** Latency histogram ***
+	pthread_t thread_lat;
+	if (pthread_create(&thread_lat, NULL, lat_print_handler, NULL) != 0)
+		printf("Thread latency print create error\n");
+#endif
+#if defined(PHY_POLL_STATS) && !defined(PHY_SIM)
+	// *** PHY polling statistics ***
+	pthread_t thread_poll;
+	if (pthread_create(&thread_poll, NULL, phy_poll_print_handler, NULL) != 0)
+		printf("Thread PHY poll print create error\n");
+#endif
 
 	// *** Join ***
 	// *** Uplink **************************************************************
@@ -249,16 +274,13 @@ int main(int argc, char *argv[])
 	// *** Downlink ************************************************************
 	pthread_join(thread_recvvlc, NULL);
 	pthread_join(thread_sendeth, NULL);
-
-	// *** ACK *****************************************************************
-	pthread_join(thread_sendack, NULL);
 	
 	// ### Test code ###########################################################
 	// *** Receive OFDM symbol test ***
 	// struct ofdmsym_t ofdmsym = {0};
 	// for (int i = 0; i <= 1000; i++)
 	// {
-		// recv_ofdm_sym(&ofdmsym);
+		// recv_ofdm_sym(&ofdmsym, 0);
 		// for (uint8_t i = 0; i < OFDM_WORD; i++)
 			// printf("0x%08X ", ofdmsym.data[i]);
 		// printf("\n");
@@ -269,10 +291,11 @@ int main(int argc, char *argv[])
 		// send_ook_sym(i);
 
 	// *** Receive OFDM frame test ***
+	// struct mac_hdr_t hdr;
 	// for (int k = 0; k <= 200; k++)
 	// {
 		// struct ethfrm_t ethfrm_d = {0};
-		// if (recv_vlc_frm(&ethfrm_d) == HEADER_MISSING)
+		// if (recv_vlc_frm(&ethfrm_d, sta_id, &hdr) == HEADER_MISSING)
 		// {		
 			// printf("VLC header missing\n");
 			// continue;
@@ -289,16 +312,17 @@ int main(int argc, char *argv[])
 			// ethfrm_u.data[i] = k;
 		
 		
-		// send_irc_frm(ethfrm_u);
+		// send_irc_frm(ethfrm_u, sta_id, IRC_TYPE_DATA, 0);
 		
 		// ethfrm_print(ethfrm_u);
 	// }
 	
 	// *** Receive OFDM ACK test ***
+	// struct mac_hdr_t hdr;
 	// for (int k = 0; k <= 10; k++)
 	// {
 		// struct ethfrm_t ethfrm_d = {0};
-		// if (recv_vlc_frm(&ethfrm_d) == ACK_FOUND)
+		// if (recv_vlc_frm(&ethfrm_d, sta_id, &hdr) == ACK_FOUND || hdr.ack)
 		// {		
 			// printf("ACK found\n");
 			// continue;
@@ -307,13 +331,38 @@ int main(int argc, char *argv[])
 	// }
 
 	// *** Send OOK ACK test ***
+	// struct ethfrm_t ethfrm_u = {0};
 	// for (int k = 0; k <= 10; k++)
-		// send_ack();
+		// send_irc_frm(ethfrm_u, sta_id, IRC_TYPE_NULL, 1);
 	
 	return 0;
 }
 
 // ### Functions ###############################################################
+#ifdef PHY_SIM
+// *** PHY registers replaced by the shared-memory medium (phy_sim.h) ***
+void phy_init()
+{
+	phy_sim_t *sim = phy_sim_open(PHY_SIM_NAME, 0);
+
+	if (sim == NULL)
+	{
+		perror("Couldn't open the PHY simulator");
+		exit(-1);
+	}
+	phy_sim_attach(&phy_port, sim);
+}
+
+uint8_t recv_ofdm_sym(ofdmsym_t *ofdmsym, uint32_t timeout_us)
+{
+	return (phy_sim_vlc_recv(&phy_port, ofdmsym->data, (uint64_t)timeout_us * 1000) == 0) ? 0 : 1;
+}
+
+void send_ook_sym(uint8_t data)
+{
+	phy_sim_irc_send(&phy_port, data);
+}
+#else
 void phy_init()
 {
 	// *** Handle to physical memory ***
@@ -327,9 +376,39 @@ void phy_init()
 			MAP_SHARED, fd_mem, AXI_IRC_TX);
 			
 	// PHY initialization
-	*(vlc_rx_p+0) = 0x2;
+	*(vlc_rx_p+0) = VLC_MOD;
+	*(vlc_rx_p+8) = VLC_BURST;
+	*(vlc_rx_p+9) = VLC_UP_FACTOR;
+	*(vlc_rx_p+10) = (VLC_NF_MARGIN << 16) | VLC_DC_RATIO;
+	*(vlc_rx_p+11) = VLC_FINE_RATIO;
+	*(ook_tx_p+0) = IRC_CTRL;
+	phy_poll_init(&poll_vlc_rx, "VLC RX", VLC_SYM_NS);
+	phy_poll_init(&poll_irc_tx, "IRC TX", IRC_BYTE_NS);
+#ifdef PHY_IRQ
+	// *** Interrupt: VLC RX symbol ready ***
+	*(vlc_rx_p+1) = 1;
+	phy_poll_uio(&poll_vlc_rx, "vlcrx");
+#endif
 }
 
+#ifdef PHY_POLL_STATS
+void *phy_poll_print_handler()
+{
+	while (1)
+	{
+		sleep(PHY_POLL_PRINT_S);
+		phy_poll_print(&poll_vlc_rx);
+		phy_poll_print(&poll_irc_tx);
+		printf("VLC RX FIFO: %u of %u symbols, %u dropped\n", *(vlc_rx_p+2) & 0xFFFF,
+				*(vlc_rx_p+2) >> 16, *(vlc_rx_p+3));
+		printf("VLC RX sync: noise floor %u, %u search timeouts, %u peak aborts\n",
+				*(vlc_rx_p+12), *(vlc_rx_p+13) & 0xFFFF, *(vlc_rx_p+13) >> 16);
+	}
+	return NULL;
+}
+#endif
+#endif
+
 void ethfrm_set(ethfrm_t *ethfrm, uint8_t *data, uint16_t bytes)
 {
 	uint16_t i;
@@ -351,206 +430,100 @@ void ethfrm_print(struct ethfrm_t ethfrm)
 	printf("\n");
 }
 
-uint8_t recv_vlc_frm(struct ethfrm_t *ethfrm)
+#ifndef PHY_SIM
+uint8_t recv_ofdm_sym(ofdmsym_t *ofdmsym, uint32_t timeout_us)
 {
-	struct ofdmsym_t ofdmsym = {0};
-	uint16_t num_ofdm, num_rem_bit, num_rem_byte;
-	uint8_t data[FRAM_SIZE] = {0};
-	uint16_t data_idx = 0;
-	uint16_t i, j;
-
-	// *** Receive OFDM header symbol ***
-	recv_ofdm_sym(&ofdmsym);
-	// *** Check ID ***
-	if (!((ofdmsym.data[0] == 0x16808880) && ((ofdmsym.data[1] & 0xFFFF0000) == 0x16800000)))
-		return HEADER_MISSING;
-	// *** Check ACK ***
-	if ((ofdmsym.data[1] & 0x0000FFFF) == 0x0000FFFF)
-		return ACK_FOUND;
-	
-	num_ofdm = (uint16_t)((ofdmsym.data[2] & 0xFFFF0000) >> 16);
-	num_rem_bit = (uint16_t)(ofdmsym.data[2] & 0x0000FFFF);
-	// printf("Number of OFDM symbol: %d\n", num_ofdm);
-	// printf("Remaining bit: %d\n", num_rem_bit);
-
-	// *** Split all the OFDM symbol into bytes, except the last OFDM symbol ***
-	for (i = 0; i < num_ofdm; i++)
+	// *** Drain the FIFO in bursts, only wait when it is empty ***
+	if (vlc_rx_avail == 0)
+		vlc_rx_avail = *(vlc_rx_p+2) & 0xFFFF;
+	if (vlc_rx_avail == 0)
 	{
-		// Receive one OFDM symbol (blocking)
-		recv_ofdm_sym(&ofdmsym);
-		// *** Split one OFDM symbol to bytes ***
-		for (j = 0; j < OFDM_BYTE; j++)
-		{
-			if (j < 4)
-				data[data_idx++] |= (ofdmsym.data[0] >> (24-(j%4)*8));
-			else if (j < 8)
-				data[data_idx++] |= (ofdmsym.data[1] >> (24-(j%4)*8));
-			else if (j < 12)
-				data[data_idx++] |= (ofdmsym.data[2] >> (24-(j%4)*8));
-			else
-				data[data_idx++] |= (ofdmsym.data[3] >> (24-(j%4)*8));
-		}
+		// Wait until ready flag is set, one symbol after the previous one
+		if (phy_poll_wait(&poll_vlc_rx, vlc_rx_p+0, 1 << 2, 1 << 2,
+				(uint64_t)timeout_us * 1000))
+			return 1;
+		vlc_rx_avail = *(vlc_rx_p+2) & 0xFFFF;
 	}
 
-	// *** Split the last OFDM symbol into bytes ***
-	if (num_rem_bit)
-	{
-		// Calculate number of remaining bytes in the last OFDM symbol
-		num_rem_byte = num_rem_bit / 8;
-		// Receive the last OFDM symbol (blocking)
-		recv_ofdm_sym(&ofdmsym);
-		// *** Split the last OFDM symbol to bytes ***
-		for (i = 0; i < num_rem_byte; i++)
-		{
-			if (i < 4)
-				data[data_idx++] |= (ofdmsym.data[0] >> (24-(i%4)*8));
-			else if (i < 8)
-				data[data_idx++] |= (ofdmsym.data[1] >> (24-(i%4)*8));
-			else if (i < 12)
-				data[data_idx++] |= (ofdmsym.data[2] >> (24-(i%4)*8));
-			else
-				data[data_idx++] |= (ofdmsym.data[3] >> (24-(i%4)*8));
-		}
-	}
-
-	// *** Construct ethrenet frame ***
-	for (i = 0; i < data_idx; i++)
-	{
-		ethfrm->data[i] = data[i];
-	}
-	ethfrm->bytes = data_idx;
-	// printf("OFDM frame size: %d byte = (%d symbol * %d bit) + %d bit\n", ethfrm->bytes,
-			// num_ofdm, OFDM_BIT, num_rem_bit);
-
-	return 0;	// Success receive
-}
-
-void send_irc_frm(ethfrm_t ethfrm)
-{
-	uint16_t i;
-
-	// printf("OOK frame size: %d byte\n", ethfrm.bytes);
-	
-	// *** Send OOK header ***
-	// *** Send ID ***
-	send_ook_sym(0x16);
-	send_ook_sym(0x80);
-	send_ook_sym(0x88);
-	send_ook_sym(0x80);
-	// *** This is data frame ***
-	send_ook_sym(0x00);
-	// *** Send number of bytes ***
-	send_ook_sym((uint8_t)(ethfrm.bytes >> 8));
-	send_ook_sym((uint8_t)(ethfrm.bytes & 0xFF));
-
-	// *** Send OOK data ***
-	for (i = 0; i < ethfrm.bytes; i++)
-	{
-		send_ook_sym(ethfrm.data[i]);
-	}
-}
-
-void send_ack()
-{
-	struct ethfrm_t ack = {0};
-	uint8_t i;
-	
-	// *** Construct ACK pattern ***
-	ack.data[0] = 0x16;
-	ack.data[1] = 0x80;
-	ack.data[2] = 0x88;
-	ack.data[3] = 0x80;
-	ack.data[4] = 0xFF;
-	ack.data[5] = 0x00;
-	ack.data[6] = 0x00;
-	ack.bytes = 7;
-
-	// *** Send IRC ACK ***	
-	for (i = 0; i < ack.bytes; i++)
-	{
-		pthread_mutex_lock(&mutex_ooktx);
-		send_ook_sym(ack.data[i]);
-		pthread_mutex_unlock(&mutex_ooktx);
-	}
-	
-}
-
-void recv_ofdm_sym(ofdmsym_t *ofdmsym)
-{
-	// Wait until ready flag is set
-	while (!(*(vlc_rx_p+0) & (1 << 2)));
-
-	// *** Read data from data register ***
+	// *** Read data from data register, the last one frees the symbol ***
 	ofdmsym->data[0] = *(vlc_rx_p+4);
 	ofdmsym->data[1] = *(vlc_rx_p+5);
 	ofdmsym->data[2] = *(vlc_rx_p+6);
 	ofdmsym->data[3] = *(vlc_rx_p+7);
+	vlc_rx_avail--;
 	// for (uint8_t i = 0; i < OFDM_WORD; i++)
 		// printf("0x%08X ", ofdmsym->data[i]);
 	// printf("\n");
-}
 
-void send_ook_sym(uint8_t data)
-{
-	// Write data to data register
-	*(ook_tx_p+1) = data;
-	
-	// Wait until busy flag is cleared
-	while ((*(ook_tx_p+0) & (1 << 17)));
+	return 0;
 }
 
-unsigned short checksum(unsigned short* buff, int _16bitword)
+void send_ook_sym(uint8_t data)
 {
-	unsigned long sum;
-	unsigned short ans;
-
-	for(sum = 0; _16bitword > 0; _16bitword--)
-		sum += htons(*(buff)++);
-	
-	sum = ((sum >> 16) + (sum & 0xFFFF));
-	sum += (sum >> 16);
-	ans = (unsigned short)(~sum);
-	ans = ((ans & 0x00FF) << 8) + ((ans & 0xFF00) >> 8);
+	irc_tx_buf[irc_tx_len++] = data;
+	if (irc_tx_len == sizeof(irc_tx_buf))
+		send_ook_flush();
 }
 
-unsigned short checksumtcp(const char *buff, unsigned size)
+// *** Queue the collected bytes in the TX FIFO, 4 per write ***
+void send_ook_flush(void)
 {
-	unsigned sum = 0;
-	int i;
+	uint16_t i = 0;
+	uint32_t lvl, room;
 
-	for (i = 0; i < size-1; i += 2)
+	while (i < irc_tx_len)
 	{
-		unsigned short word16 = *(unsigned short *)&buff[i];
-		sum += word16;
-	}
+		// *** Room in the FIFO, a byte leaves it every byte time ***
+		lvl = *(ook_tx_p+3);
+		room = (lvl >> 16) - (lvl & 0xFFFF);
+		if (room == 0)
+		{
+			phy_poll_start(&poll_irc_tx);
+			phy_poll_wait(&poll_irc_tx, ook_tx_p+0, 1 << 18, 0, 0);
+			continue;
+		}
 
-	if (size & 1)
-	{
-		unsigned short word16 = (unsigned char)buff[i];
-		sum += word16;
+		// *** Packed data register, then the last bytes one by one ***
+		for (; room >= 4 && irc_tx_len - i >= 4; room -= 4, i += 4)
+		{
+			*(ook_tx_p+2) = irc_tx_buf[i] | (irc_tx_buf[i+1] << 8) |
+					(irc_tx_buf[i+2] << 16) | ((uint32_t)irc_tx_buf[i+3] << 24);
+		}
+		for (; room > 0 && i < irc_tx_len; room--, i++)
+			*(ook_tx_p+1) = irc_tx_buf[i];
 	}
-
-	while (sum >> 16)
-		sum = (sum & 0xFFFF) + (sum >> 16);
-
-	return ~sum;
+	irc_tx_len = 0;
 }
+#endif
 
 void *recveth_handler()
 {
+	struct sockaddr_ll saddr;
+	socklen_t saddr_len;
+
 	while (1)
 	{
-		// *** Receive Ethernet frame ***
-		ethfrm_t ethfrm_rd = {0};
-		ethfrm_rd.bytes = recvfrom(fd_sock, ethfrm_rd.data, FRAM_SIZE, 0,
-				&saddr, (socklen_t *)&saddr_len);
+		// *** Receive Ethernet frame straight into the uplink buffer (this
+		// thread is its only producer), into a scratch frame if it is full ***
+		ethfrm_t ethfrm_drop;
+		uint8_t *data = staq_reserve(&buff_up, FRAM_SIZE);
+		if (data == NULL)
+			data = ethfrm_drop.data;
+		saddr_len = sizeof(saddr);
+		ssize_t bytes = recvfrom(fd_sock, data, FRAM_SIZE, 0,
+				(struct sockaddr *)&saddr, &saddr_len);
+		// Interrupted or failed, saddr and the data are not valid
+		if (bytes < (ssize_t)(sizeof(struct ethhdr) + sizeof(struct iphdr)))
+			continue;
 		
 		// *** Get Ethernet frame information ***
-		struct ethhdr *eth = (struct ethhdr *)(ethfrm_rd.data);
-		struct iphdr *ip = (struct iphdr *)(ethfrm_rd.data + sizeof(struct ethhdr));
+		struct ethhdr *eth = (struct ethhdr *)(data);
+		struct iphdr *ip = (struct iphdr *)(data + sizeof(struct ethhdr));
 
-		// *** Check Ethernet frame ***
-		if ((ntohs(ip->tot_len)+14) > 1600 || ethfrm_rd.bytes > 1600)
+		// *** Check Ethernet frame, not our own downlink frames going out ***
+		if (saddr.sll_pkttype == PACKET_OUTGOING)
+			continue;
+		if ((ntohs(ip->tot_len)+14) > 1600 || bytes > 1600)
 			continue;
 		if (!(eth->h_proto == 8 &&
 				((unsigned char)eth->h_dest[0] == mac_ethernet[0] && 
@@ -562,173 +535,143 @@ void *recveth_handler()
 			continue;
 
 		// *** Push Ethernet frame to uplink buffer ***
-		buff_up_push(ethfrm_rd);
+		if (data != ethfrm_drop.data)
+			staq_commit(&buff_up, data, bytes);
 	}
 }
 
 void *sendirc_handler()
 {
-	uint8_t resend_val = 0;
-	uint32_t wait = 0;
+	uint16_t grant, n;
+	uint8_t more, ack_ap;
 	
 	while (1)
 	{
+		// *** Wait until the access point polls us ***
+		pthread_mutex_lock(&mutex_ul);
+		while (ul_grant == 0)
+			pthread_cond_wait(&cond_ul, &mutex_ul);
+		grant = ul_grant;
+		ul_grant = 0;
+		ack_ap = ack_pending;
+		ack_pending = 0;
+		pthread_mutex_unlock(&mutex_ul);
+
 		// *** Read Ethernet frame from uplink buffer ***
 		ethfrm_t ethfrm_rd = {0};
 		if (buff_up_pop(&ethfrm_rd) == 1)
+		{
+			// Nothing to send, the access point can poll the next station
+			send_irc_frm(ethfrm_rd, sta_id, IRC_TYPE_NULL, ack_ap);
 			continue;
+		}
 		// ethfrm_print(ethfrm_rd);
 
-		// *** Clear ACK ***
-		// pthread_mutex_lock(&mutex_ack);
-		// ack = 0;
-		// pthread_mutex_unlock(&mutex_ack);
-
-		// *** Send with stop-and-wait ARQ ***
-		// resend:
-		// Send IRC frame
-		send_irc_frm(ethfrm_rd);
-
-		// *** Wait until get ACK ***
-		// while (ack == 0)
-		// {
-			// if (resend_val >= 1)
-			// {
-				// printf("Resend\n");
-				// resend_val = 0;
-				// break;
-			// }
-			// if (wait >= 20000000)
-			// {
-				// wait = 0;
-				// resend_val++;
-				// goto resend;
-			// }
-			// wait++;
-		// }
-		
-		// *** Wait ***
-		// struct timespec tim;
-		// tim.tv_sec = 0;
-		// tim.tv_nsec = 50000UL;
-		// nanosleep(&tim,NULL);
-	}
-}
-
-void *sendack_handler()
-{	
-	while(1)
-	{
-		// *** Wait until there is send ACK request ***
-		while (send_ack_flag == 0);
-		pthread_mutex_lock(&mutex_ackflag);
-		send_ack_flag = 0;
-		pthread_mutex_unlock(&mutex_ackflag);
-		
-		// *** Send ACK ***
-		send_ack();
+		// *** Send up to grant frames, each telling if another follows ***
+		for (n = 1; ; n++)
+		{
+			ethfrm_t ethfrm_next = {0};
+			more = (n < grant) && (buff_up_pop(&ethfrm_next) == 0);
+			// Send IRC frame, the first one carries the ACK
+			send_irc_frm(ethfrm_rd, sta_id, more ? IRC_TYPE_MORE : IRC_TYPE_DATA, ack_ap);
+			ack_ap = 0;
+			if (!more)
+				break;
+			ethfrm_rd = ethfrm_next;
+		}
 	}
 }
 
 uint8_t buff_up_push(ethfrm_t ethfrm)
 {
-	uint8_t stat = 1;	// Push fail (buffer full)
-
-	if (!full_up)
-	{
-		pthread_mutex_lock(&mutex_up);
-
-		// *** Write eth frame to buffer and update head ***
-		buff_up[head_up++] = ethfrm;
-		if (head_up == BUFF_UP_SIZE)
-			head_up = 0;
-
-		// *** Update empty and full status ***
-		empty_up = 0;
-		if (head_up == tail_up)
-			full_up = 1;
-
-		pthread_mutex_unlock(&mutex_up);
-
-		stat = 0;	// Push success
-	}
-
-	return stat;
+	return staq_push(&buff_up, &ethfrm);
 }
 
 uint8_t buff_up_pop(ethfrm_t *ethfrm)
 {
-	uint8_t stat = 1;	// Pop fail (buffer empty)
-
-	if (!empty_up)
-	{
-		pthread_mutex_lock(&mutex_up);
-
-		// *** Read eth frame from buffer and update tail ***
-		*ethfrm = buff_up[tail_up++];
-		if (tail_up == BUFF_UP_SIZE)
-			tail_up = 0;
-
-		// *** Update empty and full status ***
-		full_up = 0;
-		if (tail_up == head_up)
-			empty_up = 1;
-
-		pthread_mutex_unlock(&mutex_up);
-
-		stat = 0;	// Pop success
-	}
-
-	return stat;
+	return staq_pop(&buff_up, ethfrm);
 }
 
 void buff_up_print(void)
 {
-	uint16_t i, j;
-
-	printf("Buffer Uplink: Head=%d, Tail=%d, Empty=%d, Full=%d\n", head_up,
-			tail_up, empty_up, full_up);
-	for (i = 0; i < BUFF_UP_SIZE; i++)
-	{
-		for (j = 0; j < buff_up[i].bytes; j++)
-			printf("%02X ", buff_up[i].data[j]);
-		printf("\n");
-	}
+	printf("Buffer Uplink: Used=%llu/%llu bytes\n",
+			(unsigned long long)pktring_used(&buff_up.ring),
+			(unsigned long long)buff_up.ring.size);
 }
 
 void *recvvlc_handler()
 {
+	struct mac_hdr_t hdr = {0};
 	uint8_t ret_val;
 	
 	while (1)
 	{
 		// *** Reveive data from VLC ***
 		ethfrm_t ethfrm_rd = {0};	
-		ret_val = recv_vlc_frm(&ethfrm_rd);
+		ret_val = recv_vlc_frm(&ethfrm_rd, sta_id, &hdr);
+		LINK_CAP_RX(LINK_CAP_VLC, ret_val, &hdr, &ethfrm_rd);
+		LAT_STAMP(&ethfrm_rd.ts, LAT_RX, ethfrm_rd.bytes);
 		
 		// *** If header missing ***
-		// while (recv_vlc_frm(&ethfrm_rd) == HEADER_MISSING);
+		// while (recv_vlc_frm(&ethfrm_rd, sta_id, &hdr) == HEADER_MISSING);
 		if (ret_val == HEADER_MISSING)
 		{
-			printf("VLC header missing\n");
+			printf("VLC header missing, %u symbols discarded\n", rx_hunt.vlc_last);
 			continue;
 		}
-		
-		// *** If it is ACK ***
-		if (ret_val == ACK_FOUND)
+		if (rx_hunt.vlc_last)
+			printf("VLC resync, %u symbols discarded (%llu in total)\n",
+					rx_hunt.vlc_last, (unsigned long long)rx_hunt.vlc_sym);
+
+		// *** If it is for another station ***
+		if (ret_val == STA_MISMATCH)
+			continue;
+
+		// *** If it is ACK, alone or piggybacked ***
+		if (hdr.ack)
 		{
-			printf("ACK found\n");
 			pthread_mutex_lock(&mutex_ack);
 			ack = 1;
 			pthread_mutex_unlock(&mutex_ack);
+		}
+		if (ret_val == ACK_FOUND)
+			continue;
+
+		// *** If symbols were lost, the next header cut the frame ***
+		if (ret_val == RX_TIMEOUT)
+			continue;
+
+		// *** If we are polled, let sendirc_handler use the uplink ***
+		if (ret_val == POLL_FOUND)
+		{
+			pthread_mutex_lock(&mutex_ul);
+			ul_grant = hdr.grant;
+			pthread_cond_signal(&cond_ul);
+			pthread_mutex_unlock(&mutex_ul);
 			continue;
 		}
 		
-		// *** If it is data, we must send ACK ***
-		// pthread_mutex_lock(&mutex_ackflag);
-		// send_ack_flag = 1;
-		// pthread_mutex_unlock(&mutex_ackflag);
+		// *** If it is unicast data, we must send ACK, it rides the next
+		// uplink frame ***
+		if (hdr.sta == sta_id)
+		{
+			pthread_mutex_lock(&mutex_ul);
+			ack_pending = 1;
+			pthread_mutex_unlock(&mutex_ul);
+		}
 		
+		// *** Put fragments together, push the frame once complete ***
+		if (hdr.type == (uint8_t)VLC_TYPE_FRAG)
+		{
+			ethfrm_t *frm = frag_rx_push(&frag_rx, &ethfrm_rd, hdr.sta);
+			if (frm != NULL)
+			{
+				LAT_STAMP(&frm->ts, LAT_RX, frm->bytes);
+				staq_push(&buff_dl, frm);
+			}
+			continue;
+		}
+
 		// *** Push Ethernet frame to downlink buffer ***
 		buff_dl_push(ethfrm_rd);
 		// ethfrm_print(ethfrm_rd);
@@ -737,7 +680,7 @@ void *recvvlc_handler()
 
 void *sendeth_handler()
 {
-	uint16_t i;
+	uint16_t bytes;
 
 	// *** Getting index of own interface ***
 	struct ifreq ifreq_iface;
@@ -752,13 +695,14 @@ void *sendeth_handler()
 	strncpy(ifreq_mac.ifr_name, ETH_IFACE, IFNAMSIZ-1);
 	if ((ioctl(fd_sock, SIOCGIFHWADDR, &ifreq_mac)) < 0)
 		printf("Error in SIOCGIFHWADDR ioctl reading %s\n", ETH_IFACE);
+	uint32_t ip_dst = inet_addr(ip_laptop);
 
-	// *** Getting own IP address ***
-	struct ifreq ifreq_ip;
-	memset(&ifreq_ip, 0, sizeof(ifreq_ip));
-	strncpy(ifreq_ip.ifr_name, ETH_IFACE, IFNAMSIZ-1);
-	if (ioctl(fd_sock, SIOCGIFADDR, &ifreq_ip) < 0)
-		printf("Error in SIOCGIFADDR %s\n", ETH_IFACE);
+	// *** Everything goes to the laptop ***
+	struct sockaddr_ll sadr_ll;
+	memset(&sadr_ll, 0, sizeof(sadr_ll));
+	sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
+	sadr_ll.sll_halen = ETH_ALEN;
+	memcpy(sadr_ll.sll_addr, mac_laptop, ETH_ALEN);
 
 	while (1)
 	{
@@ -768,286 +712,36 @@ void *sendeth_handler()
 			continue;
 		//ethfrm_print(ethfrm_rd);
 
-		// *** Get Ethernet frame information ***
-		struct ethhdr *eth = (struct ethhdr*)(ethfrm_rd.data);
-		struct iphdr *ip = (struct iphdr*)(ethfrm_rd.data + sizeof(struct ethhdr));
-		unsigned short iphdrlen = ip->ihl * 4;
-
-		// *** Check Ethernet frame ***
-		if (eth->h_proto != 8)
+		// *** ICMP and TCP packets, to the laptop's address ***
+		ethfrm_t ethfrm_wr;
+		bytes = ip_frm_rebuild(&ethfrm_rd, &ethfrm_wr,
+				(uint8_t *)ifreq_mac.ifr_hwaddr.sa_data, mac_laptop, 0, ip_dst);
+		if (bytes == 0)
 			continue;
 
-		// *** Send Ethernet frame ***
-		if(ip->protocol == 1)	// ICMP packet
-		{
-			// printf("ICMP downlink packet found\n");
-
-			// Extract ICMP header
-			struct icmphdr *icmp = (struct icmphdr*)(ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr));
-
-			// *** Extract Data ***
-			ethfrm_rd.bytes = ntohs(ip->tot_len) + 14;
-			unsigned char *data = (ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr) + sizeof(struct icmphdr));
-			int remaining_data = ethfrm_rd.bytes - (iphdrlen + sizeof(struct ethhdr) + sizeof(struct icmphdr));
-
-			// *** Constructing Ethernet header ***
-			ethfrm_t ethfrm_wr = {0};
-			struct ethhdr *eth = (struct ethhdr*)(ethfrm_wr.data);
-			eth->h_source[0] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[0]);
-			eth->h_source[1] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[1]);
-			eth->h_source[2] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[2]);
-			eth->h_source[3] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[3]);
-			eth->h_source[4] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[4]);
-			eth->h_source[5] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[5]);
-			eth->h_dest[0] = mac_laptop[0];
-			eth->h_dest[1] = mac_laptop[1];
-			eth->h_dest[2] = mac_laptop[2];
-			eth->h_dest[3] = mac_laptop[3];
-			eth->h_dest[4] = mac_laptop[4];
-			eth->h_dest[5] = mac_laptop[5];
-			eth->h_proto = htons(ETH_P_IP);
-			ethfrm_wr.bytes += sizeof(struct ethhdr);
-
-			// *** Constructing IP header ***
-			struct iphdr *iph = (struct iphdr*)(ethfrm_wr.data + sizeof(struct ethhdr));
-			iph->ihl = ip->ihl;
-			iph->version = ip->version;
-			iph->tos = ip->tos;
-			iph->id = ip->id;
-			iph->frag_off = ip->frag_off;
-			iph->ttl = ip->ttl;
-			iph->protocol = ip->protocol;
-			iph->saddr = ip->saddr;
-			iph->daddr = inet_addr(ip_laptop);
-			iph->tot_len = ip->tot_len;
-			ethfrm_wr.bytes += sizeof(struct iphdr);
-			for(i = 0; i < (iphdrlen-sizeof(struct iphdr)); i++)
-			{
-				iph[ethfrm_wr.bytes] = ip[ethfrm_wr.bytes];
-				ethfrm_wr.bytes++;
-			}
-
-			// *** Constructing ICMP header ***
-			struct icmphdr *ih = (struct icmphdr*)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr));
-			ih->type = icmp->type;
-			ih->code = icmp->code;
-			ih->un.echo.sequence = icmp->un.echo.sequence;
-			ih->un.echo.id = icmp->un.echo.id;
-			ih->un.frag.mtu = icmp->un.frag.mtu;
-			ethfrm_wr.bytes += sizeof(struct icmphdr);
-
-			// *** Constructing payload ***
-			for (i = 0; i < remaining_data; i++)
-			{
-				ethfrm_wr.data[ethfrm_wr.bytes++] = data[i];
-			}
-
-			// *** Completing ICMP and IP header ***
-			ih->checksum = checksum((unsigned short *)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr)),
-					(sizeof(struct icmphdr)/2+remaining_data/2));
-			iph->tot_len = htons(ethfrm_wr.bytes - sizeof(struct ethhdr));
-			iph->check = checksum((unsigned short *)(ethfrm_wr.data + sizeof(struct ethhdr)), iphdrlen/2);
-
-			// *** Actual sending ***
-			struct sockaddr_ll sadr_ll;
-			sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
-			sadr_ll.sll_halen = ETH_ALEN;
-			sadr_ll.sll_addr[0] = mac_laptop[0];
-			sadr_ll.sll_addr[1] = mac_laptop[1];
-			sadr_ll.sll_addr[2] = mac_laptop[2];
-			sadr_ll.sll_addr[3] = mac_laptop[3];
-			sadr_ll.sll_addr[4] = mac_laptop[4];
-			sadr_ll.sll_addr[5] = mac_laptop[5];
-			unsigned int res = sendto(fd_sock, ethfrm_wr.data, ntohs(ip->tot_len) + 14,
-					0, (const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll));
-			// if (res < 0)
-				// printf("ICMP downlink packet send error\n");
-			// else
-				// printf("ICMP downlink packet send success\n");
-		}
-		else if (ip->protocol == 6)		// TCP packet
-		{
-			// printf("TCP downlink packet found\n");
-			
-			// *** Extract TCP header ***
-			struct tcphdr *tcp = (struct tcphdr*)(ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr));
-		
-			// *** Extract Data ***
-			ethfrm_rd.bytes = ntohs(ip->tot_len) + 14;
-			unsigned char *data = (ethfrm_rd.data + iphdrlen + sizeof(struct ethhdr) + sizeof(struct tcphdr));
-			int remaining_data = ethfrm_rd.bytes - (iphdrlen + sizeof(struct ethhdr) + sizeof(struct tcphdr));
-
-			// *** Constructing Ethernet header ***
-			ethfrm_t ethfrm_wr = {0};
-			struct ethhdr *eth = (struct ethhdr*)(ethfrm_wr.data);
-			eth->h_source[0] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[0]);
-			eth->h_source[1] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[1]);
-			eth->h_source[2] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[2]);
-			eth->h_source[3] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[3]);
-			eth->h_source[4] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[4]);
-			eth->h_source[5] = (unsigned char)(ifreq_mac.ifr_hwaddr.sa_data[5]);
-			eth->h_dest[0] = mac_laptop[0];
-			eth->h_dest[1] = mac_laptop[1];
-			eth->h_dest[2] = mac_laptop[2];
-			eth->h_dest[3] = mac_laptop[3];
-			eth->h_dest[4] = mac_laptop[4];
-			eth->h_dest[5] = mac_laptop[5];
-			eth->h_proto = htons(ETH_P_IP);
-			ethfrm_wr.bytes += sizeof(struct ethhdr);
-
-			// *** Constructing IP header ***
-			struct iphdr *iph = (struct iphdr*)(ethfrm_wr.data + sizeof(struct ethhdr));
-			iph->ihl = ip->ihl;
-			iph->version = ip->version;
-			iph->tos = ip->tos;
-			iph->id = ip->id;
-			iph->frag_off = ip->frag_off;
-			iph->ttl = ip->ttl;
-			iph->protocol = ip->protocol;
-			iph->saddr = ip->saddr;
-			iph->daddr = inet_addr(ip_laptop);
-			iph->tot_len = ip->tot_len;
-			ethfrm_wr.bytes += sizeof(struct iphdr);
-			for(i = 0; i < (iphdrlen-sizeof(struct iphdr)); i++)
-			{
-				iph[ethfrm_wr.bytes] = ip[ethfrm_wr.bytes];
-				ethfrm_wr.bytes++;
-			}
-
-			// *** Constructing TCP header
-			struct tcphdr *th = (struct tcphdr*)(ethfrm_wr.data + iphdrlen + sizeof(struct ethhdr));
-			th->th_sport = tcp->th_sport;
-			th->th_dport = tcp->th_dport;
-			th->th_seq = tcp->th_seq;
-			th->th_ack = tcp->th_ack;
-			th->th_x2 = tcp->th_x2;
-			th->th_off = tcp->th_off;
-			th->th_flags = tcp->th_flags;
-			th->th_win = tcp->th_win;
-			th->th_urp = tcp->th_urp;
-			ethfrm_wr.bytes += sizeof(struct tcphdr);
-				
-			// *** Constructing payload ***
-			for(i = 0; i < remaining_data; i++)
-			{
-				ethfrm_wr.data[ethfrm_wr.bytes++] = data[i];
-			}
-
-			// *** Pseudo TCP header ***
-			uint8_t *tcpsumbuff = (uint8_t *)malloc(2000);
-			int total_len_sum = 0;
-			memset(tcpsumbuff,0,2000);
-			struct pseudotcp_t *pseudotcp = (struct pseudotcp_t*)(tcpsumbuff);			
-			pseudotcp->saddr = iph->saddr;
-			pseudotcp->daddr = iph->daddr;
-			pseudotcp->zero = 0;
-			pseudotcp->protocol = IPPROTO_TCP;
-			pseudotcp->len = htons(ntohs(ip->tot_len) - iphdrlen);
-			total_len_sum += sizeof(struct pseudotcp_t);
-			struct tcphdr *thsum = (struct tcphdr *)(tcpsumbuff + sizeof(struct pseudotcp_t));
-			thsum->th_sport = tcp->th_sport;
-			thsum->th_dport = tcp->th_dport;
-			thsum->th_seq = tcp->th_seq;
-			thsum->th_ack = tcp->th_ack;
-			thsum->th_x2 = tcp->th_x2;
-			thsum->th_off = tcp->th_off;
-			thsum->th_flags = tcp->th_flags;
-			thsum->th_win = tcp->th_win;
-			thsum->th_urp = tcp->th_urp;
-			thsum->th_sum = 0;
-			total_len_sum += sizeof(struct tcphdr);
-			for(i = 0; i < remaining_data; i++)
-			{
-				tcpsumbuff[total_len_sum++] = data[i];
-			}
-				
-			// *** Completing TCP and IP header ***
-			th->th_sum = checksumtcp((char*)(tcpsumbuff), sizeof(struct pseudotcp_t) + ntohs(ip->tot_len) - iphdrlen);
-			iph->check = checksum((unsigned short*)(ethfrm_wr.data + sizeof(struct ethhdr)), iphdrlen/2);
-
-			//Actual sending
-			struct sockaddr_ll sadr_ll;
-			sadr_ll.sll_ifindex = ifreq_iface.ifr_ifindex;
-			sadr_ll.sll_halen = ETH_ALEN;
-			sadr_ll.sll_addr[0] = mac_laptop[0];
-			sadr_ll.sll_addr[1] = mac_laptop[1];
-			sadr_ll.sll_addr[2] = mac_laptop[2];
-			sadr_ll.sll_addr[3] = mac_laptop[3];
-			sadr_ll.sll_addr[4] = mac_laptop[4];
-			sadr_ll.sll_addr[5] = mac_laptop[5];
-
-			unsigned int res = sendto(fd_sock, ethfrm_wr.data, ntohs(ip->tot_len) + 14,
-					0, (const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll));
-			// if (res < 0)
-				// printf("TCP downlink packet send error\n");
-			// else
-				// printf("TCP downlink packet send success\n");
-		}
+		// *** Actual sending ***
+		LAT_STAMP(&ethfrm_rd.ts, LAT_TX_FIRST, ethfrm_rd.bytes);
+		if (sendto(fd_sock, ethfrm_wr.data, bytes, 0,
+				(const struct sockaddr*)&sadr_ll, sizeof(struct sockaddr_ll)) < 0)
+			printf("Downlink packet send error\n");
+		LAT_STAMP(&ethfrm_rd.ts, LAT_TX_LAST, ethfrm_rd.bytes);
+		LAT_RECORD(&ethfrm_rd.ts, ethfrm_rd.bytes);
 	}
 }
 
 uint8_t buff_dl_push(ethfrm_t ethfrm)
 {
-	uint8_t stat = 1;	// Push fail (buffer full)
-
-	if (!full_dl)
-	{
-		pthread_mutex_lock(&mutex_dl);
-
-		// *** Write eth frame to buffer and update head ***
-		buff_dl[head_dl++] = ethfrm;
-		if (head_dl == BUFF_DL_SIZE)
-			head_dl = 0;
-
-		// *** Update empty and full status ***
-		empty_dl = 0;
-		if (head_dl == tail_dl)
-			full_dl = 1;
-
-		pthread_mutex_unlock(&mutex_dl);
-
-		stat = 0;	// Push success
-	}
-
-	return stat;
+	return staq_push(&buff_dl, &ethfrm);
 }
 
 uint8_t buff_dl_pop(ethfrm_t *ethfrm)
 {
-	uint8_t stat = 1;	// Pop fail (buffer empty)
-
-	if (!empty_dl)
-	{
-		pthread_mutex_lock(&mutex_dl);
-
-		// *** Read eth frame from buffer and update tail ***
-		*ethfrm = buff_dl[tail_dl++];
-		if (tail_dl == BUFF_DL_SIZE)
-			tail_dl = 0;
-
-		// *** Update empty and full status ***
-		full_dl = 0;
-		if (tail_dl == head_dl)
-			empty_dl = 1;
-
-		pthread_mutex_unlock(&mutex_dl);
-
-		stat = 0;	// Pop success
-	}
-
-	return stat;
+	return staq_pop(&buff_dl, ethfrm);
 }
 
 void buff_dl_print(void)
 {
-	uint16_t i, j;
-
-	printf("Buffer Downlink: Head=%d, Tail=%d, Empty=%d, Full=%d\n", head_dl,
-			tail_dl, empty_dl, full_dl);
-	for (i = 0; i < BUFF_DL_SIZE; i++)
-	{
-		for (j = 0; j < buff_dl[i].bytes; j++)
-			printf("%02X ", buff_dl[i].data[j]);
-		printf("\n");
-	}
+	printf("Buffer Downlink: Used=%llu/%llu bytes\n",
+			(unsigned long long)pktring_used(&buff_dl.ring),
+			(unsigned long long)buff_dl.ring.size);
 }
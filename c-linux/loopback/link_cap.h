@@ -0,0 +1,273 @@
+// ### Description #############################################################
+// Capture of the link frames received on the optical links.
+//
+// Build with -DLINK_CAP to record every frame the link receive thread decodes
+// (recv_vlc_frm at the station, recv_irc_frm at the access point), broken
+// ones included, into a pcapng file. The receive thread only copies the frame
+// into a lock-free ring (pktring.h, one producer); a background thread drains
+// the ring into the file, which is memory-mapped and grown in
+// LINK_CAP_CHUNK steps. Frames are dropped and counted when the ring is full,
+// the receive thread never waits for the disk.
+//
+// The file ends with a custom block (0x40000BAD) covering the mapped space not
+// written yet, so it can be read at any time, also after the daemon has been
+// killed. Readers skip that block.
+//
+// Link type is LINKTYPE_USER0 (147), timestamps are in nanoseconds. Each
+// packet starts with an 8-byte link header, then the frame data:
+//	PHY FLAGS TYPE STA STATUS 0 LEN_H LEN_L
+//	PHY    = 0 VLC (OFDM), 1 IRC (OOK)
+//	FLAGS  = LINK_CAP_F_* below
+//	TYPE   = frame type of the header (VLC_TYPE_* low byte or IRC_TYPE_*)
+//	STA    = station of the header
+//	STATUS = receive status (0, HEADER_MISSING, ACK_FOUND, ...)
+//	LEN    = data bytes announced by the header, the bytes that did not
+//	         arrive in a cut frame are zero
+//
+// Without LINK_CAP every macro is empty.
+
+#ifndef _LINK_CAP_H_
+#define _LINK_CAP_H_
+
+#include "lifi_mac.h"
+
+// ### Defines #################################################################
+#define LINK_CAP_VLC		0
+#define LINK_CAP_IRC		1
+// Flags
+#define LINK_CAP_F_ACK		0x01	// ACK, alone or piggybacked
+#define LINK_CAP_F_NOHDR	0x02	// Header missing (bad sync or ID)
+#define LINK_CAP_F_CUT		0x04	// Timed out in the middle of the frame
+#define LINK_CAP_F_OTHER	0x08	// For another station
+#define LINK_CAP_HDR		8
+// Ring between the receive thread and the writer
+#define LINK_CAP_RING		(1 << 20)
+// File growth step
+#define LINK_CAP_CHUNK		(4 << 20)
+// Writer sleep when the ring is empty
+#define LINK_CAP_IDLE_US	1000
+// *** pcapng ***
+#define PCAPNG_SHB			0x0A0D0D0A
+#define PCAPNG_IDB			0x00000001
+#define PCAPNG_EPB			0x00000006
+#define PCAPNG_FILL			0x40000BAD
+#define PCAPNG_FILL_PEN		32473	// Private enterprise number for examples
+#define PCAPNG_FILL_SIZE	16
+#define PCAPNG_LINK_USER0	147
+
+#ifdef LINK_CAP
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// ### Struct definitions ######################################################
+typedef struct link_cap_t
+{
+	pktring_t ring;
+	int fd;
+	uint8_t *map;
+	uint64_t map_size;				// File and mapping size
+	uint64_t off;					// End of the last block written
+	uint64_t frames;
+	volatile uint64_t dropped;		// Ring full
+	volatile uint8_t on;
+	pthread_t thread;
+} link_cap_t;
+
+// ### Variables ###############################################################
+static link_cap_t link_cap;
+
+// ### Functions ###############################################################
+static inline uint64_t link_cap_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void link_cap_put32(uint64_t off, uint32_t val)
+{
+	memcpy(link_cap.map + off, &val, 4);
+}
+
+// *** Make room for bytes more, and the fill block after them ***
+static inline int link_cap_grow(uint64_t bytes)
+{
+	uint64_t size = link_cap.map_size;
+	void *map;
+
+	while (link_cap.off + bytes + PCAPNG_FILL_SIZE > size)
+		size += LINK_CAP_CHUNK;
+	if (size == link_cap.map_size)
+		return 0;
+	if (ftruncate(link_cap.fd, size) < 0)
+		return -1;
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, link_cap.fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	if (link_cap.map != NULL)
+		munmap(link_cap.map, link_cap.map_size);
+	link_cap.map = (uint8_t *)map;
+	link_cap.map_size = size;
+
+	return 0;
+}
+
+// *** Cover the space after the last block ***
+static inline void link_cap_fill(void)
+{
+	uint32_t len = link_cap.map_size - link_cap.off;
+
+	link_cap_put32(link_cap.off, PCAPNG_FILL);
+	link_cap_put32(link_cap.off + 4, len);
+	link_cap_put32(link_cap.off + 8, PCAPNG_FILL_PEN);
+	link_cap_put32(link_cap.off + len - 4, len);
+}
+
+// *** Ring record: timestamp, link header, data ***
+static inline void link_cap_write(const uint8_t *rec, uint32_t len)
+{
+	uint32_t cap = len - 8;
+	uint32_t blk = 32 + ((cap + 3) & ~3);
+	uint64_t ts, off;
+
+	if (link_cap_grow(blk) < 0)
+		return;
+	memcpy(&ts, rec, 8);
+	off = link_cap.off;
+	memset(link_cap.map + off, 0, blk);
+	link_cap_put32(off, PCAPNG_EPB);
+	link_cap_put32(off + 4, blk);
+	link_cap_put32(off + 8, 0);					// Interface 0
+	link_cap_put32(off + 12, (uint32_t)(ts >> 32));
+	link_cap_put32(off + 16, (uint32_t)ts);
+	link_cap_put32(off + 20, cap);
+	link_cap_put32(off + 24, cap);
+	memcpy(link_cap.map + off + 28, rec + 8, cap);
+	link_cap_put32(off + blk - 4, blk);
+	link_cap.off += blk;
+	link_cap.frames++;
+}
+
+static void *link_cap_handler(void *arg)
+{
+	uint8_t *rec;
+	uint32_t len;
+
+	(void)arg;
+	while (1)
+	{
+		if ((rec = pktring_peek(&link_cap.ring, &len)) == NULL)
+		{
+			usleep(LINK_CAP_IDLE_US);
+			continue;
+		}
+		do
+		{
+			link_cap_write(rec, len);
+			pktring_release(&link_cap.ring);
+		}
+		while ((rec = pktring_peek(&link_cap.ring, &len)) != NULL);
+		link_cap_fill();
+	}
+	return NULL;
+}
+
+// *** Create the file with its section and interface blocks, start the
+// writer. Return -1 on error, the capture then stays off ***
+static inline int link_cap_open(const char *name)
+{
+	const uint8_t tsresol[8] = {9, 0, 1, 0, 9, 0, 0, 0};	// if_tsresol = ns
+
+	if (pktring_init(&link_cap.ring, LINK_CAP_RING) < 0)
+		return -1;
+	link_cap.fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (link_cap.fd < 0 || link_cap_grow(28 + 32) < 0)
+	{
+		pktring_free(&link_cap.ring);
+		return -1;
+	}
+
+	// *** Section header, little endian, version 1.0, unknown length ***
+	link_cap_put32(0, PCAPNG_SHB);
+	link_cap_put32(4, 28);
+	link_cap_put32(8, 0x1A2B3C4D);
+	link_cap_put32(12, 0x00000001);
+	link_cap_put32(16, 0xFFFFFFFF);
+	link_cap_put32(20, 0xFFFFFFFF);
+	link_cap_put32(24, 28);
+	// *** Interface, no snap length, nanosecond timestamps ***
+	link_cap_put32(28, PCAPNG_IDB);
+	link_cap_put32(32, 32);
+	link_cap_put32(36, PCAPNG_LINK_USER0);
+	link_cap_put32(40, 0);
+	memcpy(link_cap.map + 44, tsresol, 8);
+	link_cap_put32(52, 0);						// opt_endofopt
+	link_cap_put32(56, 32);
+	link_cap.off = 60;
+	link_cap_fill();
+
+	if (pthread_create(&link_cap.thread, NULL, link_cap_handler, NULL) != 0)
+		return -1;
+	link_cap.on = 1;
+
+	return 0;
+}
+
+// *** Called by the link receive thread after each frame ***
+static inline void link_cap_rx(uint8_t phy, uint8_t status, mac_hdr_t *hdr,
+		ethfrm_t *ethfrm)
+{
+	uint64_t ts = link_cap_now_ns();
+	uint16_t cap = (ethfrm->bytes > LINK_MTU) ? LINK_MTU : ethfrm->bytes;
+	uint8_t *p, flags = 0;
+
+	// *** Nothing received ***
+	if (!link_cap.on || (status == RX_TIMEOUT && ethfrm->bytes == 0))
+		return;
+	p = pktring_reserve(&link_cap.ring, 8 + LINK_CAP_HDR + cap);
+	if (p == NULL)
+	{
+		link_cap.dropped++;
+		return;
+	}
+
+	if (status == HEADER_MISSING)
+		flags |= LINK_CAP_F_NOHDR;
+	else if (status == RX_TIMEOUT)
+		flags |= LINK_CAP_F_CUT;
+	else if (status == STA_MISMATCH)
+		flags |= LINK_CAP_F_OTHER;
+	if (status != HEADER_MISSING && hdr->ack)
+		flags |= LINK_CAP_F_ACK;
+
+	memcpy(p, &ts, 8);
+	p[8] = phy;
+	p[9] = flags;
+	p[10] = (status == HEADER_MISSING) ? 0 : hdr->type;
+	p[11] = (status == HEADER_MISSING) ? 0 : hdr->sta;
+	p[12] = status;
+	p[13] = 0;
+	p[14] = (uint8_t)(ethfrm->bytes >> 8);
+	p[15] = (uint8_t)(ethfrm->bytes & 0xFF);
+	memcpy(p + 16, ethfrm->data, cap);
+	pktring_commit(&link_cap.ring, 8 + LINK_CAP_HDR + cap);
+}
+
+#define LINK_CAP_OPEN(name)									\
+	do {													\
+		if (link_cap_open(name) < 0)						\
+			printf("Link capture %s open error\n", name);	\
+	} while (0)
+#define LINK_CAP_RX(phy, status, hdr, ethfrm)	link_cap_rx(phy, status, hdr, ethfrm)
+
+#else
+
+#define LINK_CAP_OPEN(name)
+#define LINK_CAP_RX(phy, status, hdr, ethfrm)
+
+#endif
+
+#endif
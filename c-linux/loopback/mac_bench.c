@@ -0,0 +1,432 @@
+// ### Description #############################################################
+// LiFi MAC benchmark on a simulated medium (phy_sim.h), for N = 1, 2, 4, ...
+// forked station processes.
+//
+// Downlink: the access point side (this process) schedules saturated
+// per-station queues with the lifi_mac.h scheduler and sends the frames on
+// the VLC broadcast ring. Every station receives all symbols and keeps only
+// its own frames, exactly as lifi_station does. For TDMA and DRR the aggregate
+// goodput, the airtime efficiency and Jain's fairness index are reported.
+// Stations get different frame sizes, so that airtime fairness (what the
+// scheduler is meant to provide) and byte fairness can be told apart.
+//
+// Uplink: saturated stations share the IRC channel, either polled by the
+// access point or, as before the polled uplink, sending whenever they have
+// data. Aggregate and per-station goodput and broken frames are reported.
+//
+// Build: gcc -O2 -o mac_bench mac_bench.c -lpthread -lrt
+// Usage: mac_bench [MAX_STA [SECONDS [SYM_NS [BYTE_NS]]]]
+
+// ### Includes ################################################################
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "lifi_mac.h"
+#include "phy_sim.h"
+
+// ### Defines #################################################################
+#define BENCH_STA_DEFAULT	8
+#define BENCH_SEC_DEFAULT	2
+// Simulated symbol airtime, faster than the real PHY to keep runs short
+#define BENCH_SYM_NS		2000
+// Simulated IRC byte airtime
+#define BENCH_BYTE_NS		4000
+// Uplink frames per poll and answer timeout, as in lifi_access_point
+#define BENCH_UL_GRANT		4
+#define BENCH_POLL_US		20000
+// Bytes per station queue, power of 2
+#define BENCH_QUEUE_SIZE	(64 * 2048)
+// Frame header: station ID and 32-bit sequence number
+#define BENCH_HDR_SIZE		5
+// Uplink frame size, the same for all stations to compare their access
+#define BENCH_UL_SIZE		576
+
+// ### Variables ###############################################################
+phy_sim_t *sim;
+phy_sim_port_t port;
+// Downlink frame size of each station
+uint16_t frm_size[8] = {1518, 64, 576, 1024, 128, 1500, 300, 900};
+
+// ### Function prototypes #####################################################
+void frm_fill(ethfrm_t *ethfrm, uint8_t sta, uint32_t seq, uint16_t bytes);
+uint8_t frm_check(ethfrm_t *ethfrm, uint8_t sta);
+void station_dl(uint8_t sta);
+void station_ul(uint8_t sta, uint8_t polled);
+void run_dl(uint8_t mode, uint8_t num_sta, uint32_t seconds);
+void run_ul(uint8_t polled, uint8_t num_sta, uint32_t seconds);
+double jain(double *x, uint8_t n);
+
+// ### Main ####################################################################
+int main(int argc, char *argv[])
+{
+	int max_sta = BENCH_STA_DEFAULT;
+	int seconds = BENCH_SEC_DEFAULT;
+	int sym_ns = BENCH_SYM_NS;
+	int byte_ns = BENCH_BYTE_NS;
+	uint8_t n;
+
+	// *** Get MAX_STA, SECONDS, SYM_NS and BYTE_NS ***
+	if (argc > 5)
+	{
+		printf("Error: Too many arguments supplied.\n");
+		printf("Usage: %s [MAX_STA [SECONDS [SYM_NS [BYTE_NS]]]]\n", argv[0]);
+		return -1;
+	}
+	if (argc >= 2)
+		max_sta = atoi(argv[1]);
+	if (argc >= 3)
+		seconds = atoi(argv[2]);
+	if (argc >= 4)
+		sym_ns = atoi(argv[3]);
+	if (argc >= 5)
+		byte_ns = atoi(argv[4]);
+	if (max_sta < 1 || max_sta > MAX_STA || seconds < 1 || sym_ns < 0 || byte_ns < 1)
+	{
+		printf("Error: MAX_STA must be 1 ~ %d, SECONDS >= 1, SYM_NS >= 0, BYTE_NS >= 1.\n",
+				MAX_STA);
+		return -1;
+	}
+
+	// *** Simulated medium ***
+	sim = phy_sim_open(PHY_SIM_NAME, 1);
+	if (sim == NULL)
+	{
+		perror("Couldn't create the simulated PHY");
+		return -1;
+	}
+	sim->sym_ns = sym_ns;
+	sim->byte_ns = byte_ns;
+
+	printf("VLC symbol airtime: %d ns, IRC byte airtime: %d ns, %d s per run\n",
+			sym_ns, byte_ns, seconds);
+	printf("=============================== Downlink ===============================\n");
+	printf("%-5s %3s %10s %9s %8s %8s %8s %8s\n", "Sched", "N", "Goodput", "Airtime",
+			"Jain", "Jain", "Errors", "Lost");
+	printf("%-5s %3s %10s %9s %8s %8s %8s %8s\n", "", "", "(Mbit/s)", "used (%)",
+			"airtime", "bytes", "(frame)", "(sym)");
+	for (n = 1; n <= max_sta; n *= 2)
+		run_dl(SCHED_TDMA, n, seconds);
+	for (n = 1; n <= max_sta; n *= 2)
+		run_dl(SCHED_DRR, n, seconds);
+
+	printf("================================ Uplink ================================\n");
+	printf("%-6s %3s %10s %10s %10s %8s %8s %8s %8s\n", "Access", "N", "Goodput",
+			"Per STA", "Per STA", "Jain", "Errors", "Timeout", "Collided");
+	printf("%-6s %3s %10s %10s %10s %8s %8s %8s %8s\n", "", "", "(kbit/s)", "min", "avg",
+			"", "(frame)", "(poll)", "(byte)");
+	for (n = 1; n <= max_sta; n *= 2)
+		run_ul(1, n, seconds);
+	for (n = 1; n <= max_sta; n *= 2)
+		run_ul(0, n, seconds);
+
+	shm_unlink(PHY_SIM_NAME);
+
+	return 0;
+}
+
+// ### Functions ###############################################################
+// *** PHY layer functions on the simulated medium ***
+void send_ofdm_sym(ofdmsym_t ofdmsym)
+{
+	phy_sim_vlc_send(&port, ofdmsym.data);
+}
+
+uint8_t recv_ofdm_sym(struct ofdmsym_t *ofdmsym, uint32_t timeout_us)
+{
+	// A stopped medium gives an empty symbol, which ends the current frame
+	if (phy_sim_vlc_recv(&port, ofdmsym->data, (uint64_t)timeout_us * 1000) < 0)
+	{
+		memset(ofdmsym->data, 0, sizeof(ofdmsym->data));
+		return 1;
+	}
+
+	return 0;
+}
+
+void send_ook_sym(uint8_t data)
+{
+	phy_sim_irc_send(&port, data);
+}
+
+uint8_t recv_ook_sym(uint8_t *data, uint32_t timeout_us)
+{
+	// A stopped medium looks like a timeout
+	return (phy_sim_irc_recv(&port, data, (uint64_t)timeout_us * 1000) == 0) ? 0 : 1;
+}
+
+void frm_fill(ethfrm_t *ethfrm, uint8_t sta, uint32_t seq, uint16_t bytes)
+{
+	uint16_t i;
+
+	ethfrm->bytes = bytes;
+	ethfrm->data[0] = sta;
+	ethfrm->data[1] = seq >> 24;
+	ethfrm->data[2] = seq >> 16;
+	ethfrm->data[3] = seq >> 8;
+	ethfrm->data[4] = seq;
+	for (i = BENCH_HDR_SIZE; i < ethfrm->bytes; i++)
+		ethfrm->data[i] = (uint8_t)(i + seq);
+}
+
+uint8_t frm_check(ethfrm_t *ethfrm, uint8_t sta)
+{
+	uint32_t seq;
+	uint16_t i;
+
+	if (ethfrm->bytes < BENCH_HDR_SIZE || ethfrm->data[0] != sta)
+		return 1;
+	seq = ((uint32_t)ethfrm->data[1] << 24) | (ethfrm->data[2] << 16) |
+			(ethfrm->data[3] << 8) | ethfrm->data[4];
+	for (i = BENCH_HDR_SIZE; i < ethfrm->bytes; i++)
+	{
+		if (ethfrm->data[i] != (uint8_t)(i + seq))
+			return 1;
+	}
+
+	return 0;
+}
+
+void station_dl(uint8_t sta)
+{
+	phy_sim_stat_t *stat = &sim->stat[sta];
+	struct mac_hdr_t hdr;
+	ethfrm_t ethfrm;
+	uint8_t ret_val;
+
+	while (!sim->stop)
+	{
+		ret_val = recv_vlc_frm(&ethfrm, sta, &hdr);
+		if (ret_val == STA_MISMATCH)
+			continue;
+		if (ret_val == 0 && frm_check(&ethfrm, sta) == 0)
+		{
+			stat->frames++;
+			stat->bytes += ethfrm.bytes;
+			stat->sym += vlc_frm_sym(ethfrm.bytes);
+		}
+		else if (!sim->stop)
+		{
+			stat->errors++;
+		}
+	}
+	stat->lost = port.lost;
+}
+
+void run_dl(uint8_t mode, uint8_t num_sta, uint32_t seconds)
+{
+	staq_t q[MAX_STA];
+	dl_sched_t dl_sched;
+	ethfrm_t ethfrm;
+	uint8_t *data;
+	pid_t pid[MAX_STA];
+	uint32_t seq[MAX_STA] = {0};
+	double airtime[MAX_STA], goodput[MAX_STA];
+	uint64_t bytes = 0, sym = 0, errors = 0, lost = 0, head;
+	uint64_t t_start, t_end;
+	uint8_t i;
+	int sta;
+
+	// *** Reset the medium ***
+	sim->stop = 0;
+	memset(sim->stat, 0, sizeof(sim->stat));
+
+	// *** Start the stations, attached before the first symbol is sent ***
+	for (i = 0; i < num_sta; i++)
+	{
+		pid[i] = fork();
+		if (pid[i] == 0)
+		{
+			phy_sim_attach(&port, sim);
+			station_dl(i);
+			_exit(0);
+		}
+	}
+	usleep(100000);
+	phy_sim_attach(&port, sim);
+
+	// *** Saturated station queues ***
+	for (i = 0; i < num_sta; i++)
+		staq_init(&q[i], BENCH_QUEUE_SIZE);
+	dl_sched_init(&dl_sched, mode, num_sta);
+
+	// *** Access point: schedule and send for the run time ***
+	head = sim->vlc_head;
+	t_start = phy_sim_now_ns();
+	t_end = t_start + (uint64_t)seconds * 1000000000ULL;
+	while (phy_sim_now_ns() < t_end)
+	{
+		for (i = 0; i < num_sta; i++)
+		{
+			while (1)
+			{
+				frm_fill(&ethfrm, i, seq[i], frm_size[i % 8]);
+				if (staq_push(&q[i], &ethfrm))
+					break;
+				seq[i]++;
+			}
+		}
+		sta = dl_sched_peek(&dl_sched, q, &data, &ethfrm.bytes);
+		if (sta >= 0)
+		{
+			send_vlc_buf(data, ethfrm.bytes, sta, 0);
+			staq_release(&q[sta]);
+		}
+	}
+	t_end = phy_sim_now_ns();
+	head = sim->vlc_head - head;
+
+	// *** Stop and collect ***
+	usleep(100000);
+	sim->stop = 1;
+	for (i = 0; i < num_sta; i++)
+		waitpid(pid[i], NULL, 0);
+	for (i = 0; i < num_sta; i++)
+	{
+		bytes += sim->stat[i].bytes;
+		sym += sim->stat[i].sym;
+		errors += sim->stat[i].errors;
+		lost += sim->stat[i].lost;
+		airtime[i] = sim->stat[i].sym;
+		goodput[i] = sim->stat[i].bytes;
+		pktring_free(&q[i].ring);
+	}
+
+	printf("%-5s %3d %10.2f %9.1f %8.4f %8.4f %8llu %8llu\n",
+			(mode == SCHED_TDMA) ? "TDMA" : "DRR", num_sta,
+			bytes * 8 / ((t_end - t_start) / 1e3), head ? (100.0 * sym / head) : 0.0,
+			jain(airtime, num_sta), jain(goodput, num_sta),
+			(unsigned long long)errors, (unsigned long long)lost);
+}
+
+void station_ul(uint8_t sta, uint8_t polled)
+{
+	struct mac_hdr_t hdr;
+	ethfrm_t ethfrm;
+	uint32_t seq = 0;
+	uint16_t grant, n;
+
+	while (!sim->stop)
+	{
+		// *** Without polling, send whenever there is data (always) ***
+		if (!polled)
+		{
+			frm_fill(&ethfrm, sta, seq++, BENCH_UL_SIZE);
+			send_irc_frm(ethfrm, sta, IRC_TYPE_DATA, 0);
+			continue;
+		}
+
+		// *** Wait for our poll, then send the granted frames ***
+		if (recv_vlc_frm(&ethfrm, sta, &hdr) != POLL_FOUND)
+			continue;
+		grant = hdr.grant;
+		for (n = 1; n <= grant; n++)
+		{
+			frm_fill(&ethfrm, sta, seq++, BENCH_UL_SIZE);
+			send_irc_frm(ethfrm, sta, (n < grant) ? IRC_TYPE_MORE : IRC_TYPE_DATA, 0);
+		}
+	}
+}
+
+void run_ul(uint8_t polled, uint8_t num_sta, uint32_t seconds)
+{
+	struct mac_hdr_t hdr;
+	ethfrm_t ethfrm;
+	pid_t pid[MAX_STA];
+	double goodput[MAX_STA] = {0};
+	uint64_t bytes = 0, errors = 0, timeout = 0;
+	uint64_t t_start, t_end;
+	double min, sec;
+	uint8_t ret_val, sta = 0;
+	uint16_t n;
+	uint8_t i;
+
+	// *** Reset the medium and start the stations. Listen before they do, so
+	// that the first frame is received from its start. ***
+	sim->stop = 0;
+	phy_sim_attach(&port, sim);
+	for (i = 0; i < num_sta; i++)
+	{
+		pid[i] = fork();
+		if (pid[i] == 0)
+		{
+			phy_sim_attach(&port, sim);
+			station_ul(i, polled);
+			_exit(0);
+		}
+	}
+
+	// *** Access point: receive (and poll) for the run time ***
+	t_start = phy_sim_now_ns();
+	t_end = t_start + (uint64_t)seconds * 1000000000ULL;
+	while (phy_sim_now_ns() < t_end)
+	{
+		if (!polled)
+		{
+			ret_val = recv_irc_frm(&ethfrm, &hdr, BENCH_POLL_US);
+			if (ret_val == 0 && hdr.sta < num_sta && frm_check(&ethfrm, hdr.sta) == 0)
+				goodput[hdr.sta] += ethfrm.bytes;
+			else if (ret_val != RX_TIMEOUT)
+				errors++;
+			continue;
+		}
+
+		send_vlc_poll(sta, BENCH_UL_GRANT, 0);
+		for (n = 0; n < BENCH_UL_GRANT; n++)
+		{
+			ret_val = recv_irc_frm(&ethfrm, &hdr, BENCH_POLL_US);
+			if (ret_val != 0 || hdr.sta != sta || hdr.type == IRC_TYPE_NULL ||
+					frm_check(&ethfrm, sta))
+			{
+				if (ret_val == RX_TIMEOUT)
+					timeout++;
+				else
+					errors++;
+				recv_irc_drain();
+				break;
+			}
+			goodput[sta] += ethfrm.bytes;
+			if (hdr.type != IRC_TYPE_MORE)
+				break;
+		}
+		sta = (sta + 1 == num_sta) ? 0 : sta + 1;
+	}
+	t_end = phy_sim_now_ns();
+
+	// *** Stop and collect ***
+	sim->stop = 1;
+	for (i = 0; i < num_sta; i++)
+		waitpid(pid[i], NULL, 0);
+	sec = (t_end - t_start) / 1e9;
+	min = goodput[0];
+	for (i = 0; i < num_sta; i++)
+	{
+		bytes += goodput[i];
+		if (goodput[i] < min)
+			min = goodput[i];
+	}
+
+	printf("%-6s %3d %10.1f %10.1f %10.1f %8.4f %8llu %8llu %8llu\n",
+			polled ? "Poll" : "None", num_sta, bytes * 8 / sec / 1e3, min * 8 / sec / 1e3,
+			bytes * 8 / sec / 1e3 / num_sta, jain(goodput, num_sta),
+			(unsigned long long)errors, (unsigned long long)timeout,
+			(unsigned long long)port.irc_coll);
+}
+
+double jain(double *x, uint8_t n)
+{
+	double sum = 0, sum_sq = 0;
+	uint8_t i;
+
+	for (i = 0; i < n; i++)
+	{
+		sum += x[i];
+		sum_sq += x[i] * x[i];
+	}
+
+	return (sum_sq > 0) ? (sum * sum / (n * sum_sq)) : 0.0;
+}
@@ -0,0 +1,188 @@
+// ### Description #############################################################
+// Checks of the bridge's MAC functions (lifi_mac.h), without PHY or sockets:
+//	staq_empty		staq_peek and staq_pop on an empty queue
+//	staq_frame		a frame pushed and popped comes back whole
+//	rebuild_icmp	ip_frm_rebuild of ICMP frames of odd and even length: the
+//					checksum covers the odd trailing byte, and for even
+//					lengths equals checksum() over the words, as before
+// Each check prints ok or FAIL, the exit status is the number of failures.
+// Run it built with and without -DLAT_TRACE, which puts a timestamp record in
+// front of every queued frame.
+//
+// Build: gcc -O2 [-DLAT_TRACE] -o mac_check mac_check.c -lpthread -lrt
+// Usage: mac_check
+
+// ### Includes ################################################################
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lifi_mac.h"
+
+// ### Defines #################################################################
+#define CHECK_QUEUE_SIZE	(16 * 2048)
+
+// ### Variables ###############################################################
+staq_t queue;
+ethfrm_t frm_in, frm_out;
+uint8_t mac_a[6] = {0x00, 0x26, 0x32, 0xF0, 0x56, 0x70};
+uint8_t mac_b[6] = {0x00, 0x30, 0x67, 0x0B, 0xE0, 0xFD};
+int fails;
+
+// ### Function prototypes #####################################################
+void check(const char *name, int ok);
+void check_staq_empty(void);
+void check_staq_frame(void);
+uint16_t ref_sum(const uint8_t *p, uint16_t bytes);
+void icmp_make(uint16_t payload);
+void check_rebuild_icmp(void);
+
+// ### Main ####################################################################
+int main(void)
+{
+	if (staq_init(&queue, CHECK_QUEUE_SIZE) < 0)
+	{
+		printf("Buffer allocation error\n");
+		return -1;
+	}
+
+	check_staq_empty();
+	check_staq_frame();
+	check_rebuild_icmp();
+
+	pktring_free(&queue.ring);
+
+	return fails;
+}
+
+// ### Functions ###############################################################
+void check(const char *name, int ok)
+{
+	printf("%-16s %s\n", name, ok ? "ok" : "FAIL");
+	if (!ok)
+		fails++;
+}
+
+// *** An empty queue gives no frame, 0 bytes, and leaves ethfrm alone ***
+void check_staq_empty(void)
+{
+	uint16_t bytes = 0xFFFF;
+	uint8_t *p = staq_peek(&queue, &bytes);
+
+	memset(&frm_out, 0, sizeof(frm_out));
+	frm_out.bytes = 7;
+	frm_out.data[0] = 0xA5;
+	check("staq_empty", (p == NULL) && (bytes == 0) &&
+			(staq_pop(&queue, &frm_out) == 1) &&
+			(frm_out.bytes == 7) && (frm_out.data[0] == 0xA5));
+}
+
+// *** Frames of 1 byte to LINK_MTU in and out, then the queue is empty ***
+void check_staq_frame(void)
+{
+	uint16_t bytes, i, n[3] = {1, 64, LINK_MTU};
+	int ok = 1;
+	uint8_t j;
+
+	for (j = 0; j < 3; j++)
+	{
+		memset(&frm_in, 0, sizeof(frm_in));
+		for (i = 0; i < n[j]; i++)
+			frm_in.data[i] = (uint8_t)(i * 7 + j);
+		frm_in.bytes = n[j];
+		if (staq_push(&queue, &frm_in) != 0)
+			ok = 0;
+	}
+	for (j = 0; j < 3; j++)
+	{
+		memset(&frm_out, 0, sizeof(frm_out));
+		if (staq_pop(&queue, &frm_out) != 0 || frm_out.bytes != n[j])
+		{
+			ok = 0;
+			continue;
+		}
+		for (i = 0; i < n[j]; i++)
+		{
+			if (frm_out.data[i] != (uint8_t)(i * 7 + j))
+				ok = 0;
+		}
+	}
+	check("staq_frame", ok && (staq_peek(&queue, &bytes) == NULL) && (bytes == 0));
+}
+
+// *** One's complement sum of bytes as big-endian words, an odd last byte
+// padded with zero (RFC 1071), 0xFFFF over a message with a valid checksum ***
+uint16_t ref_sum(const uint8_t *p, uint16_t bytes)
+{
+	uint32_t sum = 0;
+	uint16_t i;
+
+	for (i = 0; i + 1 < bytes; i += 2)
+		sum += (p[i] << 8) | p[i+1];
+	if (bytes & 1)
+		sum += p[bytes-1] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (uint16_t)sum;
+}
+
+// *** IPv4 ICMP echo with payload bytes ***
+void icmp_make(uint16_t payload)
+{
+	struct ethhdr *eth = (struct ethhdr *)frm_in.data;
+	struct iphdr *ip = (struct iphdr *)(frm_in.data + sizeof(struct ethhdr));
+	struct icmphdr *icmp = (struct icmphdr *)(frm_in.data + sizeof(struct ethhdr) +
+			sizeof(struct iphdr));
+	uint8_t *data = (uint8_t *)icmp + sizeof(struct icmphdr);
+	uint16_t i;
+
+	memset(&frm_in, 0, sizeof(frm_in));
+	memcpy(eth->h_dest, mac_a, ETH_ALEN);
+	memcpy(eth->h_source, mac_b, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_ICMP;
+	ip->tot_len = htons(sizeof(struct iphdr) + sizeof(struct icmphdr) + payload);
+	ip->saddr = inet_addr("192.168.1.100");
+	ip->daddr = inet_addr("192.168.3.1");
+	icmp->type = ICMP_ECHO;
+	icmp->un.echo.id = htons(0x1234);
+	icmp->un.echo.sequence = htons(1);
+	for (i = 0; i < payload; i++)
+		data[i] = (uint8_t)(0x80 | i);
+	frm_in.bytes = sizeof(struct ethhdr) + ntohs(ip->tot_len);
+}
+
+void check_rebuild_icmp(void)
+{
+	const uint16_t l3 = sizeof(struct ethhdr), l4 = l3 + sizeof(struct iphdr);
+	uint16_t payload, len, sum_odd = 0;
+	int ok = 1;
+
+	for (payload = 36; payload <= 37; payload++)
+	{
+		icmp_make(payload);
+		len = ip_frm_rebuild(&frm_in, &frm_out, mac_a, mac_b, 0, inet_addr("10.0.0.1"));
+		if (len != frm_in.bytes || ref_sum(frm_out.data + l3, sizeof(struct iphdr)) != 0xFFFF ||
+				ref_sum(frm_out.data + l4, len - l4) != 0xFFFF)
+			ok = 0;
+		if (payload & 1)
+			sum_odd = ((struct icmphdr *)(frm_out.data + l4))->checksum;
+		else
+		{
+			((struct icmphdr *)(frm_out.data + l4))->checksum = 0;
+			if (checksum((unsigned short *)(frm_out.data + l4), (len - l4)/2) !=
+					checksumtcp((const char *)(frm_out.data + l4), len - l4))
+				ok = 0;
+		}
+	}
+	// The odd trailing byte changes the checksum
+	frm_in.data[frm_in.bytes-1] ^= 0xFF;
+	ip_frm_rebuild(&frm_in, &frm_out, mac_a, mac_b, 0, inet_addr("10.0.0.1"));
+	if (((struct icmphdr *)(frm_out.data + l4))->checksum == sum_odd)
+		ok = 0;
+	check("rebuild_icmp", ok);
+}
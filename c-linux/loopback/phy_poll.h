@@ -0,0 +1,283 @@
+// ### Description #############################################################
+// Polling of the PHY ready and busy flags paced by the symbol time.
+//
+// A flag wait first sleeps until PHY_POLL_SPIN_NS before the flag is due, then
+// spins on the register. The receivers first take the symbols (or bytes) the
+// RX FIFO level register says are queued (VLC 0x08, IRC 0x10) and only wait
+// when it is empty, on the FIFO not-empty flag (VLC bit 2, IRC bit 16 of 0x00),
+// due one symbol (or byte) after the FIFO was drained. A TX FIFO full flag is
+// due to clear one symbol after the FIFO filled up. When the flag is still not
+// there PHY_POLL_SPIN_NS after it was due, the link is idle and the register
+// is read once every half symbol, sleeping in between (yielding when that is
+// shorter than PHY_POLL_SLEEP_MIN_NS). The RX FIFOs hold a frame, so the idle
+// polling only delays the first symbol of a frame, nothing is overwritten.
+//
+// Timing comes from the PHY configuration (125 MHz AXI clock):
+//	VLC symbol = (72 preamble + CP + N data + guard) samples * VLC_UP_FACTOR
+//			   = (CP + N) data samples * VLC_UP_FACTOR inside a burst (VLC_BURST > 1)
+//	with N = 2^VLC_FFT_BITS and CP = VLC_CP_LEN, 64 + 8 by default
+//	IRC byte   = 10 bits (start, 8 data, stop) * 16 ticks * IRC_MOD_M	(UART)
+//			   = 18 slots (start, 16 data, stop) * 16 ticks * IRC_SLOT_M
+//														(Manchester, 4-PPM)
+//
+// Build with -DPHY_IRQ to block on the core's interrupt instead, through a
+// UIO device (uio_pdrv_genirq, see lifi_uio.dtsi) found by its name. While the
+// link is idle the wait unmasks the interrupt and sleeps on the UIO fd until
+// the flag is raised, or PHY_IRQ_WAIT_NS as a guard against a lost interrupt.
+// The interrupt is only unmasked once the flag is late, so under load the
+// flags are still met by the paced spin and cost no interrupt at all.
+//
+// Each wait counts the register reads and the time spent spinning, the CPU
+// time lost on the flag. Build with -DPHY_POLL_STATS to print them every
+// PHY_POLL_PRINT_S seconds, and with -DPHY_POLL_SPIN to spin without sleeping,
+// as before, to compare.
+
+#ifndef _PHY_POLL_H_
+#define _PHY_POLL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/prctl.h>
+#ifdef PHY_IRQ
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+// ### Defines #################################################################
+// *** PHY configuration, same on both sides of a link ***
+#define VLC_MOD				2			// 0: BPSK, 1: QPSK, 2: QAM-16
+#define VLC_GUARD			72			// Guard interval samples, 0, 72, 144 or 216
+#define VLC_BURST			0			// Symbols per preamble, 0 or 1: no burst
+#define VLC_UP_FACTOR		25			// Up/downsampling factor, 1 - 25 (125 MHz / 5 MHz)
+#define VLC_FFT_BITS		6			// C_FFT_BITS of the VLC cores (synthesis time)
+#define VLC_CP_LEN			8			// C_CP_LEN of the VLC cores (synthesis time)
+#define IRC_MOD_M			8			// Baud tick divisor (fixed in axis_irctx/rx)
+#define IRC_MODE			0			// 0: UART, 1: Manchester, 2: 4-PPM
+#define IRC_SLOT_M			2			// Slot tick divisor of IRC_MODE 1 and 2
+// *** PHY timing ***
+#define PHY_CLK_HZ			125000000
+#if VLC_FFT_BITS != 6
+#error "The MAC carries 4 words (64-point QAM-16) per OFDM symbol"
+#endif
+#if VLC_BURST > 1
+#define VLC_SYM_SAMPLES		(VLC_CP_LEN + (1 << VLC_FFT_BITS))
+#else
+#define VLC_SYM_SAMPLES		(72 + VLC_CP_LEN + (1 << VLC_FFT_BITS) + VLC_GUARD)
+#endif
+#define VLC_SYM_NS			((uint32_t)(1000000000ULL * VLC_SYM_SAMPLES * VLC_UP_FACTOR / PHY_CLK_HZ))
+#if IRC_MODE == 0
+#define IRC_BYTE_NS			((uint32_t)(1000000000ULL * 10 * 16 * IRC_MOD_M / PHY_CLK_HZ))
+#else
+#define IRC_BYTE_NS			((uint32_t)(1000000000ULL * 18 * 16 * IRC_SLOT_M / PHY_CLK_HZ))
+#endif
+// IRC control register, mode and slot tick divisor
+#define IRC_CTRL			((IRC_MODE << 20) | IRC_SLOT_M)
+// *** Polling ***
+// Wake-up margin before the flag is due, covers the sleep latency
+#define PHY_POLL_SPIN_NS		20000
+// Shorter waits yield instead of sleeping
+#define PHY_POLL_SLEEP_MIN_NS	10000
+// Seconds between two statistics prints
+#define PHY_POLL_PRINT_S		10
+// *** Interrupt ***
+// Longest sleep on the UIO fd, a lost interrupt costs no more
+#define PHY_IRQ_WAIT_NS			100000000
+
+// ### Struct definitions ######################################################
+typedef struct phy_poll_t
+{
+	const char *name;
+	uint32_t period_ns;				// Symbol or byte time
+	uint64_t due_ns;				// Flag expected at
+	// *** Statistics ***
+	uint64_t polls;
+	uint64_t timeouts;
+	uint64_t sleeps;				// Sleeps and yields
+	uint64_t idle;					// Polls that found the link idle
+	uint64_t reads;					// Register reads
+	uint64_t spin_ns;				// Time spinning on the register
+	uint64_t irqs;					// Interrupts taken
+	int fd;							// UIO device, -1 without
+} phy_poll_t;
+
+// ### Functions ###############################################################
+static inline uint64_t phy_poll_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// *** Sleep until t, yield if it is too close ***
+static inline void phy_poll_sleep(phy_poll_t *p, uint64_t t, uint64_t now)
+{
+	struct timespec tim;
+
+	p->sleeps++;
+	if (t - now < PHY_POLL_SLEEP_MIN_NS)
+	{
+		sched_yield();
+		return;
+	}
+	tim.tv_sec = t / 1000000000ULL;
+	tim.tv_nsec = t % 1000000000ULL;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL);
+}
+
+// *** Called before the polling threads are created, they inherit the timer
+// slack ***
+static inline void phy_poll_init(phy_poll_t *p, const char *name, uint32_t period_ns)
+{
+	memset(p, 0, sizeof(*p));
+	p->name = name;
+	p->period_ns = period_ns;
+	p->fd = -1;
+	// Default slack is 50 us, longer than a symbol
+	prctl(PR_SET_TIMERSLACK, 1);
+}
+
+#ifdef PHY_IRQ
+// *** Open the UIO device named name (/sys/class/uio/uioN/name). Return 0, or
+// -1 and the wait keeps sleeping on the timer ***
+static inline int phy_poll_uio(phy_poll_t *p, const char *name)
+{
+	char path[64], buf[64];
+	FILE *f;
+	int n;
+
+	for (n = 0; n < 16; n++)
+	{
+		snprintf(path, sizeof(path), "/sys/class/uio/uio%d/name", n);
+		if ((f = fopen(path, "r")) == NULL)
+			continue;
+		buf[0] = 0;
+		if (fgets(buf, sizeof(buf), f) == NULL)
+			buf[0] = 0;
+		fclose(f);
+		buf[strcspn(buf, "\n")] = 0;
+		if (strcmp(buf, name) != 0)
+			continue;
+		snprintf(path, sizeof(path), "/dev/uio%d", n);
+		if ((p->fd = open(path, O_RDWR)) < 0)
+			break;
+		return 0;
+	}
+	printf("%s: no UIO device %s, polling\n", p->name, name);
+	return -1;
+}
+
+// *** Unmask the interrupt and sleep on it until t. The interrupt is level
+// triggered, a flag raised before the unmask fires at once ***
+static inline void phy_poll_irq(phy_poll_t *p, uint64_t t, uint64_t now)
+{
+	struct pollfd pfd = {p->fd, POLLIN, 0};
+	uint32_t n = 1;
+
+	p->sleeps++;
+	if (write(p->fd, &n, sizeof(n)) != sizeof(n))
+	{
+		phy_poll_sleep(p, t, now);
+		return;
+	}
+	// poll() counts in ms, the guard timeout needs no better
+	if (poll(&pfd, 1, (t - now + 999999) / 1000000) > 0 &&
+			read(p->fd, &n, sizeof(n)) == sizeof(n))
+		p->irqs++;
+}
+#endif
+
+// *** TX data written, the busy flag clears one period from now ***
+static inline void phy_poll_start(phy_poll_t *p)
+{
+	p->due_ns = phy_poll_now() + p->period_ns;
+}
+
+// *** Wait until (*reg & mask) == val. Return 0, or 1 after timeout_ns (0 =
+// no timeout). The next flag is due one period later ***
+static inline uint8_t phy_poll_wait(phy_poll_t *p, volatile uint32_t *reg,
+		uint32_t mask, uint32_t val, uint64_t timeout_ns)
+{
+	uint64_t start, now, spin;
+	uint8_t idle = 0;
+#ifndef PHY_POLL_SPIN
+	uint64_t spin_end;
+#endif
+
+	start = now = phy_poll_now();
+	p->polls++;
+#ifndef PHY_POLL_SPIN
+	// *** Sleep until just before the flag is due ***
+	if (p->due_ns > now + PHY_POLL_SPIN_NS)
+	{
+		spin_end = p->due_ns - PHY_POLL_SPIN_NS;
+		if (timeout_ns && spin_end > start + timeout_ns)
+			spin_end = start + timeout_ns;
+		phy_poll_sleep(p, spin_end, now);
+		now = phy_poll_now();
+	}
+#endif
+
+	// *** Spin around the due time ***
+	spin = now;
+#ifndef PHY_POLL_SPIN
+	spin_end = ((p->due_ns > now) ? p->due_ns : now) + PHY_POLL_SPIN_NS;
+#endif
+	while (p->reads++, (*reg & mask) != val)
+	{
+		now = phy_poll_now();
+		if (timeout_ns && now - start >= timeout_ns)
+		{
+			p->spin_ns += now - spin;
+			p->timeouts++;
+			p->idle += idle;
+			return 1;
+		}
+#ifndef PHY_POLL_SPIN
+		// *** Flag late, the link is idle: one read per half period ***
+		if (now >= spin_end)
+		{
+			p->spin_ns += now - spin;
+			idle = 1;
+#ifdef PHY_IRQ
+			spin_end = now + ((p->fd >= 0) ? PHY_IRQ_WAIT_NS : p->period_ns / 2);
+#else
+			spin_end = now + p->period_ns / 2;
+#endif
+			if (timeout_ns && spin_end > start + timeout_ns)
+				spin_end = start + timeout_ns;
+#ifdef PHY_IRQ
+			if (p->fd >= 0)
+				phy_poll_irq(p, spin_end, now);
+			else
+#endif
+			phy_poll_sleep(p, spin_end, now);
+			spin = spin_end = phy_poll_now();
+		}
+#endif
+	}
+	now = phy_poll_now();
+	p->spin_ns += now - spin;
+	p->idle += idle;
+	p->due_ns = now + p->period_ns;
+
+	return 0;
+}
+
+// *** Reads and spin time per poll ***
+static inline void phy_poll_print(phy_poll_t *p)
+{
+	uint64_t n = p->polls ? p->polls : 1;
+
+	printf("%s: %llu polls, %llu idle, %llu timeouts, %llu sleeps, %llu irqs, "
+			"%.1f reads/poll, %.2f us spin/poll (period %.2f us)\n", p->name,
+			(unsigned long long)p->polls, (unsigned long long)p->idle,
+			(unsigned long long)p->timeouts, (unsigned long long)p->sleeps,
+			(unsigned long long)p->irqs, (double)p->reads / n, p->spin_ns / 1e3 / n, p->period_ns / 1e3);
+}
+
+#endif
@@ -0,0 +1,245 @@
+// ### Description #############################################################
+// Shared-memory stand-in for the VLC and IRC PHY registers.
+//
+// VLC: one process writes OFDM symbols into a broadcast ring, every attached
+// process reads all of them with its own cursor, like stations under the same
+// light. The writer is paced to the symbol airtime and never waits for
+// readers: a reader that falls more than PHY_SIM_VLC_SYM symbols behind loses
+// them, as it would lose them in the real receiver.
+//
+// IRC: time is cut into byte slots of byte_ns. Any process may send a byte in
+// the current slot. Two bytes in the same slot collide and the receiver gets
+// their OR, as with two OOK transmitters on one photodiode. The receiver reads
+// the slots in order once they are over and skips idle ones.
+//
+// Link with -lrt on older glibc (shm_open).
+
+#ifndef _PHY_SIM_H_
+#define _PHY_SIM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// ### Defines #################################################################
+#define PHY_SIM_NAME		"/lifi_phy_sim"
+// Broadcast ring size in symbols, power of 2
+#define PHY_SIM_VLC_SYM		4096
+#define PHY_SIM_VLC_WORD	4
+// IRC slot ring size, power of 2
+#define PHY_SIM_IRC_SLOT	65536
+// Per-process statistics slots
+#define PHY_SIM_MAX_PROC	64
+
+// ### Struct definitions ######################################################
+typedef struct phy_sim_stat_t
+{
+	uint64_t frames;				// Frames delivered
+	uint64_t bytes;					// Bytes delivered
+	uint64_t sym;					// Symbols of the delivered frames
+	uint64_t errors;				// Header missing or corrupted frames
+	uint64_t lost;					// Symbols overwritten before read
+} phy_sim_stat_t;
+
+typedef struct phy_sim_t
+{
+	volatile uint64_t vlc_head;		// Symbols written so far
+	volatile uint32_t stop;			// Set by the controller to end a run
+	uint32_t sym_ns;				// Airtime of one VLC symbol
+	uint32_t byte_ns;				// Airtime of one IRC byte (slot)
+	uint32_t vlc_ring[PHY_SIM_VLC_SYM][PHY_SIM_VLC_WORD];
+	// IRC slot: (slot+1) << 9 | collision << 8 | data
+	volatile uint64_t irc_ring[PHY_SIM_IRC_SLOT];
+	struct phy_sim_stat_t stat[PHY_SIM_MAX_PROC];
+} phy_sim_t;
+
+typedef struct phy_sim_port_t
+{
+	phy_sim_t *sim;
+	uint64_t cursor;				// Reader: next symbol to read
+	uint64_t next_ns;				// Writer: end of the current airtime
+	uint64_t lost;					// Reader: symbols lost by overrun
+	uint64_t irc_slot;				// IRC writer: last slot used
+	uint64_t irc_cursor;			// IRC reader: next slot to read
+	uint64_t irc_coll;				// IRC reader: collided bytes
+} phy_sim_port_t;
+
+// ### Functions ###############################################################
+static inline uint64_t phy_sim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Map the medium, create and clear it if create is set. NULL on error.
+static inline phy_sim_t *phy_sim_open(const char *name, int create)
+{
+	phy_sim_t *sim;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (fd < 0)
+		return NULL;
+	if (create && ftruncate(fd, sizeof(phy_sim_t)) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	sim = (phy_sim_t *)mmap(0, sizeof(phy_sim_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (sim == MAP_FAILED)
+		return NULL;
+	if (create)
+		memset(sim, 0, sizeof(phy_sim_t));
+
+	return sim;
+}
+
+static inline void phy_sim_attach(phy_sim_port_t *port, phy_sim_t *sim)
+{
+	port->sim = sim;
+	port->cursor = __atomic_load_n(&sim->vlc_head, __ATOMIC_ACQUIRE);
+	port->next_ns = 0;
+	port->lost = 0;
+	port->irc_slot = 0;
+	port->irc_cursor = sim->byte_ns ? (phy_sim_now_ns() / sim->byte_ns) : 0;
+	port->irc_coll = 0;
+}
+
+// *** Writer, blocks for the airtime of the previous symbol ***
+static inline void phy_sim_vlc_send(phy_sim_port_t *port, const uint32_t *data)
+{
+	phy_sim_t *sim = port->sim;
+	uint64_t head = sim->vlc_head;
+	uint64_t now = phy_sim_now_ns();
+
+	// *** Busy flag: previous symbol still on air ***
+	while (now < port->next_ns)
+		now = phy_sim_now_ns();
+	port->next_ns = now + sim->sym_ns;
+
+	memcpy(sim->vlc_ring[head & (PHY_SIM_VLC_SYM-1)], data,
+			PHY_SIM_VLC_WORD * sizeof(uint32_t));
+	__atomic_store_n(&sim->vlc_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// *** Reader, returns 0, 1 if no symbol came within timeout_ns (0 waits
+// forever), or -1 if the medium was stopped ***
+static inline int phy_sim_vlc_recv(phy_sim_port_t *port, uint32_t *data, uint64_t timeout_ns)
+{
+	phy_sim_t *sim = port->sim;
+	uint64_t head, t_end = timeout_ns ? phy_sim_now_ns() + timeout_ns : 0;
+
+	while (1)
+	{
+		// *** Wait until a symbol is ready ***
+		while ((head = __atomic_load_n(&sim->vlc_head, __ATOMIC_ACQUIRE)) == port->cursor)
+		{
+			if (sim->stop)
+				return -1;
+			if (t_end && phy_sim_now_ns() >= t_end)
+				return 1;
+			sched_yield();
+		}
+
+		// *** Too slow, skip to the oldest symbol the writer cannot be
+		// overwriting (slot head is being written) ***
+		if (head - port->cursor >= PHY_SIM_VLC_SYM)
+		{
+			port->lost += head - port->cursor - (PHY_SIM_VLC_SYM-1);
+			port->cursor = head - (PHY_SIM_VLC_SYM-1);
+		}
+
+		memcpy(data, sim->vlc_ring[port->cursor & (PHY_SIM_VLC_SYM-1)],
+				PHY_SIM_VLC_WORD * sizeof(uint32_t));
+
+		// *** Overwritten while copying, count it lost and try again ***
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&sim->vlc_head, __ATOMIC_RELAXED);
+		if (head - port->cursor >= PHY_SIM_VLC_SYM)
+		{
+			port->lost++;
+			port->cursor++;
+			continue;
+		}
+
+		port->cursor++;
+		return 0;
+	}
+}
+
+// *** IRC writer, one byte per slot ***
+static inline void phy_sim_irc_send(phy_sim_port_t *port, uint8_t data)
+{
+	phy_sim_t *sim = port->sim;
+	uint64_t slot, old, val;
+	volatile uint64_t *p;
+
+	// *** Busy flag: wait for a slot after the previous byte ***
+	while ((slot = phy_sim_now_ns() / sim->byte_ns) <= port->irc_slot);
+	port->irc_slot = slot;
+
+	// *** Put the byte on air, OR with anyone else in this slot ***
+	p = &sim->irc_ring[slot & (PHY_SIM_IRC_SLOT-1)];
+	old = __atomic_load_n(p, __ATOMIC_RELAXED);
+	do
+	{
+		if ((old >> 9) == slot + 1)
+			val = old | (1 << 8) | data;
+		else
+			val = ((slot + 1) << 9) | data;
+	} while (!__atomic_compare_exchange_n(p, &old, val, 0,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// *** IRC reader, returns 0, 1 after timeout_ns of idle line (0 waits
+// forever), or -1 if the medium was stopped ***
+static inline int phy_sim_irc_recv(phy_sim_port_t *port, uint8_t *data, uint64_t timeout_ns)
+{
+	phy_sim_t *sim = port->sim;
+	uint64_t idle_ns = 0, now_slot, val;
+
+	while (1)
+	{
+		// *** Wait until the slot and the one after it are over ***
+		while ((now_slot = phy_sim_now_ns() / sim->byte_ns) < port->irc_cursor + 2)
+		{
+			if (sim->stop)
+				return -1;
+			sched_yield();
+		}
+
+		// *** Too slow, the ring has been reused ***
+		if (now_slot - port->irc_cursor >= PHY_SIM_IRC_SLOT - 2)
+		{
+			port->lost += now_slot - port->irc_cursor - (PHY_SIM_IRC_SLOT/2);
+			port->irc_cursor = now_slot - (PHY_SIM_IRC_SLOT/2);
+		}
+
+		val = __atomic_load_n(&sim->irc_ring[port->irc_cursor & (PHY_SIM_IRC_SLOT-1)],
+				__ATOMIC_ACQUIRE);
+		if ((val >> 9) == port->irc_cursor + 1)
+		{
+			port->irc_cursor++;
+			if (val & (1 << 8))
+				port->irc_coll++;
+			*data = (uint8_t)val;
+			return 0;
+		}
+
+		// *** Idle slot ***
+		port->irc_cursor++;
+		idle_ns += sim->byte_ns;
+		if (timeout_ns && idle_ns >= timeout_ns)
+			return 1;
+	}
+}
+
+#endif
@@ -0,0 +1,178 @@
+// ### Description #############################################################
+// Byte ring of variable-length packet records.
+//
+// Each record is a small header followed by the packet bytes. Records start
+// on a cache line and take a whole number of cache lines, so a 60-byte frame
+// uses one line instead of a 1.5 KB slot, and two records never share a line.
+// A record never wraps around the end of the ring: when it does not fit in
+// the space left before the end, that space is filled with a pad record and
+// the record starts at offset 0. The payload of a record is therefore always
+// contiguous and can be read (or written) in place:
+//
+//	producer: p = pktring_reserve(r, max); fill p; pktring_commit(r, len);
+//	consumer: p = pktring_peek(r, &len); use p; pktring_release(r);
+//
+// One producer and one consumer may run concurrently without locks. Several
+// producers (or consumers) must be serialized by the caller.
+
+#ifndef _PKTRING_H_
+#define _PKTRING_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ### Defines #################################################################
+#define PKTRING_LINE		64
+#define PKTRING_HDR			sizeof(struct pktring_hdr_t)
+#define PKTRING_PAD			0x1		// Filler up to the end of the ring
+// Bytes used by a record of len payload bytes
+#define PKTRING_REC(len)	(((len) + PKTRING_HDR + PKTRING_LINE-1) & ~(PKTRING_LINE-1))
+
+// ### Struct definitions ######################################################
+typedef struct pktring_hdr_t
+{
+	uint32_t len;					// Payload bytes
+	uint32_t flags;					// PKTRING_PAD
+} pktring_hdr_t;
+
+typedef struct pktring_t
+{
+	uint8_t *buf;					// Ring memory, cache line aligned
+	uint64_t size;					// Ring bytes, power of 2
+	// Producer and consumer positions are free-running byte counts, on
+	// separate cache lines so the two threads do not bounce one line
+	volatile uint64_t head __attribute__((aligned(PKTRING_LINE)));
+	uint64_t resv;					// Producer: offset of the reservation
+	volatile uint64_t tail __attribute__((aligned(PKTRING_LINE)));
+} pktring_t;
+
+// ### Functions ###############################################################
+// size is rounded down to a power of 2. Return -1 if memory is short.
+static inline int pktring_init(pktring_t *r, uint64_t size)
+{
+	void *buf;
+
+	while (size & (size - 1))
+		size &= size - 1;
+	if (size < PKTRING_LINE || posix_memalign(&buf, PKTRING_LINE, size) != 0)
+		return -1;
+	r->buf = (uint8_t *)buf;
+	r->size = size;
+	r->head = 0;
+	r->resv = 0;
+	r->tail = 0;
+
+	return 0;
+}
+
+static inline void pktring_free(pktring_t *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+static inline uint64_t pktring_used(pktring_t *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+			__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+// *** Producer ***
+// Reserve room for up to len payload bytes. Return the payload pointer, or
+// NULL if the ring is full. Nothing is visible until pktring_commit().
+static inline uint8_t *pktring_reserve(pktring_t *r, uint32_t len)
+{
+	uint64_t head = r->head;
+	uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	uint64_t pos = head & (r->size - 1);
+	uint64_t need = PKTRING_REC(len);
+	uint64_t left = r->size - pos;
+	pktring_hdr_t *pad;
+
+	// *** Not enough room before the end, pad it and start over at 0 ***
+	if (need > left)
+	{
+		if (r->size - (head - tail) < left + need)
+			return NULL;
+		pad = (pktring_hdr_t *)(r->buf + pos);
+		pad->len = left - PKTRING_HDR;
+		pad->flags = PKTRING_PAD;
+		__atomic_store_n(&r->head, head + left, __ATOMIC_RELEASE);
+		pos = 0;
+	}
+	else if (r->size - (head - tail) < need)
+	{
+		return NULL;
+	}
+
+	r->resv = pos;
+	return r->buf + pos + PKTRING_HDR;
+}
+
+// Publish the reservation with its final length (not more than reserved)
+static inline void pktring_commit(pktring_t *r, uint32_t len)
+{
+	pktring_hdr_t *hdr = (pktring_hdr_t *)(r->buf + r->resv);
+
+	hdr->len = len;
+	hdr->flags = 0;
+	__atomic_store_n(&r->head, r->head + PKTRING_REC(len), __ATOMIC_RELEASE);
+}
+
+static inline int pktring_push(pktring_t *r, const uint8_t *data, uint32_t len)
+{
+	uint8_t *p = pktring_reserve(r, len);
+
+	if (p == NULL)
+		return -1;
+	memcpy(p, data, len);
+	pktring_commit(r, len);
+
+	return 0;
+}
+
+// *** Consumer ***
+// Return the payload of the oldest record and its length, or NULL if empty.
+// The record stays in the ring until pktring_release().
+static inline uint8_t *pktring_peek(pktring_t *r, uint32_t *len)
+{
+	uint64_t tail = r->tail;
+	pktring_hdr_t *hdr;
+
+	while (tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+	{
+		hdr = (pktring_hdr_t *)(r->buf + (tail & (r->size - 1)));
+		if (!(hdr->flags & PKTRING_PAD))
+		{
+			*len = hdr->len;
+			return (uint8_t *)(hdr + 1);
+		}
+		// *** Skip the pad at the end of the ring ***
+		tail += hdr->len + PKTRING_HDR;
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static inline void pktring_release(pktring_t *r)
+{
+	pktring_hdr_t *hdr = (pktring_hdr_t *)(r->buf + (r->tail & (r->size - 1)));
+
+	__atomic_store_n(&r->tail, r->tail + PKTRING_REC(hdr->len), __ATOMIC_RELEASE);
+}
+
+static inline int pktring_pop(pktring_t *r, uint8_t *data, uint32_t *len)
+{
+	uint8_t *p = pktring_peek(r, len);
+
+	if (p == NULL)
+		return -1;
+	memcpy(data, p, *len);
+	pktring_release(r);
+
+	return 0;
+}
+
+#endif
@@ -5,26 +5,35 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
-#include "irc_payload.h"
+#include "prbs.h"
 
-// Not used. Use CLI argument.
+// Not used. Use CLI argument. NUM_DATA = 0 receives until killed.
 // #define NUM_DATA    100
 
+// Default test sequence
+#define PRBS_ORDER_DEFAULT  31
+// Print intermediate results every this many bytes
+#define REPORT_EVERY        100000
+
 static volatile uint32_t *ircrx_p;
 int NUM_DATA = 0;
-uint32_t rx_data[100000];
-uint32_t total_bit_error = 0;
+int PRBS_ORDER = PRBS_ORDER_DEFAULT;
+prbs_chk_t prbs_chk;
+
+void print_result(void);
 
 int main(int argc, char *argv[])
 {
     int fd;
 
     // *** Get NUM_DATA ***
-    if (argc == 2)
+    if (argc == 2 || argc == 3)
     {
         NUM_DATA = atoi(argv[1]);
+        if (argc == 3)
+            PRBS_ORDER = atoi(argv[2]);
     }
-    else if (argc > 2)
+    else if (argc > 3)
     {
         printf("Error: Too many arguments supplied.\n");
         return -1;
@@ -32,6 +41,14 @@ int main(int argc, char *argv[])
     else
     {
         printf("Error: One argument expected (number of IRC data).\n");
+        printf("Usage: %s NUM_DATA [PRBS_ORDER]\n", argv[0]);
+        return -1;
+    }
+
+    // *** PRBS checker ***
+    if (prbs_chk_init(&prbs_chk, PRBS_ORDER) < 0)
+    {
+        printf("Error: PRBS order must be 7, 15, 23 or 31.\n");
         return -1;
     }
 
@@ -45,27 +62,24 @@ int main(int argc, char *argv[])
     ircrx_p = (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE,
             MAP_SHARED, fd, 0x41000000);
 
-    // *** Receive IRC data ***
-    for (int i = 0; i < NUM_DATA; i++)
+    // *** Receive IRC data and calculate BER on the fly ***
+    for (int i = 0; (NUM_DATA == 0) || (i < NUM_DATA); i++)
     {
         // Wait until ready flag is one
         while (!(*(ircrx_p+0) & (1 << 16)));
         // Read data from IRC RX register
-        rx_data[i] =  *(ircrx_p+1);
+        prbs_check(&prbs_chk, *(ircrx_p+1), 8);
+        if ((i+1) % REPORT_EVERY == 0)
+            print_result();
     }
-
-    // *** Calculate BER ***
-    for (int i = 0; i < NUM_DATA; i++)
-    {
-        for (int j = 0; j < 8; j++)
-        {
-            if ((rx_data[i] & (1 << j)) != (irc_data[i] & (1 << j)))
-            {
-                total_bit_error++;
-            }
-        }
-    }
-    printf("Total bit error: %d\n", total_bit_error);
+    print_result();
 
     return 0;
 }
+
+void print_result(void)
+{
+    printf("Total bit: %llu, total bit error: %llu, BER: %4.6e, resync: %u, discarded bit: %llu\n",
+            (unsigned long long)prbs_chk.bits, (unsigned long long)prbs_chk.errors,
+            prbs_ber(&prbs_chk), prbs_chk.resync, (unsigned long long)prbs_chk.hunt_bits);
+}
@@ -6,24 +6,30 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <time.h>
-#include "irc_payload.h"
+#include "prbs.h"
 
-// Not used. Use CLI argument.
+// Not used. Use CLI argument. NUM_DATA = 0 transmits until killed.
 // #define NUM_DATA    100
 
+// Default test sequence
+#define PRBS_ORDER_DEFAULT  31
+
 static volatile uint32_t *irctx_p;
 int NUM_DATA = 0;
+int PRBS_ORDER = PRBS_ORDER_DEFAULT;
 
 int main(int argc, char *argv[])
 {
     int fd;
 
    // *** Get NUM_DATA ***
-    if (argc == 2)
+    if (argc == 2 || argc == 3)
     {
         NUM_DATA = atoi(argv[1]);
+        if (argc == 3)
+            PRBS_ORDER = atoi(argv[2]);
     }
-    else if (argc > 2)
+    else if (argc > 3)
     {
         printf("Error: Too many arguments supplied.\n");
         return -1;
@@ -31,6 +37,15 @@ int main(int argc, char *argv[])
     else
     {
         printf("Error: One argument expected (number of IRC data).\n");
+        printf("Usage: %s NUM_DATA [PRBS_ORDER]\n", argv[0]);
+        return -1;
+    }
+
+    // *** PRBS payload ***
+    prbs_t prbs;
+    if (prbs_init(&prbs, PRBS_ORDER, 0) < 0)
+    {
+        printf("Error: PRBS order must be 7, 15, 23 or 31.\n");
         return -1;
     }
 
@@ -45,13 +60,14 @@ int main(int argc, char *argv[])
             MAP_SHARED, fd, 0x43000000);
 
     // *** Transmit IRC data ***
-    for (int i = 0; i < NUM_DATA; i++)
+    for (int i = 0; (NUM_DATA == 0) || (i < NUM_DATA); i++)
     {
         // Write data to IRC TX register
-        *(irctx_p+1) = irc_data[i];
+        *(irctx_p+1) = prbs_bits(&prbs, 8);
         // Wait until busy flag is zero
         while ((*(irctx_p+0) & (1 << 17)));
     }
+    printf("%d IRC data transmitted (PRBS-%d)\n", NUM_DATA, PRBS_ORDER);
 
     return 0;
 }
@@ -0,0 +1,179 @@
+#ifndef _PRBS_H_
+#define _PRBS_H_
+
+// ### Description #############################################################
+// Word-parallel PRBS-7/15/23/31 generator and a self-synchronizing streaming
+// checker. Both use constant memory, so BER runs are not limited by a payload
+// table or a receive buffer.
+//
+// The sequences follow the ITU-T O.150 polynomials:
+//   PRBS-7  = x^7  + x^6  + 1
+//   PRBS-15 = x^15 + x^14 + 1
+//   PRBS-23 = x^23 + x^18 + 1
+//   PRBS-31 = x^31 + x^28 + 1
+// i.e. b[t] = b[t-m] ^ b[t-n]. Bits are produced MSB first: the oldest bit of
+// a prbs_bits() result is its highest bit.
+//
+// Because b[t] only depends on bits at least m steps back, up to m new bits
+// can be computed at once from the history register with two shifts and an
+// XOR. A 32-bit word therefore costs 2 (PRBS-31, PRBS-23), 3 (PRBS-15) or
+// 6 (PRBS-7) steps instead of 32.
+
+#include <stdint.h>
+
+// *** Checker ***
+// A chunk with more than 1/PRBS_BAD_DIV bit errors is suspicious. Misaligned
+// PRBS data gives about 1/2, a noisy but aligned link much less.
+#define PRBS_BAD_DIV        4
+// Consecutive suspicious chunks before sync is declared lost
+#define PRBS_LOS_CHUNKS     2
+
+typedef struct prbs_t
+{
+    uint64_t state;         // Last generated bits, most recent in bit 0
+    uint8_t n;              // Polynomial order
+    uint8_t m;              // Second tap
+} prbs_t;
+
+typedef struct prbs_chk_t
+{
+    prbs_t gen;             // Local copy of the generator
+    uint64_t hist;          // Last received bits, most recent in bit 0
+    uint32_t hist_bits;     // Number of valid bits in hist
+    uint8_t locked;         // Generator is aligned to the received stream
+    uint8_t bad;            // Consecutive suspicious chunks
+    uint64_t pend_bits;     // Bits of suspicious chunks not yet counted
+    uint64_t pend_err;      // Errors of suspicious chunks not yet counted
+    uint64_t bits;          // Bits compared while locked
+    uint64_t errors;        // Bit errors while locked
+    uint64_t hunt_bits;     // Bits discarded while (re)acquiring sync
+    uint32_t resync;        // Number of times sync was lost
+} prbs_chk_t;
+
+// *** Generator ***
+static inline int prbs_init(prbs_t *p, int order, uint32_t seed)
+{
+    int ret = 0;
+
+    // Unknown orders fall back to PRBS-31 so the state is always usable
+    switch (order)
+    {
+        case 7:  p->n = 7;  p->m = 6;  break;
+        case 15: p->n = 15; p->m = 14; break;
+        case 23: p->n = 23; p->m = 18; break;
+        case 31: p->n = 31; p->m = 28; break;
+        default: p->n = 31; p->m = 28; ret = -1; break;
+    }
+    // All-zero state is the only one the LFSR never leaves
+    p->state = seed & ((1ULL << p->n) - 1);
+    if (p->state == 0)
+        p->state = (1ULL << p->n) - 1;
+
+    return ret;
+}
+
+// Return the next nbits (1 - 32) of the sequence in the low bits
+static inline uint32_t prbs_bits(prbs_t *p, int nbits)
+{
+    uint64_t h = p->state;
+    int left = nbits;
+
+    while (left > 0)
+    {
+        int c = (left < p->m) ? left : p->m;
+        uint64_t nb = ((h >> (p->m - c)) ^ (h >> (p->n - c))) & ((1ULL << c) - 1);
+        h = (h << c) | nb;
+        left -= c;
+    }
+    p->state = h;
+
+    return (uint32_t)(h & ((1ULL << nbits) - 1));
+}
+
+static inline uint32_t prbs_word(prbs_t *p)
+{
+    return prbs_bits(p, 32);
+}
+
+// *** Checker ***
+static inline int prbs_chk_init(prbs_chk_t *c, int order)
+{
+    int ret = prbs_init(&c->gen, order, 0);
+
+    c->hist = 0;
+    c->hist_bits = 0;
+    c->locked = 0;
+    c->bad = 0;
+    c->pend_bits = 0;
+    c->pend_err = 0;
+    c->bits = 0;
+    c->errors = 0;
+    c->hunt_bits = 0;
+    c->resync = 0;
+
+    return ret;
+}
+
+// Check the next nbits (1 - 32) received bits, given in the low bits of rx
+static inline void prbs_check(prbs_chk_t *c, uint32_t rx, int nbits)
+{
+    uint32_t mask = (uint32_t)((1ULL << nbits) - 1);
+    uint32_t exp;
+    int err;
+
+    rx &= mask;
+    c->hist = (c->hist << nbits) | rx;
+    if (c->hist_bits < 64)
+        c->hist_bits += nbits;
+
+    // *** Acquire: any n error-free received bits determine the sequence ***
+    if (!c->locked)
+    {
+        c->hunt_bits += nbits;
+        if (c->hist_bits >= c->gen.n)
+        {
+            c->gen.state = c->hist;
+            c->locked = 1;
+            c->bad = 0;
+        }
+        return;
+    }
+
+    // *** Compare with the local generator ***
+    exp = prbs_bits(&c->gen, nbits);
+    err = __builtin_popcount(exp ^ rx);
+
+    if (err * PRBS_BAD_DIV > nbits)
+    {
+        // *** Suspicious, hold the errors until we know if we are misaligned ***
+        c->pend_bits += nbits;
+        c->pend_err += err;
+        if (++c->bad >= PRBS_LOS_CHUNKS)
+        {
+            // *** Sync lost (symbols dropped or inserted), re-align on the
+            // received history. If that history holds errors the next chunks
+            // are suspicious again and we simply re-align once more. ***
+            c->gen.state = c->hist;
+            c->hunt_bits += c->pend_bits;
+            c->pend_bits = 0;
+            c->pend_err = 0;
+            c->bad = 0;
+            c->resync++;
+        }
+        return;
+    }
+
+    // *** Good chunk, the held chunks were an error burst, not a slip ***
+    c->bits += c->pend_bits + nbits;
+    c->errors += c->pend_err + err;
+    c->pend_bits = 0;
+    c->pend_err = 0;
+    c->bad = 0;
+}
+
+static inline double prbs_ber(prbs_chk_t *c)
+{
+    return c->bits ? ((double)c->errors / c->bits) : 0.0;
+}
+
+#endif
@@ -5,27 +5,63 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
-#include "vlc_payload.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include "prbs.h"
+#include "vlc_search.h"
 
-// Not used. Use CLI argument.
+// Not used. Use CLI argument. NUM_DATA = 0 receives until killed.
 // #define NUM_DATA    100000
 
+// Default test sequence
+#define PRBS_ORDER_DEFAULT  31
+// Print intermediate results every this many symbols
+#define REPORT_EVERY        100000
+
+// *** Rate search ***
+// A round ends when no symbol arrived for this long
+#define SEARCH_IDLE_MS      50
+// ... or, before the first symbol, for this long
+#define SEARCH_FIRST_MS     1000
+
 static volatile uint32_t *vlcrx_p;
 
 int NUM_DATA = 0;
-uint32_t rx_data[400000];
-uint32_t total_bit_error = 0;
+int SEARCH = 0;
+int MOD_TYPE = 2;
+int PRBS_ORDER = PRBS_ORDER_DEFAULT;
+prbs_chk_t prbs_chk;
+
+uint64_t now_ns(void);
+int search(void);
+void prbs_sym_check(uint32_t *data, int mod_type);
+void print_result(void);
 
 int main(int argc, char *argv[])
 {
 	int fd;
 
-    // *** Get NUM_DATA ***
-	if (argc == 2)
+    // *** Get NUM_DATA, MOD_TYPE and PRBS_ORDER, or search mode ***
+	if (argc == 2 && strcmp(argv[1], "search") == 0)
+	{
+		SEARCH = 1;
+	}
+	else if (argc >= 2 && argc <= 4)
 	{
 		NUM_DATA = atoi(argv[1]);
+		if (argc >= 3)
+			MOD_TYPE = atoi(argv[2]);
+		if (argc >= 4)
+			PRBS_ORDER = atoi(argv[3]);
+		if (MOD_TYPE < 0 || MOD_TYPE > 2)
+		{
+			printf("Error: Modulation mode must be 0 (BPSK), 1 (QPSK) or 2 (QAM-16).\n");
+			return -1;
+		}
 	}	
-	else if (argc > 2)
+	else if (argc > 4)
 	{
 		printf("Error: Too many arguments supplied.\n");
 		return -1;
@@ -33,6 +69,15 @@ int main(int argc, char *argv[])
 	else
 	{
 		printf("Error: One argument expected (number of OFDM symbol).\n");
+		printf("Usage: %s NUM_DATA [MOD_TYPE [PRBS_ORDER]]\n", argv[0]);
+		printf("       %s search\n", argv[0]);
+		return -1;
+	}
+
+	// *** PRBS checker ***
+	if (prbs_chk_init(&prbs_chk, PRBS_ORDER) < 0)
+	{
+		printf("Error: PRBS order must be 7, 15, 23 or 31.\n");
 		return -1;
 	}
 
@@ -46,40 +91,139 @@ int main(int argc, char *argv[])
 	vlcrx_p = (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE,
 			MAP_SHARED, fd, 0x42000000);
 
-    // *** 16-QAM demodulation ***
-    *(vlcrx_p+0) = 0x2;
+	// *** Answer rate search rounds from vlc_tx ***
+	if (SEARCH)
+		return search();
+
+    // *** Demodulation ***
+    *(vlcrx_p+0) = MOD_TYPE;
+    int num_words = (MOD_TYPE == 0) ? 1 : ((MOD_TYPE == 1) ? 2 : 4);
 
-	// *** Receive data ***
-    for (int i = 0; i < NUM_DATA; i++)
+	// *** Receive data and calculate BER on the fly ***
+    uint32_t data[4];
+    int i;
+    for (i = 0; (NUM_DATA == 0) || (i < NUM_DATA); i++)
     {
         // Wait until ready flag is one
         while (!(*(vlcrx_p+0) & (1 << 2)));
-		// printf("Rx data: %d | \t", i);
-        for (int j = 0; j < 4; j++)
+        for (int j = 0; j < num_words; j++)
 		{
             // Read data from VLC RX register
-			rx_data[i*4+j] = *(vlcrx_p+4+j);
-            // printf("0x%08X ", rx_data[i*4+j]);
+			data[j] = *(vlcrx_p+4+j);
 		}
-        // printf("\n");
+        prbs_sym_check(data, MOD_TYPE);
+        if ((i+1) % REPORT_EVERY == 0)
+            print_result();
     }
-    printf("%d OFDM symbols received\n", NUM_DATA);
+    printf("%d OFDM symbols received\n", i);
+	print_result();
+	
+    return 0;
+}
 
-	// *** Calculate BER ***
-	for (int i = 0; i < NUM_DATA; i++)
+void prbs_sym_check(uint32_t *data, int mod_type)
+{
+	// *** Check the payload bits of one symbol (31, 62 or 124), MSB first ***
+	int payload_bit = (mod_type == 0) ? 31 : ((mod_type == 1) ? 62 : 124);
+
+	for (int j = 0; payload_bit > 0; j++)
 	{
-		for (int j = 0; j < 4; j++)
+		int nbits = (payload_bit > 32) ? 32 : payload_bit;
+		prbs_check(&prbs_chk, data[j] >> (32 - nbits), nbits);
+		payload_bit -= nbits;
+	}
+}
+
+void print_result(void)
+{
+	printf("Total bit: %llu, total bit error: %llu, BER: %4.6e, resync: %u, discarded bit: %llu\n",
+			(unsigned long long)prbs_chk.bits, (unsigned long long)prbs_chk.errors,
+			prbs_ber(&prbs_chk), prbs_chk.resync, (unsigned long long)prbs_chk.hunt_bits);
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int search(void)
+{
+	struct sockaddr_in addr, tx_addr;
+	socklen_t tx_addr_len;
+	search_msg_t msg;
+	int fd_sock;
+
+	// *** Control socket, vlc_tx connects to us ***
+	fd_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd_sock < 0)
+	{
+		printf("Socket create error\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(SEARCH_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("Couldn't bind search port");
+		return -1;
+	}
+	printf("Waiting for vlc_tx on UDP port %d\n", SEARCH_PORT);
+
+	while (1)
+	{
+		// *** Wait for the next round ***
+		tx_addr_len = sizeof(tx_addr);
+		if (recvfrom(fd_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&tx_addr, &tx_addr_len) != sizeof(msg))
+			continue;
+		if (ntohl(msg.cmd) == SEARCH_STOP)
+			break;
+		if (ntohl(msg.cmd) != SEARCH_START)
+			continue;
+		uint32_t mod_type = ntohl(msg.mod_type);
+		uint32_t num_sym = ntohl(msg.num_sym);
+
+		// *** Demodulation, the last data word read clears the ready flag ***
+		*(vlcrx_p+0) = mod_type;
+		int last_word = (mod_type == 0) ? 0 : ((mod_type == 1) ? 1 : 3);
+
+		// *** Flush a symbol left over from the previous round ***
+		if (*(vlcrx_p+0) & (1 << 2))
+			(void)*(vlcrx_p+4+last_word);
+
+		msg.cmd = htonl(SEARCH_READY);
+		sendto(fd_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&tx_addr, tx_addr_len);
+
+		// *** Count symbols until the round is complete or the link goes idle ***
+		uint32_t num_rx = 0;
+		uint64_t idle_ns = (uint64_t)SEARCH_FIRST_MS * 1000000ULL;
+		uint64_t t_last = now_ns();
+		while (num_rx < num_sym)
 		{
-			for (int k = 0; k < 32; k++)
+			if (*(vlcrx_p+0) & (1 << 2))
 			{
-				if ((rx_data[i*4+j] & (1 << k)) != (vlc_data[i*4+j] & (1 << k)))
-				{
-					total_bit_error++;
-				}
+				(void)*(vlcrx_p+4+last_word);
+				num_rx++;
+				t_last = now_ns();
+				idle_ns = (uint64_t)SEARCH_IDLE_MS * 1000000ULL;
+			}
+			else if (now_ns() - t_last > idle_ns)
+			{
+				break;
 			}
 		}
+
+		// *** Report ***
+		msg.cmd = htonl(SEARCH_RESULT);
+		msg.num_rx = htonl(num_rx);
+		sendto(fd_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&tx_addr, tx_addr_len);
+		printf("Mod: %u, received: %u/%u\n", mod_type, num_rx, num_sym);
 	}
-	printf("Total bit error: %d\n", total_bit_error);
-	
-    return 0;
+
+	close(fd_sock);
+	return 0;
 }
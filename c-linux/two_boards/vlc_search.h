@@ -0,0 +1,24 @@
+#ifndef _VLC_SEARCH_H_
+#define _VLC_SEARCH_H_
+
+// *** Rate search control channel between vlc_tx and vlc_rx ***
+// vlc_tx sends SEARCH_START with the modulation and the number of symbols of
+// the round, vlc_rx configures its demodulator and answers SEARCH_READY. After
+// the round vlc_rx answers SEARCH_RESULT with the number of symbols received.
+// SEARCH_STOP ends the vlc_rx search loop. All fields are in network order.
+#define SEARCH_PORT         5005
+
+#define SEARCH_START        1
+#define SEARCH_READY        2
+#define SEARCH_RESULT       3
+#define SEARCH_STOP         4
+
+typedef struct search_msg_t
+{
+    uint32_t cmd;           // SEARCH_*
+    uint32_t mod_type;      // 0 = BPSK, 1 = QPSK, 2 = QAM-16
+    uint32_t num_sym;       // Symbols sent in this round
+    uint32_t num_rx;        // Symbols received in this round (SEARCH_RESULT)
+} search_msg_t;
+
+#endif
@@ -5,25 +5,78 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <time.h>
-#include "vlc_payload.h"
+#include "prbs.h"
+#include "vlc_search.h"
 
-// Not used. Use CLI argument.
+// Not used. Use CLI argument. NUM_DATA = 0 transmits until killed.
 // #define NUM_DATA    100000
 
+// Default test sequence
+#define PRBS_ORDER_DEFAULT  31
+
+// *** Pacing ***
+// Default target symbol rate, close to the old fixed 37.5 us inter-symbol gap
+#define SYM_RATE_DEFAULT    12000
+// The last part before each deadline is spun instead of slept, because
+// clock_nanosleep wake-up latency is much larger than the symbol jitter we want
+#define SPIN_NS             20000
+
+// *** Rate search ***
+#define SEARCH_SYM          5000        // Symbols per round
+#define SEARCH_RATE_START   5000        // First round symbol rate
+#define SEARCH_STEP_DIV     50          // Each round shortens the period by 1/50
+#define SEARCH_STEP_MIN_NS  250         // ... but at least by this much
+#define SEARCH_REPLY_MS     2000        // Time to wait for vlc_rx to answer
+
 int NUM_DATA = 0;
+int MOD_TYPE = 2;
+int SEARCH = 0;
+uint32_t SYM_RATE = SYM_RATE_DEFAULT;
+int PRBS_ORDER = PRBS_ORDER_DEFAULT;
 static volatile uint32_t *vlctx_p;
+prbs_t prbs;
+
+// *** Pacing state ***
+uint64_t deadline_ns;
+uint32_t num_late = 0;
+
+uint64_t now_ns(void);
+void pace_start(void);
+void pace_wait(uint32_t period_ns);
+void vlc_config(int mod_type);
+void send_sym(uint32_t *data, int num_words);
+void prbs_sym(uint32_t *data, int mod_type);
+int search(char *rx_ip);
 
 int main(int argc, char *argv[])
 {
     int fd;
 
-    // *** Get NUM_DATA ***
-    if (argc == 2)
+    // *** Get NUM_DATA, MOD_TYPE, SYM_RATE and PRBS_ORDER, or search mode ***
+    if (argc == 3 && strcmp(argv[1], "search") == 0)
+    {
+        SEARCH = 1;
+    }
+    else if (argc >= 2 && argc <= 5)
     {
         NUM_DATA = atoi(argv[1]);
-    }	
-    else if (argc > 2)
+        if (argc >= 3)
+            MOD_TYPE = atoi(argv[2]);
+        if (argc >= 4)
+            SYM_RATE = atoi(argv[3]);
+        if (argc >= 5)
+            PRBS_ORDER = atoi(argv[4]);
+        if (MOD_TYPE < 0 || MOD_TYPE > 2)
+        {
+            printf("Error: Modulation mode must be 0 (BPSK), 1 (QPSK) or 2 (QAM-16).\n");
+            return -1;
+        }
+    }
+    else if (argc > 5)
     {
         printf("Error: Too many arguments supplied.\n");
         return -1;
@@ -31,6 +84,15 @@ int main(int argc, char *argv[])
     else
     {
         printf("Error: One argument expected (number of OFDM symbol).\n");
+        printf("Usage: %s NUM_DATA [MOD_TYPE [SYM_RATE [PRBS_ORDER]]]\n", argv[0]);
+        printf("       %s search RX_IP\n", argv[0]);
+        return -1;
+    }
+
+    // *** PRBS payload ***
+    if (prbs_init(&prbs, PRBS_ORDER, 0) < 0)
+    {
+        printf("Error: PRBS order must be 7, 15, 23 or 31.\n");
         return -1;
     }
 
@@ -44,27 +106,202 @@ int main(int argc, char *argv[])
     vlctx_p = (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE,
             MAP_SHARED, fd, 0x40000000);
 
-    // *** 16-QAM modulation and guard interval ***
-    *(vlctx_p+0) = 0x122;
+    // *** Search maximum sustainable symbol rate ***
+    if (SEARCH)
+        return search(argv[2]);
+
+    // *** Modulation and guard interval ***
+    vlc_config(MOD_TYPE);
+    int num_words = (MOD_TYPE == 0) ? 1 : ((MOD_TYPE == 1) ? 2 : 4);
+    uint32_t period_ns = (SYM_RATE > 0) ? (1000000000UL / SYM_RATE) : 0;
 
     // *** Send data ***
-    for (int i = 0; i < NUM_DATA; i++)
+    uint32_t data[4];
+    uint64_t t_start = now_ns();
+    pace_start();
+    for (int i = 0; (NUM_DATA == 0) || (i < NUM_DATA); i++)
+    {
+        prbs_sym(data, MOD_TYPE);
+        // Wait for the deadline of this symbol
+        pace_wait(period_ns);
+        send_sym(data, num_words);
+    }
+    uint64_t t_end = now_ns();
+    printf("%d OFDM symbols transmitted\n", NUM_DATA);
+    printf("Target rate: %u sym/s, actual rate: %.1f sym/s, late symbols: %u\n",
+            SYM_RATE, NUM_DATA / ((t_end - t_start) / 1e9), num_late);
+
+    return 0;
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void pace_start(void)
+{
+    deadline_ns = now_ns();
+}
+
+void pace_wait(uint32_t period_ns)
+{
+    uint64_t now;
+
+    // *** Next absolute deadline ***
+    deadline_ns += period_ns;
+    now = now_ns();
+
+    // *** Behind schedule, do not burst to catch up ***
+    if (now >= deadline_ns)
+    {
+        if (period_ns)
+            num_late++;
+        deadline_ns = now;
+        return;
+    }
+
+    // *** Sleep until shortly before the deadline ***
+    if (deadline_ns - now > SPIN_NS)
+    {
+        struct timespec tim;
+        uint64_t wake = deadline_ns - SPIN_NS;
+        tim.tv_sec = wake / 1000000000ULL;
+        tim.tv_nsec = wake % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL);
+    }
+
+    // *** Spin the rest ***
+    while (now_ns() < deadline_ns);
+}
+
+void vlc_config(int mod_type)
+{
+    // *** Modulation and guard interval ***
+    *(vlctx_p+0) = 0x120 | mod_type;
+}
+
+void send_sym(uint32_t *data, int num_words)
+{
+    for (int j = 0; j < num_words; j++)
+    {
+        // Write data to VLC TX register
+        *(vlctx_p+4+j) = data[j];
+    }
+    // Wait until busy flag is zero
+    while ((*(vlctx_p+0) & (1 << 10)));
+}
+
+void prbs_sym(uint32_t *data, int mod_type)
+{
+    // *** Fill the payload bits of one symbol (31, 62 or 124), MSB first ***
+    int payload_bit = (mod_type == 0) ? 31 : ((mod_type == 1) ? 62 : 124);
+
+    for (int j = 0; payload_bit > 0; j++)
+    {
+        int nbits = (payload_bit > 32) ? 32 : payload_bit;
+        data[j] = (nbits == 32) ? prbs_word(&prbs) : (prbs_bits(&prbs, nbits) << (32 - nbits));
+        payload_bit -= nbits;
+    }
+}
+
+int search(char *rx_ip)
+{
+    const char *mod_name[3] = {"BPSK", "QPSK", "QAM-16"};
+    uint32_t best_rate[3] = {0};
+    struct sockaddr_in rx_addr;
+    struct timeval tv;
+    search_msg_t msg;
+    int fd_sock;
+
+    // *** Control socket to vlc_rx ***
+    fd_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd_sock < 0)
     {
-        // printf("Tx data: %d | \t", i);
-        for (int j = 0; j < 4; j++)
+        printf("Socket create error\n");
+        return -1;
+    }
+    tv.tv_sec = SEARCH_REPLY_MS / 1000;
+    tv.tv_usec = (SEARCH_REPLY_MS % 1000) * 1000;
+    setsockopt(fd_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&rx_addr, 0, sizeof(rx_addr));
+    rx_addr.sin_family = AF_INET;
+    rx_addr.sin_port = htons(SEARCH_PORT);
+    rx_addr.sin_addr.s_addr = inet_addr(rx_ip);
+
+    for (int mod = 0; mod <= 2; mod++)
+    {
+        int num_words = (mod == 0) ? 1 : ((mod == 1) ? 2 : 4);
+        uint32_t period_ns = 1000000000UL / SEARCH_RATE_START;
+        uint32_t data[4];
+
+        printf("=========================== %s ===========================\n", mod_name[mod]);
+        vlc_config(mod);
+
+        while (period_ns > 0)
         {
-            // Write data to VLC TX register
-            *(vlctx_p+4+j) = vlc_data[i*4+j];
-            // Wait until busy flag is zero
-            while ((*(vlctx_p+0) & (1 << 10)));
-            // printf("0x%08X ", vlc_data[i*4+j]);
+            // *** Announce the round ***
+            msg.cmd = htonl(SEARCH_START);
+            msg.mod_type = htonl(mod);
+            msg.num_sym = htonl(SEARCH_SYM);
+            msg.num_rx = 0;
+            sendto(fd_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr));
+            if (recv(fd_sock, &msg, sizeof(msg), 0) != sizeof(msg) || ntohl(msg.cmd) != SEARCH_READY)
+            {
+                printf("Error: vlc_rx is not answering.\n");
+                return -1;
+            }
+
+            // *** Send one round at the current period ***
+            num_late = 0;
+            uint64_t t_start = now_ns();
+            pace_start();
+            for (int i = 0; i < SEARCH_SYM; i++)
+            {
+                prbs_sym(data, mod);
+                pace_wait(period_ns);
+                send_sym(data, num_words);
+            }
+            uint64_t t_end = now_ns();
+
+            // *** Get the result ***
+            uint32_t num_rx = 0;
+            if (recv(fd_sock, &msg, sizeof(msg), 0) == sizeof(msg) && ntohl(msg.cmd) == SEARCH_RESULT)
+                num_rx = ntohl(msg.num_rx);
+            double rate = SEARCH_SYM / ((t_end - t_start) / 1e9);
+            printf("Period: %6u ns, rate: %8.1f sym/s, late: %5u, received: %u/%u\n",
+                    period_ns, rate, num_late, num_rx, SEARCH_SYM);
+
+            // *** Stop at the first loss ***
+            if (num_rx < SEARCH_SYM)
+                break;
+            best_rate[mod] = (uint32_t)rate;
+
+            // *** TX cannot go faster, PHY busy flag is the limit ***
+            if (num_late > SEARCH_SYM / 2)
+                break;
+
+            // *** Shorten the gap ***
+            uint32_t step = period_ns / SEARCH_STEP_DIV;
+            if (step < SEARCH_STEP_MIN_NS)
+                step = SEARCH_STEP_MIN_NS;
+            period_ns = (period_ns > step) ? (period_ns - step) : 0;
         }
-        // printf("\n");
-        // Wait
-        struct timespec tim;
-        tim.tv_sec = 0;
-        tim.tv_nsec = 37500;
-        nanosleep(&tim, NULL);
     }
-    printf("%d OFDM symbols transmitted\n", NUM_DATA);
+
+    // *** Tell vlc_rx we are done ***
+    msg.cmd = htonl(SEARCH_STOP);
+    sendto(fd_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr));
+    close(fd_sock);
+
+    // *** Print results ***
+    printf("=================== Max sustainable symbol rate ===================\n");
+    for (int mod = 0; mod <= 2; mod++)
+        printf("%-6s: %u sym/s\n", mod_name[mod], best_rate[mod]);
+    printf("===================================================================\n");
+
+    return 0;
 }
@@ -2,13 +2,18 @@
 // Date  : 11 Mar 2018
 // Update: 26 Sep 2018 - Porting to RedPitaya
 //         07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add rx data done interrupt
+//         19 Oct 2026 - Add byte FIFO, packed 4-byte reads, level and overflow
+//                       count registers
+//         19 Oct 2026 - Add line coding mode
 
 `timescale 1ns / 1ps
 
 module axi_ircrx_control
 	#(
         C_ADDR_WIDTH = 32,
-        C_DATA_WIDTH = 32
+        C_DATA_WIDTH = 32,
+        C_FIFO_BITS = 11                // FIFO depth = 2^C_FIFO_BITS bytes
     )
 	(
         // *** Clock and reset signals ***
@@ -37,21 +42,38 @@ module axi_ircrx_control
         input  wire [7:0]                s_axis_tdata,
         input  wire                      s_axis_tvalid,
         // *** User signals ***
-        output wire [15:0]               mod_m
+        output wire [15:0]               mod_m,
+        output wire [1:0]                irc_mode,
+        // *** Interrupt, level, high while enabled and done ***
+        output wire                      irq
     );
 
     // *** Register map ***
     // 0x00: baud rate divisor and rx data done
-    //       bit 15~0 = baud[15:0] (R/W)
-    //       bit 16   = done_reg (R)
-    // 0x04: uart rx data register  
+    //       bit 15~0  = baud[15:0] (R/W), slot tick divisor of mode 1 and 2
+    //       bit 16    = done_reg (R), a byte is in the FIFO
+    //       bit 21~20 = irc_mode[1:0] (R/W), 0: UART, 1: Manchester, 2: 4-PPM
+    // 0x04: uart rx data register, a read takes one byte
     //       bit 7~0 = rxdr_reg[7:0] (R)
-    // 0x08: reserved
-    // 0x0c: reserved
-	localparam C_ADDR_BITS = 4;
+    // 0x08: interrupt enable
+    //       bit 0 = done (R/W)
+    // 0x0c: packed rx data register, a read takes up to 4 bytes, bit 7~0
+    //       first, bytes past the level are undefined
+    //       bit 31~0 = rxdr4[31:0] (R)
+    // 0x10: FIFO level
+    //       bit 15~0  = bytes queued (R)
+    //       bit 31~16 = FIFO depth in bytes (R)
+    // 0x14: overflow count
+    //       bit 31~0 = bytes dropped with the FIFO full (R), write clears
+	localparam C_ADDR_BITS = 5;
+	localparam [15:0] C_FIFO_DEPTH = 1 << C_FIFO_BITS;
 	// *** Address ***
-	localparam C_ADDR_CTRL = 4'h0,
-			   C_ADDR_RXDR = 4'h4;
+	localparam C_ADDR_CTRL = 5'h00,
+			   C_ADDR_RXDR = 5'h04,
+			   C_ADDR_IRQE = 5'h08,
+			   C_ADDR_RXD4 = 5'h0c,
+			   C_ADDR_LVL  = 5'h10,
+			   C_ADDR_OVF  = 5'h14;
 	// *** AXI write FSM ***
 	localparam S_WRIDLE = 2'd0,
 			   S_WRDATA = 2'd1,
@@ -59,9 +81,6 @@ module axi_ircrx_control
 	// *** AXI read FSM ***
 	localparam S_RDIDLE = 2'd0,
 			   S_RDDATA = 2'd1;
-    // *** AXIS s2mm FSM ***
-    localparam S_S2MM_IDLE = 2'h0,
-               S_S2MM_DONE = 2'h1;
 
     // *** AXI write ***
 	reg [1:0] wstate_cs, wstate_ns;
@@ -75,11 +94,22 @@ module axi_ircrx_control
 	wire ar_hs;
 	// *** Internal registers ***
 	reg [15:0] ctrl_reg;
-    reg [7:0] rxdr_reg;
-    reg done_cv, done_nv;
+    reg [1:0] mode_reg;
+    reg irqe_reg;
+    reg [31:0] ovf_cnt_reg;
+    wire done_w;
+    // *** Byte FIFO, 4 banks, byte i in bank i % 4 ***
+    reg [C_FIFO_BITS:0] fifo_wr_cv, fifo_rd_cv;
+    wire [C_FIFO_BITS:0] fifo_level_w;
+    wire fifo_empty_w, fifo_full_w;
+    wire [31:0] bank_q_w;
+    wire [63:0] bank_qq_w;
+    wire [31:0] rxdr4_w;
+    reg [1:0] rx_sel_reg;
+    reg fifo_rd_reg, rd1_reg;
+    reg [2:0] pop_reg;
     // *** AXIS slave ***
-    reg [1:0] s2mmstate_cs, s2mmstate_ns;
-    reg rxdr_rd_reg;
+    wire s_hs;
 
 	// *** AXI write ************************************************************
 	assign s_axi_awready = (wstate_cs == S_WRIDLE);
@@ -132,7 +162,7 @@ module axi_ircrx_control
 
 	// *** AXI read *************************************************************
 	assign s_axi_arready = (rstate_cs == S_RDIDLE);
-	assign s_axi_rdata = rdata;
+	assign s_axi_rdata = (fifo_rd_reg) ? rxdr4_w : rdata;
 	assign s_axi_rresp = 2'b00;   // OKAY
 	assign s_axi_rvalid = (rstate_cs == S_RDDATA);
 	assign ar_hs = s_axi_arvalid & s_axi_arready;
@@ -172,94 +202,146 @@ module axi_ircrx_control
 	    if (!aresetn)
 	    begin
 	        rdata <= 0;
-	        rxdr_rd_reg <= 0;
+	        fifo_rd_reg <= 0;
+	        rd1_reg <= 0;
+	        pop_reg <= 0;
 	    end
 		else if (ar_hs)
 		begin
+		    fifo_rd_reg <= 0;
+		    rd1_reg <= (raddr == C_ADDR_RXDR);
+		    pop_reg <= 0;
             case (raddr)
 				C_ADDR_CTRL:
 				begin 
-					rdata <= {done_cv, ctrl_reg};
+					rdata <= {mode_reg, 3'b0, done_w, ctrl_reg};
 			    end
 			    C_ADDR_RXDR:
 			    begin
-                    rdata <= rxdr_reg;
-                    rxdr_rd_reg <= 1;
-                end			
+			        // Bit 7~0 of the packed word
+			        rdata <= 0;
+			        fifo_rd_reg <= 1;
+                    pop_reg <= (fifo_empty_w) ? 0 : 1;
+                end
+			    C_ADDR_IRQE:
+			    begin
+                    rdata <= irqe_reg;
+                end
+			    C_ADDR_RXD4:
+			    begin
+			        fifo_rd_reg <= 1;
+                    pop_reg <= (fifo_level_w < 4) ? fifo_level_w : 4;
+                end
+			    C_ADDR_LVL:
+			    begin
+                    rdata <= {C_FIFO_DEPTH, {(15-C_FIFO_BITS){1'b0}}, fifo_level_w};
+                end
+			    C_ADDR_OVF:
+			    begin
+                    rdata <= ovf_cnt_reg;
+                end
 			endcase
 	    end
 	    else
 	    begin
-	        rxdr_rd_reg <= 0;
+	        pop_reg <= 0;
 	    end
 	end
 
     // *** Internal registers ***************************************************
     assign mod_m = ctrl_reg;
+    assign irc_mode = mode_reg;
+    assign done_w = ~fifo_empty_w;
+    assign irq = done_w & irqe_reg;
     
    	// *** ctrl_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
+	    begin
             ctrl_reg[15:0] <= 0;
+            mode_reg <= 0;
+        end
 		else if (w_hs && waddr == C_ADDR_CTRL)
+		begin
 			ctrl_reg[15:0] <= (s_axi_wdata[31:0] & wmask) | (ctrl_reg[15:0] & ~wmask);
+			mode_reg <= (s_axi_wdata[21:20] & wmask[21:20]) | (mode_reg & ~wmask[21:20]);
+		end
 	end
 
-    // *** rxdr_reg ***
+   	// *** irqe_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
-	    begin
-            rxdr_reg <= 0;
-        end
-		else if (s_axis_tvalid && s_axis_tready)
-		begin
-            rxdr_reg <= s_axis_tdata;
-        end
+            irqe_reg <= 0;
+		else if (w_hs && waddr == C_ADDR_IRQE && s_axi_wstrb[0])
+			irqe_reg <= s_axi_wdata[0];
 	end
 
-    // *** AXIS slave ***********************************************************
-    assign s_axis_tready = (s2mmstate_cs == S_S2MM_DONE) ? 0 : 1;
+    // *** Byte FIFO ************************************************************
+    assign fifo_level_w = fifo_wr_cv - fifo_rd_cv;
+    assign fifo_empty_w = (fifo_level_w == 0);
+    assign fifo_full_w = (fifo_level_w == C_FIFO_DEPTH);
+
+    // *** Banks, a packed read takes one byte from each ***
+    genvar b;
+    generate
+        for (b = 0; b < 4; b = b + 1)
+        begin: bank
+            reg [7:0] mem [0:C_FIFO_DEPTH/4-1];
+            reg [7:0] q;
+            // Byte j of the packed word comes from this bank
+            wire [1:0] j = b - fifo_rd_cv[1:0];
+            wire [C_FIFO_BITS-1:0] idx = fifo_rd_cv[C_FIFO_BITS-1:0] + j;
 
-    // *** AXIS slave state register ***
+            always @(posedge aclk)
+            begin
+                if (s_hs && !fifo_full_w && (fifo_wr_cv[1:0] == b))
+                    mem[fifo_wr_cv[C_FIFO_BITS-1:2]] <= s_axis_tdata;
+            end
+
+            always @(posedge aclk)
+            begin
+                if (ar_hs)
+                    q <= mem[idx[C_FIFO_BITS-1:2]];
+            end
+
+            assign bank_q_w[b*8 +: 8] = q;
+        end
+    endgenerate
+
+    // *** Banks rotated so the oldest byte is bit 7~0 ***
+    assign bank_qq_w = {bank_q_w, bank_q_w};
+    assign rxdr4_w = (rd1_reg) ? {24'h0, bank_qq_w[rx_sel_reg*8 +: 8]} :
+                     bank_qq_w[rx_sel_reg*8 +: 32];
+
+    // *** Write and read pointers, overflow count ***
     always @(posedge aclk)
     begin
         if (!aresetn)
         begin
-            s2mmstate_cs <= S_S2MM_IDLE;
-            done_cv <= 0;
+            fifo_wr_cv <= 0;
+            fifo_rd_cv <= 0;
+            rx_sel_reg <= 0;
+            ovf_cnt_reg <= 0;
         end
         else
         begin
-            s2mmstate_cs <= s2mmstate_ns;
-            done_cv <= done_nv;
-        end 
-    end
-    
-    // *** AXIS slave state next ***
-    always @(*)
-    begin
-        s2mmstate_ns = s2mmstate_cs;
-        done_nv = done_cv;
-        case (s2mmstate_cs)
-            S_S2MM_IDLE:
-            begin
-                if (s_axis_tvalid)
-                begin
-                    s2mmstate_ns = S_S2MM_DONE;
-                    done_nv = 1;
-                end
-            end
-            S_S2MM_DONE:
-            begin
-                if (rxdr_rd_reg)
-                begin
-                    s2mmstate_ns = S_S2MM_IDLE;
-                    done_nv = 0;
-                end
-            end
-        endcase
+            if (s_hs && !fifo_full_w)
+                fifo_wr_cv <= fifo_wr_cv + 1;
+            if (ar_hs)
+                rx_sel_reg <= fifo_rd_cv[1:0];
+            fifo_rd_cv <= fifo_rd_cv + pop_reg;
+            if (w_hs && waddr == C_ADDR_OVF)
+                ovf_cnt_reg <= 0;
+            else if (s_hs && fifo_full_w)
+                ovf_cnt_reg <= ovf_cnt_reg + 1;
+        end
     end
+
+    // *** AXIS slave ***********************************************************
+    // Never stalls the receiver, a byte without room is dropped
+    assign s_axis_tready = 1;
+    assign s_hs = s_axis_tvalid & s_axis_tready;
                            
 endmodule
@@ -2,13 +2,16 @@
 // Date  : 11 Mar 2018
 // Update: 26 Sep 2018 - Porting to RedPitaya
 //         07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add byte FIFO, packed 4-byte writes and level register
+//         19 Oct 2026 - Add line coding mode
 
 `timescale 1ns / 1ps
 
 module axi_irctx_control
 	#(
         C_ADDR_WIDTH = 32,
-        C_DATA_WIDTH = 32
+        C_DATA_WIDTH = 32,
+        C_FIFO_BITS = 11                // FIFO depth = 2^C_FIFO_BITS bytes
     )
 	(
         // *** Clock and reset signals ***
@@ -38,22 +41,32 @@ module axi_irctx_control
         output wire                      m_axis_tvalid,
         // *** User signals ***
         output wire [15:0]               mod_m,
-        output wire                      mod_38khz_en
+        output wire                      mod_38khz_en,
+        output wire [1:0]                irc_mode
     );
 
     // *** Register map ***
     // 0x00: baud rate divisor and tx busy
-    //       bit 15~0 = baud[15:0] (R/W)
-    //       bit 16   = mod_38khz_en (R/W)
-    //       bit 17   = busy_reg (R)
-    // 0x04: uart tx data register
+    //       bit 15~0  = baud[15:0] (R/W), slot tick divisor of mode 1 and 2
+    //       bit 16    = mod_38khz_en (R/W)
+    //       bit 17    = busy_reg (R), bytes queued or being sent
+    //       bit 18    = full (R), less than 4 bytes free
+    //       bit 21~20 = irc_mode[1:0] (R/W), 0: UART, 1: Manchester, 2: 4-PPM
+    // 0x04: uart tx data register, a write queues one byte
     //       bit 7~0 = txdr_reg[7:0] (R/W)
-    // 0x08: reserved
-    // 0x0c: reserved
+    // 0x08: packed tx data register, a write queues 4 bytes, bit 7~0 first
+    //       bit 31~0 = txdr4[31:0] (W)
+    // 0x0c: FIFO level
+    //       bit 15~0  = bytes queued (R)
+    //       bit 31~16 = FIFO depth in bytes (R)
+    // A write without room for its bytes is dropped.
 	localparam C_ADDR_BITS = 4;
+	localparam [15:0] C_FIFO_DEPTH = 1 << C_FIFO_BITS;
 	// *** Address ***
 	localparam C_ADDR_CTRL = 4'h0,
-			   C_ADDR_TXDR = 4'h4;
+			   C_ADDR_TXDR = 4'h4,
+			   C_ADDR_TXD4 = 4'h8,
+			   C_ADDR_LVL  = 4'hc;
 	// *** AXI write FSM ***
 	localparam S_WRIDLE = 2'd0,
 			   S_WRDATA = 2'd1,
@@ -77,11 +90,19 @@ module axi_irctx_control
 	wire ar_hs;
 	// *** Internal registers ***
 	reg [16:0] ctrl_reg;
+    reg [1:0] mode_reg;
     reg [7:0] txdr_reg;
     wire busy_com;
+    // *** Byte FIFO, 4 banks, byte i in bank i % 4 ***
+    reg [C_FIFO_BITS:0] fifo_wr_cv, fifo_rd_cv;
+    wire [C_FIFO_BITS:0] fifo_level_w;
+    wire fifo_empty_w, fifo_full_w;
+    wire push1_w, push4_w;
+    wire [31:0] bank_q_w;
+    reg [1:0] tx_sel_reg;
     // *** AXIS master ***
     reg [1:0] mm2sstate_cs, mm2sstate_ns;
-    reg start_reg;
+    wire load_w;
 
 	// *** AXI write ************************************************************
 	assign s_axi_awready = (wstate_cs == S_WRIDLE);
@@ -180,12 +201,16 @@ module axi_irctx_control
             case (raddr)
 				C_ADDR_CTRL:
 				begin 
-					rdata <= {busy_com, ctrl_reg};
+					rdata <= {mode_reg, 1'b0, fifo_full_w, busy_com, ctrl_reg};
 			    end
 			    C_ADDR_TXDR:
                 begin
                     rdata <= txdr_reg;
-			    end		
+			    end
+			    C_ADDR_LVL:
+                begin
+                    rdata <= {C_FIFO_DEPTH, {(15-C_FIFO_BITS){1'b0}}, fifo_level_w};
+			    end
 			endcase
 	    end
 	end
@@ -193,39 +218,97 @@ module axi_irctx_control
     // *** Internal registers ***************************************************
     assign mod_m = ctrl_reg[15:0];
     assign mod_38khz_en = ctrl_reg[16];
+    assign irc_mode = mode_reg;
 
    	// *** ctrl_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
+	    begin
             ctrl_reg[16:0] <= 0;
+            mode_reg <= 0;
+        end
 		else if (w_hs && waddr == C_ADDR_CTRL)
+		begin
 			ctrl_reg[16:0] <= (s_axi_wdata[31:0] & wmask) | (ctrl_reg[16:0] & ~wmask);
+			mode_reg <= (s_axi_wdata[21:20] & wmask[21:20]) | (mode_reg & ~wmask[21:20]);
+		end
 	end
 
-    // *** txdr_reg ***
+    // *** txdr_reg, last byte written ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
-	    begin
             txdr_reg[7:0] <= 0;
-            start_reg <= 0;
-        end
 		else if (w_hs && waddr == C_ADDR_TXDR)
-		begin
             txdr_reg[7:0] <= (s_axi_wdata[31:0] & wmask) | (txdr_reg[7:0] & ~wmask);
-            start_reg <= 1;
+	end
+
+    // *** Byte FIFO ************************************************************
+    assign fifo_level_w = fifo_wr_cv - fifo_rd_cv;
+    assign fifo_empty_w = (fifo_level_w == 0);
+    assign fifo_full_w = (fifo_level_w > C_FIFO_DEPTH-4);
+    assign push1_w = w_hs && (waddr == C_ADDR_TXDR) && (fifo_level_w != C_FIFO_DEPTH);
+    assign push4_w = w_hs && (waddr == C_ADDR_TXD4) && !fifo_full_w;
+
+    // *** Banks, a packed write puts one byte in each ***
+    genvar b;
+    generate
+        for (b = 0; b < 4; b = b + 1)
+        begin: bank
+            reg [7:0] mem [0:C_FIFO_DEPTH/4-1];
+            reg [7:0] q;
+            // Byte j of the packed word lands in this bank
+            wire [1:0] j = b - fifo_wr_cv[1:0];
+            wire [C_FIFO_BITS-1:0] idx = fifo_wr_cv[C_FIFO_BITS-1:0] + j;
+
+            always @(posedge aclk)
+            begin
+                if (push4_w)
+                    mem[idx[C_FIFO_BITS-1:2]] <= s_axi_wdata[j*8 +: 8];
+                else if (push1_w && (j == 0))
+                    mem[idx[C_FIFO_BITS-1:2]] <= s_axi_wdata[7:0];
+            end
+
+            always @(posedge aclk)
+            begin
+                if (load_w)
+                    q <= mem[fifo_rd_cv[C_FIFO_BITS-1:2]];
+            end
+
+            assign bank_q_w[b*8 +: 8] = q;
+        end
+    endgenerate
+
+    // *** Write and read pointers ***
+    always @(posedge aclk)
+    begin
+        if (!aresetn)
+        begin
+            fifo_wr_cv <= 0;
+            fifo_rd_cv <= 0;
+            tx_sel_reg <= 0;
         end
         else
         begin
-            start_reg <= 0;
+            if (push4_w)
+                fifo_wr_cv <= fifo_wr_cv + 4;
+            else if (push1_w)
+                fifo_wr_cv <= fifo_wr_cv + 1;
+            if (load_w)
+            begin
+                fifo_rd_cv <= fifo_rd_cv + 1;
+                tx_sel_reg <= fifo_rd_cv[1:0];
+            end
         end
-	end
+    end
 
     // *** AXIS master **********************************************************
-    assign busy_com = (mm2sstate_cs == S_MM2S_WR) ? 1 : 0;
-    assign m_axis_tdata = txdr_reg;
+    assign busy_com = (mm2sstate_cs == S_MM2S_WR) | ~fifo_empty_w;
+    assign m_axis_tdata = bank_q_w[tx_sel_reg*8 +: 8];
     assign m_axis_tvalid = (mm2sstate_cs == S_MM2S_WR) ? 1 : 0;
+    // Head byte taken from the FIFO
+    assign load_w = (mm2sstate_cs == S_MM2S_IDLE) && !fifo_empty_w;
     
     // *** AXIS master state register ***
     always @(posedge aclk)
@@ -243,7 +326,7 @@ module axi_irctx_control
         case (mm2sstate_cs)
             S_MM2S_IDLE:
             begin
-                if (start_reg)
+                if (load_w)
                     mm2sstate_ns = S_MM2S_WR;
             end
             S_MM2S_WR:
@@ -2,10 +2,21 @@
 // Date  : 23 Feb 2018
 // Update: 11 Mar 2018 - Add configurable peak threshold control register
 //	       28 Jan 2019 - Peak threshold control removed, GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - Add ready interrupt
+//         19 Oct 2026 - Add symbol FIFO with level and overflow count
+//         19 Oct 2026 - Add synchronizer burst length register
+//         19 Oct 2026 - Add downsample factor register
+//         19 Oct 2026 - FFT size from C_FFT_BITS, data register window at 0x40
+//         19 Oct 2026 - Add synchronizer threshold and noise floor registers
+//         19 Oct 2026 - Add fine detector abort count register
 
 `timescale 1ns / 1ps
 
 module axi_vlcrx_control
+    #(
+        parameter C_FIFO_BITS = 7,      // FIFO depth = 2^C_FIFO_BITS symbols
+        parameter C_FFT_BITS = 6        // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+    )
     (
 	    // *** AXI4 clock and reset port ***
 		input  wire        aclk,
@@ -36,16 +47,31 @@ module axi_vlcrx_control
 		// *** User port ***
         output wire [1:0]  demod_type,
         output wire [7:0]  fft_config,
-        output wire        fft_config_en
+        output wire        fft_config_en,
+        output wire [7:0]  burst_max,
+        output wire [4:0]  n_downsamp,
+        output wire [15:0] dc_ratio,
+        output wire [7:0]  nf_margin,
+        output wire [15:0] fine_ratio,
+        input  wire [31:0] noise_floor,
+        input  wire [1:0]  fine_abort,
+        // *** Interrupt, level, high while an enabled source is set ***
+        output wire        irq
     );
     
     // *** Register map ***
-    // 0x00: mod_type and done
-    //       bit 1~0 = mod_type[1:0] (R/W)
-    //       bit 2   = done (R)
-    // 0x04: Reserved
-    // 0x08: Reserved
-    // 0x0C: Reserved
+    // 0x00: mod_type, done and FIFO threshold
+    //       bit 1~0   = mod_type[1:0] (R/W)
+    //       bit 2     = done (R), a symbol is in the FIFO
+    //       bit 31~16 = threshold[15:0] (R/W)
+    // 0x04: interrupt enable
+    //       bit 0 = ready (R/W)
+    //       bit 1 = level > threshold (R/W)
+    // 0x08: FIFO level
+    //       bit 15~0  = symbols queued (R)
+    //       bit 31~16 = FIFO depth in symbols (R)
+    // 0x0C: overflow count
+    //       bit 31~0 = symbols dropped with the FIFO full (R), write clears
     // 0x10: data register 0
     //       bit 31~0 = data_0[31:0] (R)
     // 0x14: data register 1
@@ -54,13 +80,48 @@ module axi_vlcrx_control
     //       bit 31~0 = data_2[31:0] (R)
     // 0x1C: data register 3
     //       bit 31~0 = data_3[31:0] (R)
-    localparam C_ADDR_BITS = 5;
+    // 0x20: synchronizer burst
+    //       bit 7~0 = burst_max[7:0] (R/W), symbols per preamble, 0 or 1 =
+    //                 every symbol has its own preamble
+    // 0x24: downsample factor
+    //       bit 4~0 = n_downsamp[4:0] (R/W), 1 - 25, 25 at reset, other
+    //                 values are ignored, same as up_factor of the transmitter
+    // 0x28: coarse (DC metric) threshold
+    //       bit 15~0  = dc_ratio[15:0] (R/W), metric >= dc_ratio/256 * received
+    //                   energy, 128 at reset, 0 = fixed threshold
+    //       bit 23~16 = nf_margin[7:0] (R/W), metric > nf_margin/4 * noise
+    //                   floor, 16 at reset, 0 = no noise floor check
+    // 0x2C: fine threshold
+    //       bit 15~0 = fine_ratio[15:0] (R/W), correlation >= fine_ratio * sum
+    //                  of |x| over the 16 taps, 2540 at reset (half of an
+    //                  exact preamble), 0 = fixed threshold
+    // 0x30: noise floor
+    //       bit 31~0 = average DC metric while idle (R)
+    // 0x34: fine detector abort count, saturating, write clears
+    //       bit 15~0  = search timeouts (R), coarse triggers without a preamble
+    //       bit 31~16 = peak spacing aborts (R), peak 2 - 4 missing, the search
+    //                   started again from peak 1
+    // 0x40 + 4*i: data register i, i = 0 - C_SYM_WORDS-1, 0x40 - 0x4C are
+    //       the same registers as 0x10 - 0x1C
+    // The data registers read the oldest symbol in the FIFO. Reading the last
+    // data register of a symbol (1, 2 or 4 words with BPSK, QPSK or QAM-16
+    // at 64 points, twice that per FFT size doubling) removes it. A symbol
+    // arriving with the FIFO full is dropped whole.
+    localparam C_ADDR_BITS = 7;
+    localparam [15:0] C_FIFO_DEPTH = 1 << C_FIFO_BITS;
+    localparam C_SYM_BITS = C_FFT_BITS - 4;          // QAM-16 words per symbol = 2^C_SYM_BITS
+    localparam C_SYM_WORDS = 1 << C_SYM_BITS;
     // *** Memory-mapped Address ***
-    localparam C_ADDR_CTRL = 5'h00,
-               C_ADDR_DR00 = 5'h10,
-               C_ADDR_DR01 = 5'h14,
-               C_ADDR_DR02 = 5'h18,
-               C_ADDR_DR03 = 5'h1c;            
+    localparam C_ADDR_CTRL = 7'h00,
+               C_ADDR_IRQE = 7'h04,
+               C_ADDR_LVL  = 7'h08,
+               C_ADDR_OVF  = 7'h0c,
+               C_ADDR_BRST = 7'h20,
+               C_ADDR_DNS  = 7'h24,
+               C_ADDR_DCT  = 7'h28,
+               C_ADDR_FNT  = 7'h2c,
+               C_ADDR_NF   = 7'h30,
+               C_ADDR_ABRT = 7'h34;
     // *** AXI write FSM ***
     localparam S_WRIDLE = 2'h0,
                S_WRDATA = 2'h1,
@@ -68,10 +129,6 @@ module axi_vlcrx_control
     // *** AXI read FSM ***
     localparam S_RDIDLE = 2'h0,
                S_RDDATA = 2'h1;
-    // *** AXIS FSM ***
-    localparam S_IDLE = 2'h0,
-               S_READ_STREAM = 2'h1,
-               S_BUSY = 2'h2;
 
     // *** AXI write ***
 	reg [1:0] wstate_cs, wstate_ns;
@@ -83,14 +140,35 @@ module axi_vlcrx_control
 	wire [C_ADDR_BITS-1:0] raddr;
 	reg [31:0] rdata;
 	wire ar_hs;
+	// *** Data register decode, 0x10 - 0x1C or the 0x40 window ***
+	wire rdr_w;
+	wire [3:0] rword_w;
 	// *** Internal registers ***
 	reg [1:0] ctrl_reg;
-    reg [31:0] data_reg [0:3];
-    // *** AXIS ***
-    reg [1:0] s2mmstate_cs, s2mmstate_ns;
-    reg [1:0] rd_ptr_cv, rd_ptr_nv;
-    reg ready_cv, ready_nv;
+    reg [15:0] thr_reg;
+    reg [1:0] irqe_reg;
+    reg [7:0] burst_reg;
+    reg [4:0] dn_reg;
+    reg [15:0] dc_ratio_reg;
+    reg [7:0] nf_margin_reg;
+    reg [15:0] fine_ratio_reg;
+    reg [15:0] abrt_search_reg, abrt_peak_reg;
+    reg [31:0] ovf_cnt_reg;
+    wire ready_w;
+    wire [C_SYM_BITS:0] num_words_w;
+    // *** Symbol FIFO, C_SYM_WORDS words per symbol ***
+    reg [31:0] fifo_mem [0:C_FIFO_DEPTH*C_SYM_WORDS-1];
+    reg [C_FIFO_BITS:0] fifo_wr_cv, fifo_rd_cv;
+    wire [C_FIFO_BITS:0] fifo_level_w;
+    wire fifo_full_w, fifo_empty_w;
+    reg [31:0] fifo_rdata;
+    reg fifo_rd_reg;
     reg data_rd_reg;
+    // *** AXIS ***
+    reg [C_SYM_BITS-1:0] wr_ptr_cv;
+    reg drop_reg;
+    wire drop_w;
+    wire s_hs;
     
 	// *** AXI write ************************************************************
 	assign s_axi_awready = (wstate_cs == S_WRIDLE);
@@ -143,11 +221,15 @@ module axi_vlcrx_control
 
 	// *** AXI read *************************************************************
 	assign s_axi_arready = (rstate_cs == S_RDIDLE);
-	assign s_axi_rdata = rdata;
+	assign s_axi_rdata = (fifo_rd_reg) ? fifo_rdata : rdata;
 	assign s_axi_rresp = 2'b00;   // OKAY
 	assign s_axi_rvalid = (rstate_cs == S_RDDATA);
 	assign ar_hs = s_axi_arvalid & s_axi_arready;
 	assign raddr = s_axi_araddr[C_ADDR_BITS-1:0];
+
+	// *** Data register decode ***
+	assign rword_w = (raddr[6]) ? raddr[5:2] : {2'b00, raddr[3:2]};
+	assign rdr_w = (raddr[6] || (raddr[5:4] == 1)) && (rword_w < C_SYM_WORDS);
 	
 	// *** Read state register ***
 	always @(posedge aclk)
@@ -183,37 +265,62 @@ module axi_vlcrx_control
 	    if (!aresetn)
 	    begin
 	        rdata <= 0;
+	        fifo_rd_reg <= 0;
 	        data_rd_reg <= 0;
 	    end
 		else if (ar_hs)
 		begin
+		    fifo_rd_reg <= 0;
             case (raddr)
 				C_ADDR_CTRL:
 				begin
-					rdata <= {ready_cv, ctrl_reg[1:0]};
+					rdata <= {thr_reg, 13'h0, ready_w, ctrl_reg[1:0]};
 			    end
-			    C_ADDR_DR00:
+			    C_ADDR_IRQE:
 			    begin
-                    rdata <= data_reg[0];
-                    if (ctrl_reg[1:0] == 0)
-                        data_rd_reg <= 1;
-                end
-			    C_ADDR_DR01:
+			        rdata <= irqe_reg;
+			    end
+			    C_ADDR_LVL:
 			    begin
-                    rdata <= data_reg[1];
-                    if (ctrl_reg[1:0] == 1)
-                        data_rd_reg <= 1;
-                end
-			    C_ADDR_DR02:
+			        rdata <= {C_FIFO_DEPTH, {(15-C_FIFO_BITS){1'b0}}, fifo_level_w};
+			    end
+			    C_ADDR_OVF:
 			    begin
-                    rdata <= data_reg[2];
-                end
-			    C_ADDR_DR03:
+			        rdata <= ovf_cnt_reg;
+			    end
+			    C_ADDR_BRST:
+			    begin
+			        rdata <= burst_reg;
+			    end
+			    C_ADDR_DNS:
+			    begin
+			        rdata <= dn_reg;
+			    end
+			    C_ADDR_DCT:
+			    begin
+			        rdata <= {8'h0, nf_margin_reg, dc_ratio_reg};
+			    end
+			    C_ADDR_FNT:
+			    begin
+			        rdata <= fine_ratio_reg;
+			    end
+			    C_ADDR_NF:
+			    begin
+			        rdata <= noise_floor;
+			    end
+			    C_ADDR_ABRT:
+			    begin
+			        rdata <= {abrt_peak_reg, abrt_search_reg};
+			    end
+			    default:
 			    begin
-                    rdata <= data_reg[3];
-                    if (ctrl_reg[1:0] == 2)
-                        data_rd_reg <= 1;
-                end        			
+			        if (rdr_w)
+			        begin
+                        fifo_rd_reg <= 1;
+                        if (rword_w == num_words_w-1)
+                            data_rd_reg <= 1;
+                    end
+			    end
 			endcase
         end
         else
@@ -224,111 +331,175 @@ module axi_vlcrx_control
 
     // *** Internal registers ***************************************************
     assign demod_type = ctrl_reg[1:0];
-    
-   	// *** ctrl_reg[1:0] ***
+    assign num_words_w = ((ctrl_reg[1:0] == 0) ? 1 : ((ctrl_reg[1:0] == 1) ? 2 : 4)) << (C_FFT_BITS-6);
+    assign burst_max = burst_reg;
+    assign n_downsamp = dn_reg;
+    assign dc_ratio = dc_ratio_reg;
+    assign nf_margin = nf_margin_reg;
+    assign fine_ratio = fine_ratio_reg;
+    assign ready_w = ~fifo_empty_w;
+    assign irq = (ready_w & irqe_reg[0]) | ((fifo_level_w > thr_reg) & irqe_reg[1]);
+
+   	// *** ctrl_reg[1:0], thr_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
+	    begin
             ctrl_reg[1:0] <= 0;
+            thr_reg <= 0;
+        end
 		else if (w_hs && waddr == C_ADDR_CTRL)
+		begin
 			ctrl_reg[1:0] <= (s_axi_wdata[31:0] & wmask) | (ctrl_reg[1:0] & ~wmask);
+			thr_reg <= (s_axi_wdata[31:16] & wmask[31:16]) | (thr_reg & ~wmask[31:16]);
+		end
 	end
 
-    // *** data_reg[0][31:0] - data_reg[3][31:0] ***
+   	// *** irqe_reg ***
+	always @(posedge aclk)
+	begin
+	    if (!aresetn)
+            irqe_reg <= 0;
+		else if (w_hs && waddr == C_ADDR_IRQE && s_axi_wstrb[0])
+			irqe_reg <= s_axi_wdata[1:0];
+	end
+
+   	// *** burst_reg ***
+	always @(posedge aclk)
+	begin
+	    if (!aresetn)
+            burst_reg <= 0;
+		else if (w_hs && waddr == C_ADDR_BRST && s_axi_wstrb[0])
+			burst_reg <= s_axi_wdata[7:0];
+	end
+
+   	// *** dn_reg ***
+	always @(posedge aclk)
+	begin
+	    if (!aresetn)
+            dn_reg <= 25;
+		else if (w_hs && waddr == C_ADDR_DNS && s_axi_wstrb[0] &&
+		         s_axi_wdata[7:0] >= 1 && s_axi_wdata[7:0] <= 25)
+			dn_reg <= s_axi_wdata[4:0];
+	end
+
+   	// *** dc_ratio_reg, nf_margin_reg, fine_ratio_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
 	    begin
-            data_reg[0] <= 0;
-            data_reg[1] <= 0;
-            data_reg[2] <= 0;
-            data_reg[3] <= 0;
+            dc_ratio_reg <= 128;
+            nf_margin_reg <= 16;
+            fine_ratio_reg <= 2540;
         end
-		else if (s_axis_tvalid && s_axis_tready)
+		else if (w_hs && waddr == C_ADDR_DCT)
+		begin
+			dc_ratio_reg <= (s_axi_wdata[15:0] & wmask[15:0]) | (dc_ratio_reg & ~wmask[15:0]);
+			nf_margin_reg <= (s_axi_wdata[23:16] & wmask[23:16]) | (nf_margin_reg & ~wmask[23:16]);
+		end
+		else if (w_hs && waddr == C_ADDR_FNT)
 		begin
-            data_reg[rd_ptr_cv] <= s_axis_tdata;
+			fine_ratio_reg <= (s_axi_wdata[15:0] & wmask[15:0]) | (fine_ratio_reg & ~wmask[15:0]);
+		end
+	end
+
+   	// *** abrt_search_reg, abrt_peak_reg ***
+	always @(posedge aclk)
+	begin
+	    if (!aresetn)
+	    begin
+            abrt_search_reg <= 0;
+            abrt_peak_reg <= 0;
+        end
+		else if (w_hs && waddr == C_ADDR_ABRT)
+		begin
+            abrt_search_reg <= 0;
+            abrt_peak_reg <= 0;
+        end
+        else
+        begin
+            if (fine_abort[0] && abrt_search_reg != 16'hFFFF)
+                abrt_search_reg <= abrt_search_reg + 1;
+            if (fine_abort[1] && abrt_peak_reg != 16'hFFFF)
+                abrt_peak_reg <= abrt_peak_reg + 1;
         end
 	end
 
+    // *** Symbol FIFO **********************************************************
+    assign fifo_level_w = fifo_wr_cv - fifo_rd_cv;
+    assign fifo_full_w = (fifo_level_w == C_FIFO_DEPTH);
+    assign fifo_empty_w = (fifo_level_w == 0);
+
+    // *** Head symbol word, read on the AR handshake, valid in S_RDDATA ***
+    always @(posedge aclk)
+    begin
+        if (ar_hs)
+            fifo_rdata <= fifo_mem[{fifo_rd_cv[C_FIFO_BITS-1:0], rword_w[C_SYM_BITS-1:0]}];
+    end
+
+    // *** Read pointer, the last data register of a symbol was read ***
+    always @(posedge aclk)
+    begin
+        if (!aresetn)
+            fifo_rd_cv <= 0;
+        else if (data_rd_reg && !fifo_empty_w)
+            fifo_rd_cv <= fifo_rd_cv + 1;
+    end
+
     // *** AXIS *****************************************************************
-    assign s_axis_tready = (s2mmstate_cs == S_BUSY) ? 0 : 1;
+    // Never stalls the demodulator, a symbol without room is dropped
+    assign s_axis_tready = 1;
+    assign s_hs = s_axis_tvalid & s_axis_tready;
+    // Room is checked on the first word of a symbol
+    assign drop_w = (wr_ptr_cv == 0) ? fifo_full_w : drop_reg;
+
+    always @(posedge aclk)
+    begin
+        if (s_hs && !drop_w)
+            fifo_mem[{fifo_wr_cv[C_FIFO_BITS-1:0], wr_ptr_cv}] <= s_axis_tdata;
+    end
 
-    // *** AXIS state register ***
+    // *** Write pointer and overflow count ***
     always @(posedge aclk)
     begin
         if (!aresetn)
         begin
-            s2mmstate_cs <= S_IDLE;
-            rd_ptr_cv <= 0;
-            ready_cv <= 0;
+            wr_ptr_cv <= 0;
+            drop_reg <= 0;
+            fifo_wr_cv <= 0;
+            ovf_cnt_reg <= 0;
         end
         else
         begin
-            s2mmstate_cs <= s2mmstate_ns;
-            rd_ptr_cv <= rd_ptr_nv;
-            ready_cv <= ready_nv;
-        end 
-    end
-    
-    // *** AXIS state next ***
-    always @(*)
-    begin
-        s2mmstate_ns = s2mmstate_cs;
-        rd_ptr_nv = rd_ptr_cv;
-        ready_nv = ready_cv;
-        case (s2mmstate_cs)
-            S_IDLE:
-            begin
-                if (s_axis_tvalid)
-                begin
-                    if (s_axis_tlast)
-                    begin
-                        s2mmstate_ns = S_BUSY;
-                        rd_ptr_nv = 0;
-                        ready_nv = 1;
-                    end
-                    else
-                    begin
-                        s2mmstate_ns = S_READ_STREAM;
-                        rd_ptr_nv = rd_ptr_cv + 1;
-                    end
-                end
-            end
-            S_READ_STREAM:
+            if (s_hs)
             begin
-                if (s_axis_tvalid)
+                if (s_axis_tlast)
                 begin
-                    if (s_axis_tlast)
-                    begin
-                        s2mmstate_ns = S_BUSY;
-                        rd_ptr_nv = 0;
-                        ready_nv = 1;
-                    end
-                    else
-                    begin
-                        rd_ptr_nv = rd_ptr_cv + 1;
-                    end
+                    wr_ptr_cv <= 0;
+                    if (!drop_w)
+                        fifo_wr_cv <= fifo_wr_cv + 1;
                 end
-            end
-            S_BUSY:
-            begin
-                if (data_rd_reg)
+                else
                 begin
-                    s2mmstate_ns = S_IDLE;
-                    ready_nv = 0;
+                    wr_ptr_cv <= wr_ptr_cv + 1;
                 end
+                drop_reg <= drop_w;
             end
-        endcase
+            if (w_hs && waddr == C_ADDR_OVF)
+                ovf_cnt_reg <= 0;
+            else if (s_hs && s_axis_tlast && drop_w)
+                ovf_cnt_reg <= ovf_cnt_reg + 1;
+        end
     end
 
     // *** FFT configuration ****************************************************
-    // Bit 0 = fwd_inv = 1 (forward)
+    // Bit 0 = fwd_inv = 1 (forward), the same for every transform length
     assign fft_config = 8'h1;
     assign fft_config_en = 1;
 
 	// *** FFT IP core settings ***	
 	// Number of Channels  = 1
-	// Transform Length    = 64
+	// Transform Length    = 2^C_FFT_BITS (64 - 256)
 	// Architecture Choice = Radix-4, Burst I/O
 	// Data Formats        = Fixed Point
 	// Scaling Options     = Unscaled
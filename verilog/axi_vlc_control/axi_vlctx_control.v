@@ -3,10 +3,22 @@
 // Update: 11 Mar 2018 - Add guard interval control register
 //         15 Jul 2018 - Porting to RedPitaya
 //	       28 Jan 2019 - GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - Add symbol FIFO, level/threshold registers and
+//                       AXI4-stream (DMA) symbol input, low-water interrupt
+//         19 Oct 2026 - Add burst length register
+//         19 Oct 2026 - Add upsample factor register
+//         19 Oct 2026 - FFT size and cyclic prefix from C_FFT_BITS and C_CP_LEN,
+//                       data register window at 0x40
+//         19 Oct 2026 - Zero the words of a symbol after an early tlast
 
 `timescale 1ns / 1ps
 
 module axi_vlctx_control
+    #(
+        parameter C_FIFO_BITS = 7,      // FIFO depth = 2^C_FIFO_BITS symbols, a full frame
+        parameter C_FFT_BITS = 6,       // IFFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_CP_LEN = 8          // Cyclic prefix samples
+    )
     (
 	    // *** AXI4 clock and reset port ***
 		input  wire        aclk,
@@ -29,6 +41,11 @@ module axi_vlctx_control
 		output wire [31:0] s_axi_rdata,		
         output wire [1:0]  s_axi_rresp,
         output wire        s_axi_rvalid,
+        // *** AXI4-stream slave port (symbol words from an AXI DMA MM2S) ***
+        output wire        s_axis_tready,
+        input  wire [31:0] s_axis_tdata,
+        input  wire        s_axis_tvalid,
+        input  wire        s_axis_tlast,
         // *** AXI4-stream master port ***
         input  wire        m_axis_tready,
         output wire [31:0] m_axis_tdata,
@@ -36,20 +53,34 @@ module axi_vlctx_control
         output wire        m_axis_tlast,
 		// *** User port ***
         output wire [1:0]  mod_type,
-        output wire [15:0] ifft_config,
+        output wire [23:0] ifft_config,
         output wire        ifft_config_en,
         output wire [7:0]  guard_interval,
-        input wire         done_tick
+        output wire [7:0]  burst_max,
+        output wire [4:0]  up_factor,
+        input wire         done_tick,
+        // *** Interrupt, level, high while enabled and low ***
+        output wire        irq
     );
 
     // *** Register map ***
-    // 0x00: mod_type, guard_interval, and busy
+    // 0x00: mod_type, guard_interval, busy and FIFO status
     //       bit 1~0 = mod_type[1:0] (R/W)
     //       bit 9~2 = guard_interval[9:2] (R/W)
-    //       bit 10  = busy (R)
-    // 0x04: Reserved
-    // 0x08: Reserved
-    // 0x0C: Reserved
+    //       bit 10  = busy (R), symbols queued or being sent
+    //       bit 11  = full (R)
+    //       bit 12  = low (R), level <= threshold
+    //       bit 13  = overflow (R/W1C), a symbol was written while full
+    //       bit 14  = src_dma (R/W), 0: data registers, 1: AXI4-stream
+    //       bit 23~16 = burst_max[7:0] (R/W), symbols per preamble, 0 or 1 =
+    //                   every symbol has its own preamble
+    // 0x04: FIFO level
+    //       bit 15~0  = symbols queued (R)
+    //       bit 31~16 = FIFO depth in symbols (R)
+    // 0x08: FIFO threshold
+    //       bit 15~0 = threshold[15:0] (R/W)
+    // 0x0C: interrupt enable
+    //       bit 0 = low (R/W)
     // 0x10: data register 0
     //       bit 31~0 = data_0[31:0] (R/W)
     // 0x14: data register 1
@@ -58,13 +89,28 @@ module axi_vlctx_control
     //       bit 31~0 = data_2[31:0] (R/W)
     // 0x1C: data register 3
     //       bit 31~0 = data_3[31:0] (R/W)
-    localparam C_ADDR_BITS = 5;
+    // 0x20: upsample factor
+    //       bit 4~0 = up_factor[4:0] (R/W), 1 - 25, 25 at reset, other values
+    //                 are ignored. The OFDM sample rate is 125 MHz / up_factor.
+    // 0x40 + 4*i: data register i, i = 0 - C_SYM_WORDS-1, 0x40 - 0x4C are
+    //       the same registers as 0x10 - 0x1C
+    // Writing the last data register of a symbol (1, 2 or 4 words with
+    // BPSK, QPSK or QAM-16 at 64 points, twice that per FFT size doubling)
+    // queues the symbol. With src_dma the data registers are ignored and each
+    // group of that many stream words is a symbol, tlast also ends a symbol.
+    // The words of a symbol ended early by tlast are sent as zero.
+    // Symbols leave the FIFO one at a time, the next one after done_tick of
+    // the previous one.
+    localparam C_ADDR_BITS = 7;
+    localparam [15:0] C_FIFO_DEPTH = 1 << C_FIFO_BITS;
+    localparam C_SYM_BITS = C_FFT_BITS - 4;          // QAM-16 words per symbol = 2^C_SYM_BITS
+    localparam C_SYM_WORDS = 1 << C_SYM_BITS;
     // *** Memory-mapped Address ***
-    localparam C_ADDR_CTRL = 5'h00,
-               C_ADDR_DR00 = 5'h10,
-               C_ADDR_DR01 = 5'h14,
-               C_ADDR_DR02 = 5'h18,
-               C_ADDR_DR03 = 5'h1c;            
+    localparam C_ADDR_CTRL = 7'h00,
+               C_ADDR_LVL  = 7'h04,
+               C_ADDR_THR  = 7'h08,
+               C_ADDR_IRQE = 7'h0c,
+               C_ADDR_UPS  = 7'h20;
     // *** AXI write FSM ***
     localparam S_WRIDLE = 2'h0,
                S_WRDATA = 2'h1,
@@ -74,7 +120,9 @@ module axi_vlctx_control
                S_RDDATA = 2'h1;
     // *** AXIS FSM ***
     localparam S_IDLE = 2'h0,
-               S_WRITE_STREAM = 2'h1;
+               S_WRITE_STREAM = 2'h1,
+               S_LOAD = 2'h2,
+               S_WAIT_DONE = 2'h3;
 
     // *** AXI write ***
 	reg [1:0] wstate_cs, wstate_ns;
@@ -86,16 +134,44 @@ module axi_vlctx_control
 	wire [C_ADDR_BITS-1:0] raddr;
 	reg [31:0] rdata;
 	wire ar_hs;
+	// *** Data register decode, 0x10 - 0x1C or the 0x40 window ***
+	wire wdr_w, rdr_w;
+	wire [3:0] wword_w, rword_w;
 	// *** Internal registers ***
 	reg [9:0] ctrl_reg;
-    reg [31:0] data_reg [0:3];
-    reg start_reg;
-    wire [2:0] num_words_w;
+    reg [31:0] data_reg [0:C_SYM_WORDS-1];
+    reg [15:0] thr_reg;
+    reg src_dma_reg;
+    reg [7:0] burst_reg;
+    reg [4:0] up_reg;
+    reg ovf_reg;
+    reg irqe_reg;
+    wire [C_SYM_BITS:0] num_words_w;
+    // *** Symbol FIFO, C_SYM_WORDS words per symbol ***
+    reg [31:0] fifo_mem [0:C_FIFO_DEPTH*C_SYM_WORDS-1];
+    reg [C_FIFO_BITS:0] fifo_wr_cv, fifo_rd_cv;
+    wire [C_FIFO_BITS:0] fifo_level_w;
+    wire fifo_full_w, fifo_empty_w;
+    reg fifo_we;
+    reg [C_SYM_BITS-1:0] fifo_wword;
+    reg [31:0] fifo_wdata;
+    reg fifo_commit;
+    reg [C_SYM_BITS:0] fifo_wnum;
+    // Words written per slot, the words after them are sent as zero
+    reg [C_SYM_BITS:0] fifo_num [0:C_FIFO_DEPTH-1];
+    wire [C_FIFO_BITS+C_SYM_BITS-1:0] fifo_raddr_w;
+    reg [31:0] fifo_rdata;
+    // *** AXI4-stream input ***
+    reg [C_SYM_BITS-1:0] s_word_cv;
+    wire s_hs;
     // *** AXIS ***
     reg [1:0] mm2sstate_cs, mm2sstate_ns;
-    reg [1:0] wr_ptr_cv, wr_ptr_nv;
+    reg [C_SYM_BITS-1:0] wr_ptr_cv, wr_ptr_nv;
+    reg [C_SYM_BITS:0] ld_ptr_cv, ld_ptr_nv;
     reg tlast_cv, tlast_nv;
+    reg [31:0] out_reg [0:C_SYM_WORDS-1];
     reg busy_reg;
+    integer i;
 
 	// *** AXI write ************************************************************
 	assign s_axi_awready = (wstate_cs == S_WRIDLE);
@@ -153,6 +229,12 @@ module axi_vlctx_control
 	assign s_axi_rvalid = (rstate_cs == S_RDDATA);
 	assign ar_hs = s_axi_arvalid & s_axi_arready;
 	assign raddr = s_axi_araddr[C_ADDR_BITS-1:0];
+
+	// *** Data register decode ***
+	assign wword_w = (waddr[6]) ? waddr[5:2] : {2'b00, waddr[3:2]};
+	assign rword_w = (raddr[6]) ? raddr[5:2] : {2'b00, raddr[3:2]};
+	assign wdr_w = (waddr[6] || (waddr[5:4] == 1)) && (wword_w < C_SYM_WORDS);
+	assign rdr_w = (raddr[6] || (raddr[5:4] == 1)) && (rword_w < C_SYM_WORDS);
 	
 	// *** Read state register ***
 	always @(posedge aclk)
@@ -190,91 +272,159 @@ module axi_vlctx_control
 		else if (ar_hs)
             case (raddr)
 				C_ADDR_CTRL: 
-					rdata <= {busy_reg, ctrl_reg[9:0]};
-			    C_ADDR_DR00:
-                    rdata <= data_reg[0];
-			    C_ADDR_DR01:
-                    rdata <= data_reg[1];
-			    C_ADDR_DR02:
-                    rdata <= data_reg[2];
-			    C_ADDR_DR03:
-                    rdata <= data_reg[3];         			
+					rdata <= {burst_reg, 1'b0, src_dma_reg, ovf_reg, (fifo_level_w <= thr_reg), fifo_full_w,
+					          busy_reg | ~fifo_empty_w | (mm2sstate_cs != S_IDLE), ctrl_reg[9:0]};
+				C_ADDR_LVL:
+				    rdata <= {C_FIFO_DEPTH, {(15-C_FIFO_BITS){1'b0}}, fifo_level_w};
+				C_ADDR_THR:
+				    rdata <= {16'h0, thr_reg};
+				C_ADDR_IRQE:
+				    rdata <= irqe_reg;
+			    C_ADDR_UPS:
+                    rdata <= up_reg;
+                default:
+                    if (rdr_w)
+                        rdata <= data_reg[rword_w];
 			endcase
 	end
 
     // *** Internal registers ***************************************************
    	assign mod_type = ctrl_reg[1:0];
-   	assign num_words_w = (ctrl_reg[1:0] == 0) ? 1 : ((ctrl_reg[1:0] == 1) ? 2 : 4);
+   	assign num_words_w = ((ctrl_reg[1:0] == 0) ? 1 : ((ctrl_reg[1:0] == 1) ? 2 : 4)) << (C_FFT_BITS-6);
    	assign guard_interval = ctrl_reg[9:2];
+   	assign burst_max = burst_reg;
+   	assign up_factor = up_reg;
+   	assign irq = (fifo_level_w <= thr_reg) & irqe_reg;
    	
-   	// *** ctrl_reg[9:0] ***
+   	// *** ctrl_reg[9:0], src_dma_reg, burst_reg, thr_reg ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
 	    begin
 	        ctrl_reg[9:0] <= 0;
+	        src_dma_reg <= 0;
+	        burst_reg <= 0;
+	        thr_reg <= 0;
+	        irqe_reg <= 0;
 	    end
 		else if (w_hs && (waddr == C_ADDR_CTRL))
 		begin
-            ctrl_reg[9:0] <= (s_axi_wdata[31:0] & wmask) | (ctrl_reg[9:0] & ~wmask);
+            ctrl_reg[9:0] <= (s_axi_wdata[9:0] & wmask[9:0]) | (ctrl_reg[9:0] & ~wmask[9:0]);
+            if (wmask[14])
+                src_dma_reg <= s_axi_wdata[14];
+            burst_reg <= (s_axi_wdata[23:16] & wmask[23:16]) | (burst_reg & ~wmask[23:16]);
+		end
+		else if (w_hs && (waddr == C_ADDR_THR))
+		begin
+            thr_reg <= (s_axi_wdata[15:0] & wmask[15:0]) | (thr_reg & ~wmask[15:0]);
+		end
+		else if (w_hs && (waddr == C_ADDR_IRQE) && s_axi_wstrb[0])
+		begin
+            irqe_reg <= s_axi_wdata[0];
 		end
 	end
 
-	// *** data_reg[0][31:0] - data_reg[3][31:0] ***
+   	// *** up_reg ***
+	always @(posedge aclk)
+	begin
+	    if (!aresetn)
+            up_reg <= 25;
+		else if (w_hs && (waddr == C_ADDR_UPS) && s_axi_wstrb[0] &&
+		         (s_axi_wdata[7:0] >= 1) && (s_axi_wdata[7:0] <= 25))
+            up_reg <= s_axi_wdata[4:0];
+	end
+
+	// *** data_reg[0][31:0] - data_reg[C_SYM_WORDS-1][31:0], read back only ***
 	always @(posedge aclk)
 	begin
 	    if (!aresetn)
 	    begin
-	        start_reg <= 0;
-	        busy_reg <= 0;
-            data_reg[0] <= 0;
-            data_reg[1] <= 0;
-            data_reg[2] <= 0;
-            data_reg[3] <= 0;
+            for (i = 0; i < C_SYM_WORDS; i = i+1)
+                data_reg[i] <= 0;
         end
-		else if (w_hs && waddr == C_ADDR_DR00)
-		begin
-		    if (num_words_w == 1)
-		    begin
-                start_reg <= 1;
-                busy_reg <= 1;
-            end
-			data_reg[0][31:0] <= (s_axi_wdata[31:0] & wmask) | (data_reg[0][31:0] & ~wmask);
-	    end
-		else if (w_hs && waddr == C_ADDR_DR01)
+		else if (w_hs && wdr_w)
+			data_reg[wword_w][31:0] <= (s_axi_wdata[31:0] & wmask) | (data_reg[wword_w][31:0] & ~wmask);
+	end
+
+    // *** Symbol FIFO **********************************************************
+    assign fifo_level_w = fifo_wr_cv - fifo_rd_cv;
+    assign fifo_full_w = (fifo_level_w == C_FIFO_DEPTH);
+    assign fifo_empty_w = (fifo_level_w == 0);
+    assign s_hs = s_axis_tvalid & s_axis_tready;
+    // Stream words are taken while a free slot is left
+    assign s_axis_tready = src_dma_reg & ~fifo_full_w;
+
+    // *** Word into the free slot, from the data registers or the stream ***
+    always @(*)
+    begin
+        fifo_we = 0;
+        fifo_wword = 0;
+        fifo_wdata = s_axi_wdata;
+        fifo_commit = 0;
+        fifo_wnum = num_words_w;
+        if (!src_dma_reg)
         begin
-            if (num_words_w == 2)
+            if (w_hs && wdr_w && !fifo_full_w)
             begin
-                start_reg <= 1;
-                busy_reg <= 1;
+                fifo_we = 1;
+                fifo_wword = wword_w;
+                // Partial strobes keep the other bytes of the data register
+                fifo_wdata = (s_axi_wdata & wmask) | (data_reg[wword_w] & ~wmask);
+                fifo_commit = (wword_w == num_words_w-1);
             end
-            data_reg[1][31:0] <= (s_axi_wdata[31:0] & wmask) | (data_reg[1][31:0] & ~wmask);
-        end
-		else if (w_hs && waddr == C_ADDR_DR02)
-        begin
-            data_reg[2][31:0] <= (s_axi_wdata[31:0] & wmask) | (data_reg[2][31:0] & ~wmask);
         end
-		else if (w_hs && waddr == C_ADDR_DR03)
+        else if (s_hs)
         begin
-            if (num_words_w == 4)
-            begin
-                start_reg <= 1;
-                busy_reg <= 1;
-            end
-            data_reg[3][31:0] <= (s_axi_wdata[31:0] & wmask) | (data_reg[3][31:0] & ~wmask);
+            fifo_we = 1;
+            fifo_wword = s_word_cv;
+            fifo_wdata = s_axis_tdata;
+            fifo_commit = (s_word_cv == num_words_w-1) | s_axis_tlast;
+            fifo_wnum = s_word_cv + 1;
         end
-        else if (done_tick)
+    end
+
+    always @(posedge aclk)
+    begin
+        if (fifo_we)
+            fifo_mem[{fifo_wr_cv[C_FIFO_BITS-1:0], fifo_wword}] <= fifo_wdata;
+        if (fifo_commit)
+            fifo_num[fifo_wr_cv[C_FIFO_BITS-1:0]] <= fifo_wnum;
+    end
+
+    // *** Write pointer, stream word counter and overflow ***
+    always @(posedge aclk)
+    begin
+        if (!aresetn)
         begin
-            busy_reg <= 0;
+            fifo_wr_cv <= 0;
+            s_word_cv <= 0;
+            ovf_reg <= 0;
         end
-	    else
+        else
         begin
-            start_reg <= 0;
+            if (fifo_commit)
+                fifo_wr_cv <= fifo_wr_cv + 1;
+            if (s_hs)
+                s_word_cv <= (fifo_commit) ? 0 : s_word_cv + 1;
+            // Last data register written while full: the symbol is lost
+            if (!src_dma_reg && w_hs && fifo_full_w && wdr_w &&
+                    (wword_w == num_words_w-1))
+                ovf_reg <= 1;
+            else if (w_hs && (waddr == C_ADDR_CTRL) && wmask[13] && s_axi_wdata[13])
+                ovf_reg <= 0;
         end
-	end
+    end
+
+    // *** Head symbol read, one word per clock ***
+    assign fifo_raddr_w = {fifo_rd_cv[C_FIFO_BITS-1:0], ld_ptr_cv[C_SYM_BITS-1:0]};
+
+    always @(posedge aclk)
+    begin
+        fifo_rdata <= fifo_mem[fifo_raddr_w];
+    end
 
     // *** AXIS *****************************************************************
-    assign m_axis_tdata = data_reg[wr_ptr_cv];
+    assign m_axis_tdata = out_reg[wr_ptr_cv];
     assign m_axis_tvalid = (mm2sstate_cs == S_WRITE_STREAM) ? 1 : 0;
     assign m_axis_tlast = tlast_cv;
     
@@ -285,30 +435,65 @@ module axi_vlctx_control
         begin
             mm2sstate_cs <= S_IDLE;
             wr_ptr_cv <= 0;
+            ld_ptr_cv <= 0;
             tlast_cv <= 0;
+            fifo_rd_cv <= 0;
+            busy_reg <= 0;
         end
         else
         begin
             mm2sstate_cs <= mm2sstate_ns;
             wr_ptr_cv <= wr_ptr_nv;
+            ld_ptr_cv <= ld_ptr_nv;
             tlast_cv <= tlast_nv;
+            // Head symbol copied to out_reg, its slot is free
+            if ((mm2sstate_cs == S_LOAD) && (ld_ptr_cv == C_SYM_WORDS))
+                fifo_rd_cv <= fifo_rd_cv + 1;
+            // One symbol in the modulator until done_tick
+            if ((mm2sstate_cs == S_LOAD) && (ld_ptr_cv == C_SYM_WORDS))
+                busy_reg <= 1;
+            else if (done_tick)
+                busy_reg <= 0;
         end 
     end
+
+    // *** out_reg[0:C_SYM_WORDS-1], fifo_rdata is the word read one clock before,
+    // words after the ones written to the slot are zero ***
+    always @(posedge aclk)
+    begin
+        if ((mm2sstate_cs == S_LOAD) && (ld_ptr_cv != 0))
+            out_reg[ld_ptr_cv-1] <= (ld_ptr_cv <= fifo_num[fifo_rd_cv[C_FIFO_BITS-1:0]]) ?
+                                    fifo_rdata : 0;
+    end
     
     // *** AXIS state next ***
     always @(*)
     begin
         mm2sstate_ns = mm2sstate_cs;
         wr_ptr_nv = wr_ptr_cv;
+        ld_ptr_nv = ld_ptr_cv;
         tlast_nv = tlast_cv;
         case (mm2sstate_cs)
             S_IDLE:
             begin
-                if (start_reg)
+                if (!fifo_empty_w && !busy_reg)
+                begin
+                    mm2sstate_ns = S_LOAD;
+                    ld_ptr_nv = 0;
+                end
+            end
+            S_LOAD:
+            begin
+                if (ld_ptr_cv == C_SYM_WORDS)
                 begin
                     mm2sstate_ns = S_WRITE_STREAM;
+                    ld_ptr_nv = 0;
                     if (num_words_w == 1)
-                        tlast_nv = 1;    
+                        tlast_nv = 1;
+                end
+                else
+                begin
+                    ld_ptr_nv = ld_ptr_cv + 1;
                 end
             end
             S_WRITE_STREAM:
@@ -317,7 +502,7 @@ module axi_vlctx_control
                 begin
                     if (wr_ptr_cv == num_words_w-1)
                     begin
-                        mm2sstate_ns = S_IDLE;
+                        mm2sstate_ns = S_WAIT_DONE;
                         wr_ptr_nv = 0;
                         tlast_nv = 0;
                     end
@@ -331,20 +516,30 @@ module axi_vlctx_control
                     end
                 end
             end
+            S_WAIT_DONE:
+            begin
+                if (!busy_reg)
+                    mm2sstate_ns = S_IDLE;
+            end
         endcase
     end
 
     // *** IFFT configuration ***************************************************
-    // Bit 5~0  = cp_len[5:0]     = 8
-    // Bit 8    = fwd_inv         = 0 (inverse)
-    // Bit 14~9 = scale_sch[14:9] = 0b101010 (default scaling for radix-4), see Xilinx's datasheet
-    // 0b0101_0100_0000_1000 = 0x5408
-    assign ifft_config = 16'h5408;
+    // Bit 7~0   = cp_len         = C_CP_LEN, C_FFT_BITS bits used
+    // Bit 8     = fwd_inv        = 0 (inverse)
+    // Bit 16~9  = scale_sch      = 0b101010 (64), 0b01101010 (128), 0b10101010 (256),
+    //                              see Xilinx's datasheet. Scaled by N in total as
+    //                              at 64 points, the demodulator thresholds hold.
+    // 64 points: 0b0101_0100_0000_1000 = 0x5408, bit 23~16 are 0
+    localparam [14:0] C_SCALE_SCH = (C_FFT_BITS == 6) ? 15'b101010 :
+                                    ((C_FFT_BITS == 7) ? 15'b01101010 : 15'b10101010);
+    localparam [7:0] C_CP_FIELD = C_CP_LEN;
+    assign ifft_config = {C_SCALE_SCH, 1'b0, C_CP_FIELD};
     assign ifft_config_en = 1;
 	
 	// *** IFFT IP core settings ***
 	// Number of Channels  = 1
-	// Transform Length    = 64
+	// Transform Length    = 2^C_FFT_BITS (64 - 256)
 	// Architecture Choice = Radix-4, Burst I/O
 	// Data Formats        = Fixed Point
 	// Scaling Options     = Scaled
@@ -2,18 +2,23 @@
 // Date  : 15 Jan 2018
 // Update: 01 Jul 2018 - Porting to RedPitaya
 //	       04 Feb 2019 - GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - FFT size from C_FFT_BITS
 
 
 `timescale 1ns / 1ps
 
 module axis_demodulator
+    #(
+        parameter C_FFT_BITS = 6,       // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_S_AXIS_TDATA_WIDTH = (C_FFT_BITS == 8) ? 64 : 48
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
         input wire         aresetn,
         // *** AXI4-stream slave port ***
         output wire        s_axis_tready,
-        input wire [47:0]  s_axis_tdata,
+        input wire [C_S_AXIS_TDATA_WIDTH-1:0] s_axis_tdata,
         input wire         s_axis_tvalid,
         input wire         s_axis_tlast,
         // *** AXI4-stream master port ***
@@ -48,7 +53,7 @@ module axis_demodulator
     assign en_qpsk = (demod_type == 1) ? 1 : 0;
     assign en_qam16 = (demod_type == 2) ? 1 : 0;
 
-    axis_bpsk_demod axis_bpsk_demod_0
+    axis_bpsk_demod #(.C_FFT_BITS(C_FFT_BITS), .C_S_AXIS_TDATA_WIDTH(C_S_AXIS_TDATA_WIDTH)) axis_bpsk_demod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -63,7 +68,7 @@ module axis_demodulator
         .en(en_bpsk)
     );
 
-    axis_qpsk_demod axis_qpsk_demod_0
+    axis_qpsk_demod #(.C_FFT_BITS(C_FFT_BITS), .C_S_AXIS_TDATA_WIDTH(C_S_AXIS_TDATA_WIDTH)) axis_qpsk_demod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -78,7 +83,7 @@ module axis_demodulator
         .en(en_qpsk)
     );
 
-    axis_qam16_demod axis_qam16_demod_0
+    axis_qam16_demod #(.C_FFT_BITS(C_FFT_BITS), .C_S_AXIS_TDATA_WIDTH(C_S_AXIS_TDATA_WIDTH)) axis_qam16_demod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -2,18 +2,23 @@
 // Date  : 15 Jan 2018
 // Update: 01 Jul 2018 - Porting to RedPitaya
 //	       04 Feb 2019 - GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - FFT size from C_FFT_BITS
 
 
 `timescale 1ns / 1ps
 
 module axis_qam16_demod
+    #(
+        parameter C_FFT_BITS = 6,       // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_S_AXIS_TDATA_WIDTH = (C_FFT_BITS == 8) ? 64 : 48
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
         input wire         aresetn,
         // *** AXI4-stream slave port ***
         output wire        s_axis_tready,
-        input wire [47:0]  s_axis_tdata,
+        input wire [C_S_AXIS_TDATA_WIDTH-1:0] s_axis_tdata,
         input wire         s_axis_tvalid,
         input wire         s_axis_tlast,
         // *** AXI4-stream master port ***
@@ -27,15 +32,20 @@ module axis_qam16_demod
     
     localparam S_READ = 2'h0,
                S_WRITE = 2'h1;
+    // The FFT output grows by C_FFT_BITS+1 bits, but with 14-bit ADC data
+    // in the 16-bit input 23 bits hold it up to 256 points
+    localparam C_N = 1 << C_FFT_BITS;
+    localparam C_LANE = C_S_AXIS_TDATA_WIDTH/2;
                  
     reg [1:0] _cs, _ns;
-    reg [5:0] cnt_rd_cv, cnt_rd_nv;
-    reg [4:0] cnt_wr_cv, cnt_wr_nv;
+    reg [C_FFT_BITS-1:0] cnt_rd_cv, cnt_rd_nv;
+    reg [C_FFT_BITS-1:0] cnt_wr_cv, cnt_wr_nv;
     wire [22:0] data_in_re_w, data_in_im_w;
     wire [3:0] data_demod_w;    
     reg m_axis_tlast_cv, m_axis_tlast_nv;
-    reg [3:0] data_demod [0:31];
+    reg [3:0] data_demod [0:C_N/2-1];
     integer i;
+    genvar k;
 
     qam16_demod qam16_demod_0
     (
@@ -45,32 +55,31 @@ module axis_qam16_demod
     );
     
     assign data_in_re_w = s_axis_tdata[22:0];
-    assign data_in_im_w = s_axis_tdata[46:24];
+    assign data_in_im_w = s_axis_tdata[C_LANE+22:C_LANE];
     assign s_axis_tready = (_cs == S_READ) ? 1 : 0;
-    assign m_axis_tdata = (cnt_wr_cv <= 17) ? 
-                          {data_demod[cnt_wr_cv+0], data_demod[cnt_wr_cv+1],
-                           data_demod[cnt_wr_cv+2], data_demod[cnt_wr_cv+3],
-                           data_demod[cnt_wr_cv+4], data_demod[cnt_wr_cv+5],
-                           data_demod[cnt_wr_cv+6], data_demod[cnt_wr_cv+7]} :
-                          {data_demod[cnt_wr_cv+0], data_demod[cnt_wr_cv+1],
-                           data_demod[cnt_wr_cv+2], data_demod[cnt_wr_cv+3],
-                           data_demod[cnt_wr_cv+4], data_demod[cnt_wr_cv+5],
-                           data_demod[cnt_wr_cv+6], 4'b0000};
     assign m_axis_tvalid = ((_cs == S_WRITE)) ? 1 : 0;
     assign m_axis_tlast = m_axis_tlast_cv;
+    
+    // *** Output word, subcarrier N/2 is not used and gives 0 bits ***
+    generate
+        for (k = 0; k <= 7; k = k+1)
+        begin: g_word
+            assign m_axis_tdata[31-4*k -: 4] = (cnt_wr_cv+k < C_N/2) ? data_demod[cnt_wr_cv+k] : 0;
+        end
+    endgenerate
         
     always @(posedge aclk)
     begin
         if (!aresetn)
         begin
-            for (i = 0; i <= 31; i = i+1)
+            for (i = 0; i <= C_N/2-1; i = i+1)
                 data_demod[i] <= 0;
         end
         else
         begin
             if (en)
             begin
-                if (s_axis_tvalid)
+                if (s_axis_tvalid && cnt_rd_cv < C_N/2)
                     data_demod[cnt_rd_cv] <= data_demod_w;
             end
         end
@@ -111,7 +120,7 @@ module axis_qam16_demod
                     if (s_axis_tvalid)
                     begin
                         cnt_rd_nv = cnt_rd_cv + 1;
-                        if (cnt_rd_cv == 63)
+                        if (cnt_rd_cv == C_N-1)
                         begin
                             _ns = S_WRITE; 
                             cnt_rd_nv = 0;
@@ -122,7 +131,7 @@ module axis_qam16_demod
                 begin
                     if (m_axis_tready)
                     begin
-                        if (cnt_wr_cv == 25)
+                        if (cnt_wr_cv == C_N/2-7)
                         begin
                             _ns = S_READ;
                             cnt_wr_nv = 1;
@@ -131,7 +140,7 @@ module axis_qam16_demod
                         else
                         begin
                             cnt_wr_nv = cnt_wr_cv + 8;
-                            if (cnt_wr_cv == 17)
+                            if (cnt_wr_cv == C_N/2-15)
                                 m_axis_tlast_nv = 1;
                         end
                     end
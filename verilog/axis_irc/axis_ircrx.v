@@ -2,6 +2,8 @@
 // Date  : 11 Mar 2018
 // Update: 26 Sep 2018 - Porting to RedPitaya
 //         07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add baseband Manchester and 4-PPM modes with majority
+//                       vote slot detection
 
 `timescale 1ns / 1ps
 
@@ -20,29 +22,69 @@ module axis_ircrx
         output wire        m_axis_tvalid,
         // *** IRC signals ***
         input  wire [15:0] mod_m,
+        input  wire [1:0]  mode,
         input  wire        rx
     );
     
+    // *** Line coding, mode, see axis_irctx ***
+    // 0: UART 8N1, 1: Manchester, 2: 4-PPM
+    // In mode 1 and 2 each slot is sampled on ticks C_VOTE_FIRST to
+    // C_VOTE_LAST and the number of 1 samples decides: a Manchester bit is 1
+    // when its second slot has more, a PPM symbol is the slot with the fewest.
+    // A start slot that does not vote 0 is a glitch and is ignored.
+    localparam [1:0] C_MODE_UART = 2'd0,
+                     C_MODE_MAN = 2'd1,
+                     C_MODE_PPM = 2'd2;
+    localparam C_VOTE_FIRST = 5,
+               C_VOTE_LAST = 11;
+    
     localparam [2:0] S_IDLE = 3'b000,
                      S_START = 3'b001,
                      S_DATA = 3'b010,
                      S_STOP = 3'b011,
-                     S_WR_STREAM = 3'b100;
+                     S_WR_STREAM = 3'b100,
+                     S_BB_START = 3'b101,
+                     S_BB_DATA = 3'b110,
+                     S_BB_STOP = 3'b111;
     
     reg [2:0] rx_cs, rx_ns;
     reg [3:0] cnt_btick_cv, cnt_btick_nv;
     reg [2:0] cnt_bit_cv, cnt_bit_nv;
+    reg [3:0] cnt_slot_cv, cnt_slot_nv;
     reg [7:0] data_cv, data_nv;
+    // *** Slot vote ***
+    reg [2:0] ones_cv, ones_nv;         // 1 samples in the current slot
+    reg [2:0] prev_cv, prev_nv;         // Manchester first slot, PPM fewest
+    reg [1:0] arg_cv, arg_nv;           // PPM slot with the fewest
+    wire [2:0] ones_w;
     wire btick;
+    wire [15:0] mod_m_w;
+    reg [1:0] rx_sync;
+
+    // The UART keeps its fixed tick, the slot rate is programmable
+    assign mod_m_w = (mode == C_MODE_UART) ? 16'd8 : mod_m;
 
     baud_gen baud_gen_0
     (
         .clk(aclk),
         .rst_n(aresetn),
-        .mod_m(8),
+        .mod_m(mod_m_w),
         .btick(btick)
     );
 
+    // *** rx into the clock domain, for the baseband modes ***
+    always @(posedge aclk)
+    begin
+        if (!aresetn)
+            rx_sync <= 2'b11;
+        else
+            rx_sync <= {rx_sync[0], rx};
+    end
+
+    // Count of the slot with this tick's sample
+    assign ones_w = ((cnt_btick_cv >= C_VOTE_FIRST) && (cnt_btick_cv <= C_VOTE_LAST) &&
+                     rx_sync[1]) ? ones_cv + 1 : ones_cv;
+
     assign m_axis_tdata = data_cv;
     assign m_axis_tvalid = (rx_cs == S_WR_STREAM) ? 1 : 0;
 
@@ -53,14 +95,22 @@ module axis_ircrx
             rx_cs <= S_IDLE;
             cnt_btick_cv <= 0;
             cnt_bit_cv <= 0;
+            cnt_slot_cv <= 0;
             data_cv <= 0;
+            ones_cv <= 0;
+            prev_cv <= 0;
+            arg_cv <= 0;
         end
         else
         begin
             rx_cs <= rx_ns;
             cnt_btick_cv <= cnt_btick_nv;
             cnt_bit_cv <= cnt_bit_nv;
+            cnt_slot_cv <= cnt_slot_nv;
             data_cv <= data_nv;
+            ones_cv <= ones_nv;
+            prev_cv <= prev_nv;
+            arg_cv <= arg_nv;
         end
     end
 
@@ -69,15 +119,25 @@ module axis_ircrx
         rx_ns = rx_cs;
         cnt_btick_nv = cnt_btick_cv;
         cnt_bit_nv = cnt_bit_cv;
+        cnt_slot_nv = cnt_slot_cv;
         data_nv = data_cv;
+        ones_nv = ones_cv;
+        prev_nv = prev_cv;
+        arg_nv = arg_cv;
         case (rx_cs)
             S_IDLE:
             begin
-                if (!rx)
+                if ((mode == C_MODE_UART) && !rx)
                 begin
                     rx_ns = S_START;
                     cnt_btick_nv = 0;
                 end
+                else if ((mode != C_MODE_UART) && !rx_sync[1])
+                begin
+                    rx_ns = S_BB_START;
+                    cnt_btick_nv = 0;
+                    ones_nv = 0;
+                end
             end
             S_START:
             begin
@@ -135,6 +195,78 @@ module axis_ircrx
                     rx_ns = S_IDLE;
                 end
             end
+            S_BB_START:
+            begin
+                if (btick)
+                begin
+                    ones_nv = ones_w;
+                    if (cnt_btick_cv == 15)
+                    begin
+                        cnt_btick_nv = 0;
+                        cnt_slot_nv = 0;
+                        ones_nv = 0;
+                        // Start slot must vote 0
+                        if (ones_w > (C_VOTE_LAST-C_VOTE_FIRST+1)/2)
+                            rx_ns = S_IDLE;
+                        else
+                            rx_ns = S_BB_DATA;
+                    end
+                    else
+                    begin
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                    end
+                end
+            end
+            S_BB_DATA:
+            begin
+                if (btick)
+                begin
+                    ones_nv = ones_w;
+                    if (cnt_btick_cv == 15)
+                    begin
+                        cnt_btick_nv = 0;
+                        ones_nv = 0;
+                        if (mode == C_MODE_MAN)
+                        begin
+                            // Bit from the second slot of the pair
+                            if (!cnt_slot_cv[0])
+                                prev_nv = ones_w;
+                            else
+                                data_nv = {(ones_w > prev_cv), data_cv[7:1]};
+                        end
+                        else
+                        begin
+                            // Fewest 1 samples of the 4 slots is the pulse
+                            if ((cnt_slot_cv[1:0] == 0) || (ones_w < prev_cv))
+                            begin
+                                prev_nv = ones_w;
+                                arg_nv = cnt_slot_cv[1:0];
+                            end
+                            if (cnt_slot_cv[1:0] == 3)
+                                data_nv = {((ones_w < prev_cv) ? 2'd3 : arg_cv), data_cv[7:2]};
+                        end
+                        if (cnt_slot_cv == 15)          // 16 data slots
+                            rx_ns = S_BB_STOP;
+                        else
+                            cnt_slot_nv = cnt_slot_cv + 1;
+                    end
+                    else
+                    begin
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                    end
+                end
+            end
+            S_BB_STOP:
+            begin
+                // Half the stop slot, the next start edge is found in S_IDLE
+                if (btick)
+                begin
+                    if (cnt_btick_cv == 7)
+                        rx_ns = S_WR_STREAM;
+                    else
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                end
+            end
         endcase
     end
     
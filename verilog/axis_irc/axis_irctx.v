@@ -2,6 +2,7 @@
 // Date  : 11 Mar 2018
 // Update: 26 Sep 2018 - Porting to RedPitaya
 //         07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add baseband Manchester and 4-PPM modes
 
 `timescale 1ns / 1ps
 
@@ -21,28 +22,60 @@ module axis_irctx
         // *** IRC signals ***
         input  wire [15:0] mod_m,
         input  wire        mod_38khz_en,
+        input  wire [1:0]  mode,
         output wire        tx_mod
     );
 
-    localparam [1:0] S_IDLE = 2'b000,
-                     S_START = 2'b001,
-                     S_DATA = 2'b010,
-                     S_STOP = 2'b011;
+    // *** Line coding, mode ***
+    // 0: UART 8N1, 16 ticks per bit, tick = 8 clocks
+    // 1: Manchester, bit 1 = slots (0, 1), bit 0 = slots (1, 0)
+    // 2: 4-PPM, 2 bits per 4 slots, the pulse (0) in slot number {b1, b0}
+    // In mode 1 and 2 a byte is a start slot (0), 16 data slots from bit 0,
+    // and a stop slot (1). A slot is 16 ticks of mod_m clocks. Both modes
+    // are meant for the baseband line (mod_38khz_en = 0): Manchester is DC
+    // free, 4-PPM has a 1/4 pulse duty cycle.
+    localparam [1:0] C_MODE_UART = 2'd0,
+                     C_MODE_MAN = 2'd1,
+                     C_MODE_PPM = 2'd2;
+
+    localparam [2:0] S_IDLE = 3'b000,
+                     S_START = 3'b001,
+                     S_DATA = 3'b010,
+                     S_STOP = 3'b011,
+                     S_BB_START = 3'b100,
+                     S_BB_DATA = 3'b101,
+                     S_BB_STOP = 3'b110;
     
-    reg [1:0] tx_cs, tx_ns;
+    reg [2:0] tx_cs, tx_ns;
     reg [3:0] cnt_btick_cv, cnt_btick_nv;
     reg [2:0] cnt_bit_cv, cnt_bit_nv;
+    reg [3:0] cnt_slot_cv, cnt_slot_nv;
     reg [7:0] data_cv, data_nv;
     reg tx_cv, tx_nv;
     wire btick;
+    wire [15:0] mod_m_w;
+    reg slot_w;
+
+    // The UART keeps its fixed tick, the slot rate is programmable
+    assign mod_m_w = (mode == C_MODE_UART) ? 16'd8 : mod_m;
     
     baud_gen baud_gen_0
     (
         .clk(aclk),
         .rst_n(aresetn),
-        .mod_m(8),
+        .mod_m(mod_m_w),
         .btick(btick)
     );
+
+    // *** Level of data slot cnt_slot_cv ***
+    always @(*)
+    begin
+        if (mode == C_MODE_MAN)
+            slot_w = (cnt_slot_cv[0]) ? data_cv[cnt_slot_cv[3:1]] : ~data_cv[cnt_slot_cv[3:1]];
+        else
+            slot_w = (cnt_slot_cv[1:0] == {data_cv[{cnt_slot_cv[3:2], 1'b1}],
+                                           data_cv[{cnt_slot_cv[3:2], 1'b0}]}) ? 0 : 1;
+    end
        
     mod_38khz mod_38khz_0
     (
@@ -62,6 +95,7 @@ module axis_irctx
             tx_cs <= S_IDLE;
             cnt_btick_cv <= 0;
             cnt_bit_cv <= 0;
+            cnt_slot_cv <= 0;
             data_cv <= 0;
             tx_cv <= 1;
         end
@@ -70,6 +104,7 @@ module axis_irctx
             tx_cs <= tx_ns;
             cnt_btick_cv <= cnt_btick_nv;
             cnt_bit_cv <= cnt_bit_nv;
+            cnt_slot_cv <= cnt_slot_nv;
             data_cv <= data_nv;
             tx_cv <= tx_nv;
         end
@@ -80,6 +115,7 @@ module axis_irctx
         tx_ns = tx_cs;
         cnt_btick_nv = cnt_btick_cv;
         cnt_bit_nv = cnt_bit_cv;
+        cnt_slot_nv = cnt_slot_cv;
         data_nv = data_cv;
         tx_nv = tx_cv;   
         case (tx_cs)
@@ -88,7 +124,7 @@ module axis_irctx
                 tx_nv = 1;
                 if (s_axis_tvalid)
                 begin
-                    tx_ns = S_START;
+                    tx_ns = (mode == C_MODE_UART) ? S_START : S_BB_START;
                     cnt_btick_nv = 0;
                     data_nv = s_axis_tdata;
                 end
@@ -145,6 +181,53 @@ module axis_irctx
                     end
                 end
             end
+            S_BB_START:
+            begin
+                tx_nv = 0;
+                if (btick)
+                begin
+                    if (cnt_btick_cv == 15)
+                    begin
+                        tx_ns = S_BB_DATA;
+                        cnt_btick_nv = 0;
+                        cnt_slot_nv = 0;
+                    end
+                    else
+                    begin
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                    end
+                end
+            end
+            S_BB_DATA:
+            begin
+                tx_nv = slot_w;
+                if (btick)
+                begin
+                    if (cnt_btick_cv == 15)
+                    begin
+                        cnt_btick_nv = 0;
+                        if (cnt_slot_cv == 15)          // 16 data slots
+                            tx_ns = S_BB_STOP;
+                        else
+                            cnt_slot_nv = cnt_slot_cv + 1;
+                    end
+                    else
+                    begin
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                    end
+                end
+            end
+            S_BB_STOP:
+            begin
+                tx_nv = 1;
+                if (btick)
+                begin
+                    if (cnt_btick_cv == 15)
+                        tx_ns = S_IDLE;
+                    else
+                        cnt_btick_nv = cnt_btick_cv + 1;
+                end
+            end
         endcase
     end
   
@@ -2,10 +2,14 @@
 // Date  : 6 Jan 2018
 // Update: 15 Jul 2018 - Porting to RedPitaya
 //	       04 Feb 2019 - GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - FFT size from C_FFT_BITS
 
 `timescale 1ns / 1ps
 
 module axis_bpsk_mod
+    #(
+        parameter C_FFT_BITS = 6        // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
@@ -27,15 +31,18 @@ module axis_bpsk_mod
     localparam S_READ = 2'h0,
                S_MAP = 2'h1,
                S_WRITE = 2'h2;
+    localparam C_N = 1 << C_FFT_BITS;
+    localparam C_N_CAR = C_N/2 - 1;     // Data subcarriers 1 - N/2-1, conjugate in N/2+1 - N-1
     
     reg [1:0] _cs, _ns;
-    reg [4:0] cnt_map_cv, cnt_map_nv;
-    reg [5:0] cnt_wr_cv, cnt_wr_nv;
+    reg [C_FFT_BITS-1:0] cnt_rd_cv, cnt_rd_nv;
+    reg [C_FFT_BITS-1:0] cnt_map_cv, cnt_map_nv;
+    reg [C_FFT_BITS-1:0] cnt_wr_cv, cnt_wr_nv;
     wire data_in_w;
     wire [31:0] data_mod_w, data_conj_w;
     reg m_axis_tlast_cv, m_axis_tlast_nv;
-    reg data_mem [0:31];
-    reg [31:0] subcar_mem [0:63];
+    reg data_mem [0:C_N/2-1];
+    reg [31:0] subcar_mem [0:C_N-1];
     integer i;
     
     // *** BPSK modulator ***
@@ -57,7 +64,7 @@ module axis_bpsk_mod
     begin
         if (!aresetn)
         begin
-            for (i = 0; i <= 31; i = i+1)
+            for (i = 0; i <= C_N/2-1; i = i+1)
                 data_mem[i] <= 0;
         end
         else
@@ -67,7 +74,7 @@ module axis_bpsk_mod
                 if (s_axis_tvalid)
                 begin
                     for (i = 0; i <= 31; i = i+1)
-                        data_mem[i] <= s_axis_tdata[31-i];
+                        data_mem[cnt_rd_cv+i] <= s_axis_tdata[31-i];
                 end
             end
         end
@@ -78,7 +85,7 @@ module axis_bpsk_mod
     begin
         if (!aresetn)
         begin
-            for (i = 0; i <= 63; i = i+1)
+            for (i = 0; i <= C_N-1; i = i+1)
                 subcar_mem[i] <= 0;
         end
         else
@@ -88,7 +95,7 @@ module axis_bpsk_mod
                 if (_cs == S_MAP)
                 begin
                     subcar_mem[cnt_map_cv+1] <= data_mod_w;
-                    subcar_mem[64-cnt_map_cv-1] <= data_conj_w;
+                    subcar_mem[C_N-cnt_map_cv-1] <= data_conj_w;
                 end
             end
         end
@@ -99,6 +106,7 @@ module axis_bpsk_mod
         if (!aresetn)
         begin
             _cs <= S_READ;
+            cnt_rd_cv <= 0;
             cnt_map_cv <= 0;
             cnt_wr_cv <= 0;
             m_axis_tlast_cv <= 0;
@@ -108,6 +116,7 @@ module axis_bpsk_mod
             if (en)
             begin
                 _cs <= _ns;
+                cnt_rd_cv <= cnt_rd_nv;
                 cnt_map_cv <= cnt_map_nv;
                 cnt_wr_cv <= cnt_wr_nv;
                 m_axis_tlast_cv <= m_axis_tlast_nv;
@@ -118,6 +127,7 @@ module axis_bpsk_mod
     always @(*)
     begin
         _ns = _cs;
+        cnt_rd_nv = cnt_rd_cv;
         cnt_map_nv = cnt_map_cv;
         cnt_wr_nv = cnt_wr_cv;
         m_axis_tlast_nv = m_axis_tlast_cv;
@@ -128,13 +138,18 @@ module axis_bpsk_mod
                 begin
                     if (s_axis_tvalid)
                     begin
-                        _ns = S_MAP; 
+                        cnt_rd_nv = cnt_rd_cv + 32;
+                        if (cnt_rd_cv == C_N/2-32)
+                        begin
+                            _ns = S_MAP; 
+                            cnt_rd_nv = 0;
+                        end
                     end
                 end
                 S_MAP:
                 begin
                     cnt_map_nv = cnt_map_cv + 1;
-                    if (cnt_map_cv == 30)
+                    if (cnt_map_cv == C_N_CAR-1)
                     begin
                         _ns = S_WRITE; 
                         cnt_map_nv = 0;
@@ -144,7 +159,7 @@ module axis_bpsk_mod
                 begin
                     if (m_axis_tready)
                     begin
-                        if (cnt_wr_cv == 63)
+                        if (cnt_wr_cv == C_N-1)
                         begin
                             _ns = S_READ;
                             cnt_wr_nv = 0;
@@ -153,7 +168,7 @@ module axis_bpsk_mod
                         else
                         begin
                             cnt_wr_nv = cnt_wr_cv + 1;
-                            if (cnt_wr_cv == 62)
+                            if (cnt_wr_cv == C_N-2)
                                 m_axis_tlast_nv = 1;
                         end
                     end
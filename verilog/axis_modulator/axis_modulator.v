@@ -2,10 +2,14 @@
 // Date  : 6 Jan 2018
 // Update: 15 Jul 2018 - Porting to RedPitaya
 //	       04 Feb 2019 - GitHub first commit, from lifi_ap_functional_daa
+//         19 Oct 2026 - FFT size from C_FFT_BITS
 
 `timescale 1ns / 1ps
 
 module axis_modulator
+    #(
+        parameter C_FFT_BITS = 6        // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
@@ -47,7 +51,7 @@ module axis_modulator
     assign en_qpsk = (mod_type == 1) ? 1 : 0;
     assign en_qam16 = (mod_type == 2) ? 1 : 0;
 
-    axis_bpsk_mod axis_bpsk_mod_0
+    axis_bpsk_mod #(.C_FFT_BITS(C_FFT_BITS)) axis_bpsk_mod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -62,7 +66,7 @@ module axis_modulator
         .en(en_bpsk) 
     );
    
-    axis_qpsk_mod axis_qpsk_mod_0
+    axis_qpsk_mod #(.C_FFT_BITS(C_FFT_BITS)) axis_qpsk_mod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -77,7 +81,7 @@ module axis_modulator
         .en(en_qpsk) 
     );
                                    
-    axis_qam16_mod axis_qam16_mod_0
+    axis_qam16_mod #(.C_FFT_BITS(C_FFT_BITS)) axis_qam16_mod_0
     (
         .aclk(aclk),
         .aresetn(aresetn),
@@ -5,10 +5,17 @@
 //         30 Agt 2018 - Remove preamble CP
 //	       04 Feb 2019 - GitHub first commit, from lifi_ap_functional_daa
 //         04 Feb 2019 - Add upsample with factor N = 25, change name to axis_preamble
+//         19 Oct 2026 - Add burst mode, one preamble for up to burst_max symbols
+//         19 Oct 2026 - Upsample factor from up_factor port, 1 - 25
+//         19 Oct 2026 - Symbol length from C_FFT_BITS and C_CP_LEN
 
 `timescale 1ns / 1ps
 
 module axis_preamble
+    #(
+        parameter C_FFT_BITS = 6,       // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_CP_LEN = 8          // Cyclic prefix samples, as in ifft_config
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
@@ -25,30 +32,67 @@ module axis_preamble
         output wire        m_axis_tlast,
         // *** User port ***
         input  wire [7:0]  guard_interval,  // 0 - 216 (0, 72, 144, 216)
+        input  wire [7:0]  burst_max,       // Symbols per preamble, 0 or 1 = no burst
+        input  wire [4:0]  up_factor,       // Upsample factor, sample and hold
         output reg         done_tick
     );
     
+    // *** Transmit memory ***
+    // The preamble (8 CP + 4 x 16 samples for the synchronizer) does not
+    // depend on the FFT size, the data symbol is C_CP_LEN + 2^C_FFT_BITS
+    // samples from the IFFT.
+    localparam C_PRE_LEN = 72;
+    localparam C_SYM_LEN = C_CP_LEN + (1 << C_FFT_BITS);
+    localparam C_DATA0 = C_PRE_LEN;
+    localparam C_DATA_END = C_DATA0 + C_SYM_LEN - 1;    // 143 with 64 + 8
+    localparam C_GUARD = C_DATA_END + 1;                // 144
+    localparam C_GUARD_MAX = 216;
+    localparam C_DATA1 = C_GUARD + C_GUARD_MAX;         // 360
+    localparam C_MEM_LEN = C_DATA1 + C_SYM_LEN;         // 432
+
+    // *** Burst mode ***
+    // With burst_max > 1 the data of the next symbol follows the current one
+    // right away, without preamble and guard interval, when it is already
+    // buffered, up to burst_max symbols. The guard interval closes the burst.
+    // Symbols are read into two data buffers and done_tick is given as soon
+    // as one is read, so the next symbol comes through the IFFT while the
+    // current one is sent. Without burst done_tick is given after the guard
+    // interval as before.
     localparam S_READ = 2'h0,
                S_WRITE = 2'h1,
                S_DONE = 2'h2;
-    localparam UP_FACTOR = 25;
     
     reg [1:0] _cs, _ns;
-    reg [7:0] cnt_rd_cv, cnt_rd_nv;
-    reg [8:0] cnt_wr_cv, cnt_wr_nv;
+    reg [8:0] cnt_rd_cv;
+    reg [9:0] cnt_wr_cv, cnt_wr_nv;
     reg [7:0] cnt_up_cv, cnt_up_nv;    // Upsample counter
     reg m_axis_tlast_cv, m_axis_tlast_nv;
     wire signed [15:0] s_axis_tdata_16bit_w;
     wire signed [15:0] s_axis_tdata_max_checked_w;
     wire signed [13:0] s_axis_tdata_14bit_w;
-    reg signed [13:0] tx_mem [0:359];  // 72 preamble + 72 data + 3*72 guard interval
+    reg signed [13:0] tx_mem [0:C_MEM_LEN-1];  // Preamble + data + 3*72 guard interval + data
     reg [7:0] gi_reg;
     integer i;
+    // *** Data buffers, C_DATA0 and C_DATA1 ***
+    reg in_buf_cv, out_buf_cv, out_buf_nv;
+    reg [1:0] full_cv;
+    reg buf_free;                       // out_buf sent
+    wire s_hs, burst_on_w, cont_w;
+    wire [9:0] in_addr_w, out_addr_w;
+    reg [7:0] cnt_burst_cv, cnt_burst_nv;
+    reg cont_cv, cont_nv;
     
-    assign s_axis_tready = (_cs == S_READ) ? 1 : 0;
-    assign m_axis_tdata = tx_mem[cnt_wr_cv];
+    assign s_hs = s_axis_tvalid & s_axis_tready;
+    assign s_axis_tready = ~full_cv[in_buf_cv];
+    assign m_axis_tdata = tx_mem[out_addr_w];
     assign m_axis_tvalid = (_cs == S_WRITE) ? 1 : 0;
     assign m_axis_tlast = m_axis_tlast_cv;
+    assign in_addr_w = ((in_buf_cv) ? C_DATA1 : C_DATA0) + cnt_rd_cv;
+    assign out_addr_w = (cnt_wr_cv >= C_DATA0 && cnt_wr_cv <= C_DATA_END && out_buf_cv) ?
+                        cnt_wr_cv + (C_DATA1 - C_DATA0) : cnt_wr_cv;
+    assign burst_on_w = (burst_max > 1);
+    // Next symbol of the burst is ready
+    assign cont_w = burst_on_w && (cnt_burst_cv < burst_max) && full_cv[~out_buf_cv];
     
     // *** Check OFDM data max peak (PAPR reduction) ***
     assign s_axis_tdata_16bit_w = s_axis_tdata[15:0];
@@ -133,17 +177,45 @@ module axis_preamble
             tx_mem[70] <= 1505;
             tx_mem[71] <= 2351;
             // *** Data ***
-            for (i = 72; i <= 143; i = i+1) // 64 135
+            for (i = C_DATA0; i <= C_DATA_END; i = i+1) // 64 135
                 tx_mem[i] <= 0;
-            // *** Guard interval ***
-            for (i = 144; i <= 359; i = i+1) // 136 351
+            // *** Guard interval, second data buffer ***
+            for (i = C_GUARD; i <= C_MEM_LEN-1; i = i+1) // 136 351
                 tx_mem[i] <= 0;
         end
         else
         begin
             // *** OFDM data + CP from IFFT output ***
-            if (s_axis_tvalid)
-                tx_mem[cnt_rd_cv] <= s_axis_tdata_14bit_w;
+            if (s_hs)
+                tx_mem[in_addr_w] <= s_axis_tdata_14bit_w;
+        end
+    end
+
+    // *** Read IFFT output into the free data buffer ***
+    always @(posedge aclk)
+    begin
+        if (!aresetn)
+        begin
+            cnt_rd_cv <= 0;
+            in_buf_cv <= 0;
+            full_cv <= 0;
+        end
+        else
+        begin
+            if (s_hs)
+            begin
+                cnt_rd_cv <= cnt_rd_cv + 1;
+                if (s_axis_tlast)
+                begin
+                    cnt_rd_cv <= 0;
+                    in_buf_cv <= ~in_buf_cv;
+                end
+            end
+            // Different buffers when both happen
+            if (s_hs && s_axis_tlast)
+                full_cv[in_buf_cv] <= 1;
+            if (buf_free)
+                full_cv[out_buf_cv] <= 0;
         end
     end
     
@@ -152,43 +224,48 @@ module axis_preamble
         if (!aresetn)
         begin
             _cs <= S_READ;
-            cnt_rd_cv <= 72;
             cnt_wr_cv <= 0;
             cnt_up_cv <= 0;
             m_axis_tlast_cv <= 0;
             gi_reg <= 0;
+            out_buf_cv <= 0;
+            cnt_burst_cv <= 0;
+            cont_cv <= 0;
         end
         else
         begin
             _cs <= _ns;
-            cnt_rd_cv <= cnt_rd_nv;
             cnt_wr_cv <= cnt_wr_nv;
             cnt_up_cv <= cnt_up_nv;
             m_axis_tlast_cv <= m_axis_tlast_nv;
             gi_reg <= guard_interval;
+            out_buf_cv <= out_buf_nv;
+            cnt_burst_cv <= cnt_burst_nv;
+            cont_cv <= cont_nv;
         end
     end
 
     always @(*)
     begin
         _ns = _cs;
-        cnt_rd_nv = cnt_rd_cv;
         cnt_wr_nv = cnt_wr_cv;
         cnt_up_nv = cnt_up_cv;
         m_axis_tlast_nv = m_axis_tlast_cv;
-        done_tick = 0;
+        out_buf_nv = out_buf_cv;
+        cnt_burst_nv = cnt_burst_cv;
+        cont_nv = cont_cv;
+        buf_free = 0;
+        // A burst takes the symbol as soon as it is buffered
+        done_tick = burst_on_w & s_hs & s_axis_tlast;
         case (_cs)
             S_READ:
             begin
-                // *** Read IFFT output ***
-                if (s_axis_tvalid)
+                // *** Wait for a buffered OFDM symbol ***
+                if (full_cv[out_buf_cv])
                 begin
-                    cnt_rd_nv = cnt_rd_cv + 1;
-                    if (s_axis_tlast)
-                    begin
-                        _ns = S_WRITE;
-                        cnt_rd_nv = 72;
-                    end
+                    _ns = S_WRITE;
+                    cnt_wr_nv = 0;
+                    cnt_burst_nv = 1;
                 end
             end
             S_WRITE:
@@ -197,10 +274,33 @@ module axis_preamble
                 if (m_axis_tready)
                 begin
                     cnt_up_nv = cnt_up_cv + 1;
-                    if (cnt_up_cv == UP_FACTOR-1)   // Upsampling process
+                    if (cnt_up_cv == up_factor-1)   // Upsampling process
                     begin
                         cnt_up_nv = 0;
-                        if (cnt_wr_cv == 143 + gi_reg)
+                        if (cnt_wr_cv == C_DATA_END)
+                        begin
+                            // *** Data sent, next symbol of the burst or guard ***
+                            buf_free = 1;
+                            out_buf_nv = ~out_buf_cv;
+                            if (cont_cv)
+                            begin
+                                cnt_wr_nv = C_DATA0;
+                                cnt_burst_nv = cnt_burst_cv + 1;
+                            end
+                            else if (gi_reg == 0)
+                            begin
+                                _ns = S_DONE;
+                                cnt_wr_nv = 0;
+                                m_axis_tlast_nv = 0;
+                            end
+                            else
+                            begin
+                                cnt_wr_nv = C_GUARD;
+                                if (gi_reg == 1)
+                                    m_axis_tlast_nv = 1;
+                            end
+                        end
+                        else if (cnt_wr_cv == C_DATA_END + gi_reg)
                         begin
                             _ns = S_DONE;
                             cnt_wr_nv = 0;
@@ -209,7 +309,9 @@ module axis_preamble
                         else
                         begin
                             cnt_wr_nv = cnt_wr_cv + 1;
-                            if (cnt_wr_cv == 142 + gi_reg)
+                            if (cnt_wr_cv == C_DATA_END-1)
+                                cont_nv = cont_w;
+                            if ((cnt_wr_cv == C_DATA_END-1 + gi_reg) && !(cnt_wr_cv == C_DATA_END-1 && cont_w))
                                 m_axis_tlast_nv = 1;
                         end
                     end
@@ -220,7 +322,7 @@ module axis_preamble
                 // *** Generate done signal ***
                 cnt_up_nv = 0;
                 _ns = S_READ;
-                done_tick = 1;
+                done_tick = done_tick | ~burst_on_w;
             end
         endcase
     end
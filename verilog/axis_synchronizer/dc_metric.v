@@ -2,6 +2,8 @@
 // Date  : 7 Feb 2019
 // Update: 07 Feb 2019 - Change to pipeline architecture
 //		   07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Delay of 16 samples * n_downsamp
+//         19 Oct 2026 - Add energy output, sum of |in| over the same window
 
 `timescale 1ns / 1ps
 
@@ -10,13 +12,20 @@ module dc_metric
         input wire         clk,
         input wire         rst_n,
         input wire [31:0]  in,
-        output wire [31:0] out
+        input wire [4:0]   n_downsamp,
+        output wire [31:0] out,
+        output wire [31:0] energy
     );
     
     wire [31:0] in_pip, reg0_out_w, reg1_out_w, reg2_out_w;
     wire [63:0] mult_out_tmp;
     reg [63:0] mult_out_tmp_pip_reg;
     wire [31:0] mult_out_w, mult_out_w_pip, add_out_w, sub_out_w, sub_out_w_pip;
+    wire [8:0] depth_w;
+    wire [31:0] abs_in_w, reg3_out_w;
+    reg [31:0] energy_reg;
+    
+    assign depth_w = {n_downsamp, 4'b0};    // 16 preamble samples
     
 	// *** The circuit is from "OFDM Baseband Receiver Design for wireless Communications"
 	// by Tzi-Dar Chiueh and Pei-Yun Tsai, pp.96, Figure 5.7 ***
@@ -25,6 +34,7 @@ module dc_metric
         .clk(clk),
         .rst_n(rst_n),
         .d(in_pip),
+        .depth(depth_w),
         .q(reg0_out_w)
     );
     shift_reg reg1
@@ -32,6 +42,7 @@ module dc_metric
         .clk(clk),
         .rst_n(rst_n),
         .d(mult_out_w_pip),
+        .depth(depth_w),
         .q(reg1_out_w)
     );
     single_reg reg2
@@ -47,6 +58,36 @@ module dc_metric
         .out(out)
     );
 
+	// *** Energy, sum of |in| over 16 * n_downsamp samples. The metric grows
+	// linearly with the signal amplitude, so does this sum, their ratio does
+	// not depend on the received optical power ***
+    abs abs1
+    (
+        .in(in_pip),
+        .out(abs_in_w)
+    );
+    shift_reg reg3
+    (
+        .clk(clk),
+        .rst_n(rst_n),
+        .d(abs_in_w),
+        .depth(depth_w),
+        .q(reg3_out_w)
+    );
+    always @(posedge clk)
+    begin
+        if (!rst_n)
+        begin
+            energy_reg <= 0;
+        end
+        else
+        begin
+            energy_reg <= energy_reg + abs_in_w - reg3_out_w;
+        end
+    end
+    
+    assign energy = energy_reg;
+
 	// *** 4-stage pipeline architecture proposed by me ***
     single_reg reg_pip0
     (
@@ -0,0 +1,36 @@
+// Date  : 19 Oct 2026
+
+// ### Description #############################################################
+// Boxcar average before downsampling, the matched filter of the upsampling
+// (sample and hold) in axis_preamble. The samples of the window (en) are
+// summed and y is the average with the sample at dump, 2^shift samples in all.
+
+`timescale 1ns / 1ps
+
+module downsamp_avg
+    (
+        input wire         clk,
+        input wire         rst_n,
+        input wire         clr,
+        input wire         en,
+        input wire         dump,
+        input wire [2:0]   shift,
+        input wire [13:0]  x,
+        output wire [13:0] y
+    );
+    
+    reg signed [18:0] acc_reg;
+    wire signed [18:0] sum_w;
+    
+    assign sum_w = acc_reg + {{5{x[13]}}, x};
+    assign y = sum_w >>> shift;
+    
+    always @(posedge clk)
+    begin
+        if (!rst_n || clr || dump)
+            acc_reg <= 0;
+        else if (en)
+            acc_reg <= sum_w;
+    end
+    
+endmodule
@@ -1,44 +1,119 @@
 // Author: Erwin Ouyang
 // Date  : 7 Feb 2019
 // Update: 07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - CP wait from C_CP_LEN
+//         19 Oct 2026 - Threshold relative to the sum of |x| over the correlator
+//         19 Oct 2026 - Peak spacing window, search timeout, armed per read
 
 `timescale 1ns / 1ps
 
 module fine_detector
+    #(
+        parameter C_CP_LEN = 8          // Cyclic prefix samples, 4 or more
+    )
     (
         input wire        clk,
         input wire        rst_n,
         input wire        en,
         input wire [31:0] y,
-        output wire       trigger_tick
+        input wire [13:0] x,            // Correlator input sample
+        input wire [15:0] fine_ratio,   // 0 = fixed threshold
+        input wire        arm,          // Start of a read, search for peak 1
+        output wire       trigger_tick,
+        output wire [1:0] abort_tick    // 0: search timeout, 1: peak missing
     );
     
+    // *** Peak search ***
+    // The search starts at arm, ignoring the first 16 samples that still
+    // hold the previous read in the correlator. Peaks 2 - 4 are 16 samples
+    // apart, a peak is taken within C_PEAK_TOL samples of that. Without it
+    // the search starts again from peak 1 (abort_tick[1]), the first peak
+    // was noise. Without a trigger C_SEARCH_TIMEOUT samples after arm the
+    // coarse trigger was false (abort_tick[0]) and the detector waits for
+    // the next arm. After a trigger it also waits for the next arm.
+    localparam C_PEAK_TOL = 2,
+               C_PEAK_AT = 14,                  // Counter starts 2 samples after a peak
+               C_SEARCH_TIMEOUT = 128;          // Peak 1 within about 64 samples
+    
+    // A peak needs y >= fine_ratio * sum of |x| over the 16 correlator
+    // samples. An exact preamble gives sum(b^2)/sum(|b|) = 5079 for the
+    // coefficients of fine_corr_dp at any amplitude. With fine_ratio = 0 the
+    // fixed C_FINE_THRESHOLD is used.
     localparam [31:0] C_FINE_THRESHOLD = 32'd200000000;
 
     reg [7:0] _cs, _ns;
     reg [11:0] cnt_fine_timeout_cv, cnt_fine_timeout_nv;    // Counter for fine peak timeout
+    reg [7:0] cnt_search_cv, cnt_search_nv;                 // Counter for samples since arm
+    reg [1:0] abort_nv;
+    reg [1:0] abort_tick_reg;
+    wire spacing_w;
     reg [5:0] cnt_wait_cv, cnt_wait_nv;                     // Counter for removing cyclic prefix
     reg trigger_tick_cv, trigger_tick_nv;
+    wire [13:0] x_abs_w;
+    reg [13:0] x_abs [0:15];
+    reg [17:0] x_sum_reg;                                   // Sum of |x| over 16 samples
+    wire [33:0] fine_thr_w;
+    wire peak_w;
+    integer i;
     
     assign trigger_tick = trigger_tick_cv;
+    assign abort_tick = abort_tick_reg;
+    assign spacing_w = (cnt_fine_timeout_cv >= C_PEAK_AT-C_PEAK_TOL);
+    assign x_abs_w = (x[13]) ? -x : x;
+    assign fine_thr_w = fine_ratio * x_sum_reg;
+    assign peak_w = (fine_ratio == 0) ? (y >= C_FINE_THRESHOLD) : (y >= fine_thr_w);
     
+    // *** Sum of |x|, follows the correlator taps ***
     always @(posedge clk)
     begin
         if (!rst_n)
         begin
-            _cs <= 0;
+            for (i = 0; i <= 15; i = i+1)
+                x_abs[i] <= 0;
+            x_sum_reg <= 0;
+        end
+        else
+        begin
+            if (en)
+            begin
+                for (i = 1; i <= 15; i = i+1)
+                    x_abs[i] <= x_abs[i-1];
+                x_abs[0] <= x_abs_w;
+                x_sum_reg <= x_sum_reg + x_abs_w - x_abs[15];
+            end
+        end
+    end
+    
+    always @(posedge clk)
+    begin
+        if (!rst_n)
+        begin
+            _cs <= 10;
             cnt_fine_timeout_cv <= 0;
+            cnt_search_cv <= 0;
             trigger_tick_cv <= 0;
             cnt_wait_cv <= 0;
+            abort_tick_reg <= 0;
         end
         else
         begin
-            if (en)
+            abort_tick_reg <= 0;
+            if (arm)
+            begin
+                _cs <= 0;
+                cnt_fine_timeout_cv <= 0;
+                cnt_search_cv <= 0;
+                trigger_tick_cv <= 0;
+                cnt_wait_cv <= 0;
+            end
+            else if (en)
             begin 
                 _cs <= _ns;
                 cnt_fine_timeout_cv <= cnt_fine_timeout_nv;
+                cnt_search_cv <= cnt_search_nv;
                 trigger_tick_cv <= trigger_tick_nv;
                 cnt_wait_cv <= cnt_wait_nv;
+                abort_tick_reg <= abort_nv;     // One clock
             end
         end
     end
@@ -47,17 +122,14 @@ module fine_detector
     begin
         _ns = _cs;
         cnt_fine_timeout_nv = cnt_fine_timeout_cv;
+        cnt_search_nv = cnt_search_cv;
         cnt_wait_nv = cnt_wait_cv;
         trigger_tick_nv = 0;
+        abort_nv = 0;
         case (_cs)
             0:  // Wait for peak 1
             begin
-//                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
-//                if (cnt_fine_timeout_cv > 800)  // Timeout
-//                begin
-//                    _ns = 8;
-//                end
-                if (en == 1 && y >= C_FINE_THRESHOLD)    // Peak 1
+                if (en == 1 && peak_w && cnt_search_cv >= 16)    // Peak 1
                 begin
                     _ns = 1;
                 end
@@ -69,15 +141,16 @@ module fine_detector
             end
             2:  // Wait for peak 2
             begin
-//                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
-//                if (cnt_fine_timeout_cv > 400)  // Timeout
-//                begin
-//                    _ns = 8;
-//                end
-                if (en == 1 && y >= C_FINE_THRESHOLD)    // Peak 2
+                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
+                if (en == 1 && peak_w && spacing_w)    // Peak 2
                 begin
                     _ns = 3;
                 end
+                else if (cnt_fine_timeout_cv == C_PEAK_AT+C_PEAK_TOL)  // Timeout
+                begin
+                    abort_nv[1] = 1;
+                    _ns = 0;
+                end
             end
             3:  // Peak 2 found
             begin
@@ -86,15 +159,16 @@ module fine_detector
             end
             4:  // Wait for peak 3
             begin
-//                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
-//                if (cnt_fine_timeout_cv > 400)  // Timeout
-//                begin
-//                    _ns = 8;
-//                end
-                if (en == 1 && y >= C_FINE_THRESHOLD)    // Peak 3
+                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
+                if (en == 1 && peak_w && spacing_w)    // Peak 3
                 begin
                     _ns = 5;
                 end
+                else if (cnt_fine_timeout_cv == C_PEAK_AT+C_PEAK_TOL)  // Timeout
+                begin
+                    abort_nv[1] = 1;
+                    _ns = 0;
+                end
             end
             5:  // Peak 3 found
             begin
@@ -103,15 +177,16 @@ module fine_detector
             end
             6:  // Wait for peak 4
             begin
-//                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
-//                if (cnt_fine_timeout_cv > 400)  // Timeout
-//                begin
-//                    _ns = 8;
-//                end
-                if (en == 1 && y >= C_FINE_THRESHOLD)    // Peak 4
+                cnt_fine_timeout_nv = cnt_fine_timeout_cv + 1;
+                if (en == 1 && peak_w && spacing_w)    // Peak 4
                 begin
                     _ns = 7;
                 end
+                else if (cnt_fine_timeout_cv == C_PEAK_AT+C_PEAK_TOL)  // Timeout
+                begin
+                    abort_nv[1] = 1;
+                    _ns = 0;
+                end
             end
             7:  // Peak 4 found
             begin
@@ -121,18 +196,31 @@ module fine_detector
             8:
             begin
                 cnt_wait_nv = cnt_wait_cv + 1;
-                if (cnt_wait_cv == 4)
+                if (cnt_wait_cv == C_CP_LEN-4)     // 4 samples of the CP pass in the correlator
                 begin
                     trigger_tick_nv = 1;
                     cnt_wait_nv = 0;
-                    _ns = 0;
+                    _ns = 10;
                 end
             end
-            9:
+            9:  // Search timeout
+            begin
+                _ns = 10;
+            end
+            10: // Wait for arm
             begin
-                _ns = 0;
             end
         endcase
+        // Search timeout, before peak 4 is found
+        if (_cs <= 6)
+        begin
+            cnt_search_nv = cnt_search_cv + 1;
+            if (cnt_search_cv == C_SEARCH_TIMEOUT-1)    // No preamble since arm
+            begin
+                abort_nv = 2'b01;
+                _ns = 9;
+            end
+        end
     end
 
 endmodule
@@ -1,11 +1,12 @@
 // Author: Erwin Ouyang
 // Date  : 7 Feb 2019
 // Update: 07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Output tap set by depth, for the downsampling factor
 
 // ### Description #############################################################
 // A shift register for DC metric. From OFDM Baseband Receiver
 // Design for wireless Communications" by Tzi-Dar Chiueh and Pei-Yun Tsai,
-// pp.96, Figure 5.7.
+// pp.96, Figure 5.7. The output is taken depth samples back, up to DEPTH.
 
 `timescale 1ns / 1ps
 
@@ -14,10 +15,11 @@ module shift_reg
         input wire         clk,
         input wire         rst_n,
         input wire [31:0]  d,
+        input wire [8:0]   depth,
         output wire [31:0] q 
     );
 
-    // Number of preamble * oversampling factor = 16 * 25 = 400
+    // Number of preamble * max. oversampling factor = 16 * 25 = 400
     localparam DEPTH = 400;
     
     reg [31:0] fifo [0:DEPTH-1];
@@ -38,6 +40,6 @@ module shift_reg
         end
     end
 
-    assign q = fifo[DEPTH-1];
+    assign q = fifo[depth-1];
     
 endmodule
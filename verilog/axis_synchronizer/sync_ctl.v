@@ -1,10 +1,21 @@
 // Author: Erwin Ouyang
 // Date  : 7 Feb 2019
 // Update: 07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add burst mode, consecutive symbols after one preamble
+//         19 Oct 2026 - Downsampling factor n_downsamp from register, boxcar
+//                       average window
+//         19 Oct 2026 - Symbol length from C_FFT_BITS and C_CP_LEN
+//         19 Oct 2026 - DC threshold relative to the received energy, noise
+//                       floor tracking
+//         19 Oct 2026 - End the read when the fine detector gives up
 
 `timescale 1ns / 1ps
 
 module sync_ctl
+    #(
+        parameter C_FFT_BITS = 6,       // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_CP_LEN = 8          // Cyclic prefix samples, 4 or more
+    )
     (
         input wire         clk,
         input wire         rst_n,
@@ -18,17 +29,60 @@ module sync_ctl
         output wire [12:0] addrb_load,
         // *** Coarse correlation ***
         input wire [31:0]  dc_metric_i,
+        input wire [31:0]  dc_energy_i,
+        input wire [15:0]  dc_ratio,        // 1/256, 0 = fixed threshold
+        input wire [7:0]   nf_margin,       // 1/4, 0 = no noise floor check
+        output wire [31:0] noise_floor,
         // *** Downsample ***
+        input wire [4:0]   n_downsamp,      // 1 - 25
         output wire        valid_downsamp,
+        output wire        avg_en,
+        output wire [2:0]  avg_shift,
+        input wire [13:0]  sample_i,
         // *** Fine correlation ***
         input wire         fine_trigger,
+        input wire         fine_abort,      // No preamble in the read, coarse trigger was false
         output wire        valid_final,
-        output wire        last_final
+        output wire        last_final,
+        // *** Burst ***
+        input wire [7:0]   burst_max        // Symbols per preamble, 0 or 1 = no burst
     );
 
-    localparam [31:0] C_DC_THRESHOLD = 32'd900000,
-                      C_FINE_THRESHOLD = 32'd210000000;
-    localparam [4:0] C_N_DOWNSAMP = 5'd25; 
+    // *** Symbol ***
+    // The fine trigger gives the first sample after the CP of the data
+    // symbol, 2^C_FFT_BITS samples go to the FFT. Without burst the preamble
+    // and the data symbol are read after they are complete in the 8K BRAM,
+    // (72 + C_CP_LEN + 2^C_FFT_BITS + 2) * n_downsamp clock must fit, a 256
+    // FFT needs n_downsamp <= 24.
+    localparam C_N = 1 << C_FFT_BITS;
+    
+    // *** Burst mode ***
+    // With burst_max > 1 the ADC data is written to BRAM while reading, so the
+    // read starts right after the coarse trigger and follows the write back_w
+    // clock behind (1710 at 25). After the C_N samples of a symbol the next
+    // C_CP_LEN samples are the CP of the next symbol of the burst. If the CP
+    // has signal (sum of |x| >= C_BURST_THRESHOLD), its C_N samples are taken
+    // without fine correlation, up to burst_max symbols. The guard interval
+    // at the end of the burst fails the check and the controller goes back
+    // to idle.
+
+    // *** Coarse threshold ***
+    // The DC metric has to reach dc_ratio/256 of dc_energy_i (sum of |x| over
+    // the same window), which holds at any received power. A preamble gives
+    // a metric about equal to the energy, noise a small fraction of it. With
+    // dc_ratio = 0 the fixed threshold dc_thr_w is used. The metric has also
+    // to be above nf_margin/4 times the noise floor, the average metric while
+    // idle (time constant 2^C_NF_SHIFT clock).
+    localparam C_NF_SHIFT = 12;
+
+    // *** Downsampling factor ***
+    // Timing below was measured in clocks with n_downsamp = 25 and scales
+    // with n_downsamp, as does the DC metric (sum over 16 * n_downsamp). Each
+    // sample is the average of the last 2^avg_shift ADC samples of the
+    // period, the largest power of 2 <= n_downsamp.
+    localparam [31:0] C_DC_THRESHOLD = 32'd36000,       // Per 1 n_downsamp, 900000 at 25
+                      C_FINE_THRESHOLD = 32'd210000000,
+                      C_BURST_THRESHOLD = 500 * C_CP_LEN;   // Mean |x| 500 over the CP
     
     reg [7:0] _cs, _ns;
     // *** BRAM ***
@@ -47,9 +101,26 @@ module sync_ctl
     reg last_cv, last_nv;
     // *** Counters ***
     reg [11:0] cnt_plateau_cv, cnt_plateau_nv;              // Counter plateau of DC metric
-    reg [11:0] cnt_wait_sym_cv, cnt_wait_sym_nv;            // Counter for wait until one symbol is inside the FIFO seek
+    reg [12:0] cnt_wait_sym_cv, cnt_wait_sym_nv;            // Counter for wait until one symbol is inside the FIFO seek
     reg [4:0] cnt_downsamp_cv, cnt_downsamp_nv;             // Counter for downsampling
-    reg [5:0] cnt_sample_for_fft_cv, cnt_sample_for_fft_nv; // Counter for counting number of FFT input (64 sample)
+    reg [C_FFT_BITS-1:0] cnt_sample_for_fft_cv, cnt_sample_for_fft_nv; // Counter for counting number of FFT input (C_N sample)
+    // *** Burst ***
+    wire burst_on_w;
+    wire [14:0] sample_abs_w;
+    reg [7:0] cnt_burst_cv, cnt_burst_nv;                   // Symbols taken in this burst, 0 before fine trigger
+    reg [7:0] cnt_cp_cv, cnt_cp_nv;                         // CP samples of the next symbol
+    reg [31:0] energy_cv, energy_nv;                        // Sum of |x| over the CP
+    // *** Downsampling factor ***
+    wire [31:0] dc_thr_w;
+    wire [11:0] plateau_w;
+    wire [12:0] back_w, sym_len_w, wait_sym_w;
+    wire [4:0] downsamp_start_w;
+    // *** Coarse threshold ***
+    wire [47:0] dc_norm_w;
+    wire [39:0] dc_floor_w;
+    wire signed [32:0] nf_diff_w, nf_step_w;
+    reg dc_hit_reg;
+    reg [31:0] noise_floor_reg;
     
     assign wea = wea_cv;
     assign reb = reb_cv;
@@ -58,6 +129,40 @@ module sync_ctl
     assign valid_downsamp = valid_downsamp_cv;
     assign valid_final = valid_downsamp_cv & valid_sync_cv & reb_cv;
     assign last_final = last_cv & valid_final;
+    assign burst_on_w = (burst_max > 1);
+    assign dc_thr_w = C_DC_THRESHOLD * n_downsamp;
+    assign plateau_w = 40 * n_downsamp;             // 1000 clock at 25
+    assign back_w = 68 * n_downsamp + 10;           // 1710 clock at 25
+    assign sym_len_w = (72 + C_CP_LEN + C_N + 2) * n_downsamp;    // 3650 clock at 25, 64 + 8
+    assign wait_sym_w = (C_CP_LEN + C_N + 18) * n_downsamp;       // 2250 clock at 25, 64 + 8
+    assign downsamp_start_w = (n_downsamp > 5) ? n_downsamp - 5 : 0;    // 20 at 25
+    assign avg_shift = (n_downsamp >= 16) ? 4 : (n_downsamp >= 8) ? 3 : (n_downsamp >= 4) ? 2 :
+                       (n_downsamp >= 2) ? 1 : 0;
+    assign avg_en = reb_cv & (cnt_downsamp_cv > n_downsamp - (1 << avg_shift));
+    assign sample_abs_w = (sample_i[13]) ? -{sample_i[13], sample_i} : {sample_i[13], sample_i};
+    assign dc_norm_w = dc_ratio * dc_energy_i;
+    assign dc_floor_w = noise_floor_reg * nf_margin;
+    assign nf_diff_w = $signed({1'b0, dc_metric_i}) - $signed({1'b0, noise_floor_reg});
+    assign nf_step_w = nf_diff_w >>> C_NF_SHIFT;
+    assign noise_floor = noise_floor_reg;
+    
+    // *** Coarse threshold and noise floor ***
+    always @(posedge clk)
+    begin
+        if (!rst_n)
+        begin
+            dc_hit_reg <= 0;
+            noise_floor_reg <= 0;
+        end
+        else
+        begin
+            dc_hit_reg <= ((dc_ratio == 0) ? (dc_metric_i >= dc_thr_w) : ({dc_metric_i, 8'b0} >= dc_norm_w)) &&
+                          ((nf_margin == 0) || ({dc_metric_i, 2'b0} > dc_floor_w));
+            // Only learnt while idle and below the threshold, not from a preamble
+            if (_cs == 0 && !dc_hit_reg)
+                noise_floor_reg <= noise_floor_reg + nf_step_w[31:0];
+        end
+    end
     
     always @(posedge clk)
     begin
@@ -77,6 +182,9 @@ module sync_ctl
             cnt_downsamp_cv <= 0;
             cnt_sample_for_fft_cv <= 0;
             last_cv <= 0;
+            cnt_burst_cv <= 0;
+            cnt_cp_cv <= 0;
+            energy_cv <= 0;
         end
         else
         begin
@@ -94,6 +202,9 @@ module sync_ctl
             cnt_downsamp_cv <= cnt_downsamp_nv;
             cnt_sample_for_fft_cv <= cnt_sample_for_fft_nv;
             last_cv <= last_nv;
+            cnt_burst_cv <= cnt_burst_nv;
+            cnt_cp_cv <= cnt_cp_nv;
+            energy_cv <= energy_nv;
         end
     end
     
@@ -113,16 +224,19 @@ module sync_ctl
         cnt_downsamp_nv = cnt_downsamp_cv;
         cnt_sample_for_fft_nv = cnt_sample_for_fft_cv;
         last_nv = last_cv;
+        cnt_burst_nv = cnt_burst_cv;
+        cnt_cp_nv = cnt_cp_cv;
+        energy_nv = energy_cv;
         case (_cs)
             0:  // Idle, wait for DC metric to be larger than threshold
             begin
                 // If coarse correlation (DC metirc) is larger than threshold
-                if (dc_metric_i >= C_DC_THRESHOLD)
+                if (dc_hit_reg)
                     _ns = 1;
             end
             1:  // Count DC metric duration, and also check if DC metric is drop below threshold
             begin   
-                if (dc_metric_i < C_DC_THRESHOLD)
+                if (!dc_hit_reg)
                 begin
                     // If below threshold, then reset
                     cnt_plateau_nv = 0;
@@ -132,7 +246,7 @@ module sync_ctl
                 begin
                     // Increment plateau counter
                     cnt_plateau_nv = cnt_plateau_cv + 1;
-                    if (cnt_plateau_cv >= 1000)     // Plateatu duration: 8us/8ns = 1000 clock
+                    if (cnt_plateau_cv >= plateau_w)    // Plateatu duration: 8us/8ns = 1000 clock
                     begin
                         cnt_plateau_nv = 0;
                         _ns = 2;
@@ -142,14 +256,15 @@ module sync_ctl
             2:  // Trigger coarse correlation
             begin
                 dc_trigger_nv = 1;
-                addr_at_start_sym_nv = addra - 1710;
-                sym_len_nv = addra - 1710 + 3650;
-                _ns = 3;
+                addr_at_start_sym_nv = addra - back_w;
+                sym_len_nv = addra - back_w + sym_len_w;
+                cnt_burst_nv = 0;
+                _ns = (burst_on_w) ? 4 : 3;     // Burst keeps writing, no need to wait
             end
             3:  // Wait until one complete symbol is in memory
             begin
                 cnt_wait_sym_nv = cnt_wait_sym_cv + 1;
-                if (cnt_wait_sym_cv == 2250)    // 18us/8ns = 2250 clock
+                if (cnt_wait_sym_cv == wait_sym_w)  // 18us/8ns = 2250 clock
                 begin
                     wea_nv = 0;                 // Disable write ADC data to BRAM
                     cnt_wait_sym_nv = 0;
@@ -165,40 +280,91 @@ module sync_ctl
             begin
                 reb_nv = 1;                                 // Enable read address counter
                 cnt_downsamp_nv = cnt_downsamp_cv + 1;      // Increment downsample counter
-                if (cnt_downsamp_cv == (C_N_DOWNSAMP-1))
+                if (cnt_downsamp_cv == (n_downsamp-1))
                 begin
                     cnt_downsamp_nv = 0;
                     valid_downsamp_nv = 1;                  // Pick up a sample
                 end
-                if (fine_trigger)
+                if (fine_trigger && !(burst_on_w && cnt_burst_cv != 0))
                 begin
                     valid_sync_nv = 1;
+                    cnt_burst_nv = 1;
                 end
                 if (valid_sync_cv && valid_downsamp_cv)
                 begin
-                    cnt_sample_for_fft_nv = cnt_sample_for_fft_cv + 1;          // Count number of sample up to 64
-                    if (cnt_sample_for_fft_cv == 62 && valid_downsamp_cv == 1)  // At the last sample
+                    cnt_sample_for_fft_nv = cnt_sample_for_fft_cv + 1;          // Count number of sample up to C_N
+                    if (cnt_sample_for_fft_cv == C_N-2 && valid_downsamp_cv == 1)   // At the last sample
                     begin
                         last_nv = 1;
                     end
-                    if (cnt_sample_for_fft_cv == 63 && valid_downsamp_cv == 1)
+                    if (cnt_sample_for_fft_cv == C_N-1 && valid_downsamp_cv == 1)
                     begin
                         last_nv = 0;
                         valid_sync_nv = 0;
                         cnt_sample_for_fft_nv = 0;
+                        if (burst_on_w)
+                        begin
+                            if (cnt_burst_cv < burst_max)
+                            begin
+                                // Check the CP of the next symbol
+                                cnt_cp_nv = 0;
+                                energy_nv = 0;
+                                _ns = 6;
+                            end
+                            else
+                            begin
+                                // Burst complete
+                                reb_nv = 0;
+                                cnt_downsamp_nv = downsamp_start_w;
+                                _ns = 0;
+                            end
+                        end
                     end
                 end
-                if (addrb == sym_len_cv)
+                // End of the read window, or no preamble found in it, in burst
+                // mode only before the fine trigger
+                if ((addrb == sym_len_cv || fine_abort) && !(burst_on_w && cnt_burst_cv != 0))
                 begin
                     reb_nv = 0;
                     valid_sync_nv = 0;
                     
-                    cnt_downsamp_nv = 20;
+                    cnt_downsamp_nv = downsamp_start_w;
                     wea_nv = 1;
                     
                     _ns = 0;
                 end
             end
+            6:  // Burst, CP of the next symbol
+            begin
+                cnt_downsamp_nv = cnt_downsamp_cv + 1;
+                if (cnt_downsamp_cv == (n_downsamp-1))
+                begin
+                    cnt_downsamp_nv = 0;
+                    valid_downsamp_nv = 1;
+                end
+                if (valid_downsamp_cv)
+                begin
+                    cnt_cp_nv = cnt_cp_cv + 1;
+                    energy_nv = energy_cv + sample_abs_w;
+                    if (cnt_cp_cv == C_CP_LEN-1)
+                    begin
+                        if (energy_nv >= C_BURST_THRESHOLD)
+                        begin
+                            // Next symbol starts with the next sample
+                            valid_sync_nv = 1;
+                            cnt_burst_nv = cnt_burst_cv + 1;
+                            _ns = 5;
+                        end
+                        else
+                        begin
+                            // Guard interval, burst ended early
+                            reb_nv = 0;
+                            cnt_downsamp_nv = downsamp_start_w;
+                            _ns = 0;
+                        end
+                    end
+                end
+            end
         endcase
     end
     
@@ -1,10 +1,20 @@
 // Author: Erwin Ouyang
 // Date  : 7 Feb 2019
 // Update: 07 Feb 2019 - GitHub first commit, from lifi_ap_v2_sync
+//         19 Oct 2026 - Add burst_max port
+//         19 Oct 2026 - Add n_downsamp port and boxcar average before
+//                       downsampling
+//         19 Oct 2026 - Symbol length from C_FFT_BITS and C_CP_LEN
+//         19 Oct 2026 - Add threshold ports and noise floor output
+//         19 Oct 2026 - Add fine detector abort output
 
 `timescale 1ns / 1ps
 
 module synchronizer_v2
+    #(
+        parameter C_FFT_BITS = 6,       // FFT size = 2^C_FFT_BITS, 6 - 8 (64 - 256)
+        parameter C_CP_LEN = 8          // Cyclic prefix samples, 4 or more
+    )
     (
         // *** AXI4 clock and reset port ***
         input wire         aclk,
@@ -32,11 +42,23 @@ module synchronizer_v2
         input wire [31:0]  douta,
         input wire [31:0]  doutb,
         output wire        wea,
-        output wire        web
+        output wire        web,
+        // *** Burst ***
+        input wire [7:0]   burst_max,
+        // *** Downsampling factor, 1 - 25 ***
+        input wire [4:0]   n_downsamp,
+        // *** Thresholds ***
+        input wire [15:0]  dc_ratio,
+        input wire [7:0]   nf_margin,
+        input wire [15:0]  fine_ratio,
+        output wire [31:0] noise_floor,
+        // *** Fine detector aborts, 0: search timeout, 1: peak missing ***
+        output wire [1:0]  fine_abort
     );
 
     wire signed [31:0] adc_data;
     wire signed [31:0] dc_metric_0_out;
+    wire [31:0] dc_metric_0_energy;
     wire [12:0]addr_counter_0_addra;
     wire [12:0]addr_counter_0_addrb;
     wire [12:0] sync_ctl_0_addrb_load;
@@ -48,6 +70,12 @@ module synchronizer_v2
     wire sync_ctl_0_wea;
     wire [31:0] fine_corr_dp_0_y;
     wire fine_detector_0_trigger_tick;
+    wire [1:0] fine_detector_0_abort_tick;
+    wire sync_ctl_0_avg_en;
+    wire [2:0] sync_ctl_0_avg_shift;
+    wire [13:0] downsamp_avg_0_y;
+    reg [4:0] n_downsamp_reg;
+    wire rst_n_w;
     
     assign adc_data = {{18{s_axis_tdata[13]}}, s_axis_tdata[13:0]};     // Sign extentsion of ADC data
     
@@ -65,23 +93,35 @@ module synchronizer_v2
     assign web = 0; 
     
     assign s_axis_tready = 1;
+    assign fine_abort = fine_detector_0_abort_tick;
     
-    assign m_axis_tdata = doutb;
+    assign m_axis_tdata = {{18{downsamp_avg_0_y[13]}}, downsamp_avg_0_y};
     assign m_axis_tvalid = sync_ctl_0_valid_final;
     assign m_axis_tlast = sync_ctl_0_last_final; 
+    
+    // *** Restart the synchronizer when the downsampling factor changes, the
+    // DC metric sums over 16 * n_downsamp clock ***
+    assign rst_n_w = aresetn & (n_downsamp_reg == n_downsamp);
+    
+    always @(posedge aclk)
+    begin
+        n_downsamp_reg <= n_downsamp;
+    end
 
     dc_metric dc_metric_0
     (
         .clk(aclk),
-        .rst_n(aresetn),
+        .rst_n(rst_n_w),
         .in(adc_data),
-        .out(dc_metric_0_out)
+        .n_downsamp(n_downsamp),
+        .out(dc_metric_0_out),
+        .energy(dc_metric_0_energy)
     );
     
     addr_counter addr_counter_0
     (
         .clk(aclk),
-        .rst_n(aresetn),
+        .rst_n(rst_n_w),
         .wea(sync_ctl_0_wea),
         .addra(addr_counter_0_addra),
         .reb(sync_ctl_0_reb),
@@ -93,25 +133,41 @@ module synchronizer_v2
     fine_corr_dp fine_corr_dp_0
     (
         .clk(aclk),
-        .rst_n(aresetn),
+        .rst_n(rst_n_w),
         .en(sync_ctl_0_valid_downsamp),
-        .x(doutb[13:0]),
+        .x(downsamp_avg_0_y),
         .y(fine_corr_dp_0_y)
     );
     
-    fine_detector fine_detector_0
+    downsamp_avg downsamp_avg_0
+    (
+        .clk(aclk),
+        .rst_n(rst_n_w),
+        .clr(~sync_ctl_0_reb),
+        .en(sync_ctl_0_avg_en),
+        .dump(sync_ctl_0_valid_downsamp),
+        .shift(sync_ctl_0_avg_shift),
+        .x(doutb[13:0]),
+        .y(downsamp_avg_0_y)
+    );
+    
+    fine_detector #(.C_CP_LEN(C_CP_LEN)) fine_detector_0
     (
         .clk(aclk),
-        .rst_n(aresetn),
+        .rst_n(rst_n_w),
         .en(sync_ctl_0_valid_downsamp),
         .y(fine_corr_dp_0_y),
-        .trigger_tick(fine_detector_0_trigger_tick)
+        .x(downsamp_avg_0_y),
+        .fine_ratio(fine_ratio),
+        .arm(sync_ctl_0_addrb_load_en),
+        .trigger_tick(fine_detector_0_trigger_tick),
+        .abort_tick(fine_detector_0_abort_tick)
     );
             
-    sync_ctl sync_ctl_0
+    sync_ctl #(.C_FFT_BITS(C_FFT_BITS), .C_CP_LEN(C_CP_LEN)) sync_ctl_0
     (
         .clk(aclk),
-        .rst_n(aresetn),
+        .rst_n(rst_n_w),
         .addra(addr_counter_0_addra),
         .wea(sync_ctl_0_wea),
         .addrb(addr_counter_0_addrb),
@@ -119,10 +175,20 @@ module synchronizer_v2
         .addrb_load_en(sync_ctl_0_addrb_load_en),
         .addrb_load(sync_ctl_0_addrb_load),
         .dc_metric_i(dc_metric_0_out),
+        .dc_energy_i(dc_metric_0_energy),
+        .dc_ratio(dc_ratio),
+        .nf_margin(nf_margin),
+        .noise_floor(noise_floor),
+        .n_downsamp(n_downsamp),
         .valid_downsamp(sync_ctl_0_valid_downsamp),
+        .avg_en(sync_ctl_0_avg_en),
+        .avg_shift(sync_ctl_0_avg_shift),
+        .sample_i(downsamp_avg_0_y),
         .fine_trigger(fine_detector_0_trigger_tick),
+        .fine_abort(fine_detector_0_abort_tick[0]),
         .valid_final(sync_ctl_0_valid_final),
-        .last_final(sync_ctl_0_last_final)
+        .last_final(sync_ctl_0_last_final),
+        .burst_max(burst_max)
     );
     
 endmodule